@@ -0,0 +1,319 @@
+/*
+ * bitcache.c - RAM cache of recently used FPGA bitstreams
+ * 10-17-26
+ *
+ * Bitstreams are kept by the CRC32 of their bytes as stored / sent (so a
+ * compressed container is cached compressed). Flash slot images are kept
+ * as the slot's mmap and cost no heap, so both real ~100kB images stay
+ * cached without crowding WiFi. Uploads are heap copies up to
+ * BITCACHE_MAX_BYTES. Entries are referenced while a config job is using
+ * them and the least recently used unreferenced, unpinned entries are
+ * evicted to make room.
+ */
+
+#include <string.h>
+#include "bitcache.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+
+struct bitcache_ent
+{
+	uint32_t crc;
+	uint32_t size;
+	uint8_t *data;			// NULL for a free entry
+	uint32_t used;			// LRU stamp
+	uint8_t pinned;
+	uint8_t refs;
+	uint8_t mapped;			// data is a flash slot mmap, not heap
+	uint8_t stale;			// slot is being rewritten - drop when idle
+	spi_flash_mmap_handle_t map;
+};
+
+static const char* TAG = "bitcache";
+static struct bitcache_ent bitcache[BITCACHE_ENTRIES];
+static SemaphoreHandle_t bitcache_mutex;
+static uint32_t bitcache_clock, bitcache_bytes;
+static uint32_t bitcache_hits, bitcache_misses, bitcache_evictions;
+
+/*
+ * set up the lock
+ */
+esp_err_t bitcache_init(void)
+{
+	if(!(bitcache_mutex = xSemaphoreCreateMutex()))
+		return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+/*
+ * entry for a CRC, NULL if not cached. Call with the mutex held.
+ */
+static struct bitcache_ent *bitcache_find(uint32_t crc)
+{
+	int i;
+	
+	for(i=0;i<BITCACHE_ENTRIES;i++)
+		if(bitcache[i].data && !bitcache[i].stale && (bitcache[i].crc == crc))
+			return &bitcache[i];
+	return NULL;
+}
+
+/*
+ * let go of an entry's data. Call with the mutex held.
+ */
+static void bitcache_free(struct bitcache_ent *ent)
+{
+	if(ent->mapped)
+		spi_flash_munmap(ent->map);
+	else
+	{
+		bitcache_bytes -= ent->size;
+		free(ent->data);
+	}
+	ent->data = NULL;
+}
+
+/*
+ * drop the least recently used idle entry, only heap copies if heap is
+ * set. Returns 0 if none can go. Call with the mutex held.
+ */
+static uint8_t bitcache_evict(uint8_t heap)
+{
+	struct bitcache_ent *lru = NULL;
+	int i;
+	
+	for(i=0;i<BITCACHE_ENTRIES;i++)
+		if(bitcache[i].data && !bitcache[i].pinned && !bitcache[i].refs &&
+			!(heap && bitcache[i].mapped) &&
+			(!lru || ((int32_t)(bitcache[i].used - lru->used) < 0)))
+			lru = &bitcache[i];
+	if(!lru)
+		return 0;
+	
+	ESP_LOGI(TAG, "Evict 0x%08X, %u bytes", lru->crc, lru->size);
+	bitcache_evictions++;
+	bitcache_free(lru);
+	return 1;
+}
+
+/*
+ * free entry, evicting one if they're all in use. Call with the mutex
+ * held.
+ */
+static struct bitcache_ent *bitcache_slot(void)
+{
+	int i;
+	
+	for(i=0;i<BITCACHE_ENTRIES;i++)
+		if(!bitcache[i].data)
+			return &bitcache[i];
+	if(!bitcache_evict(0))
+		return NULL;
+	for(i=0;bitcache[i].data;i++);
+	return &bitcache[i];
+}
+
+/*
+ * fill in a new entry and take a reference to it. Call with the mutex
+ * held.
+ */
+static void bitcache_fill(struct bitcache_ent *ent, uint32_t crc, uint32_t size)
+{
+	ent->crc = crc;
+	ent->size = size;
+	ent->pinned = 0;
+	ent->refs = 1;
+	ent->stale = 0;
+	ent->used = ++bitcache_clock;
+}
+
+/*
+ * look up a bitstream and take a reference to it. Counts a hit or miss.
+ */
+bitcache_ent_t *bitcache_get(uint32_t crc)
+{
+	struct bitcache_ent *ent;
+	
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	if((ent = bitcache_find(crc)))
+	{
+		ent->refs++;
+		ent->used = ++bitcache_clock;
+		bitcache_hits++;
+	}
+	else
+		bitcache_misses++;
+	xSemaphoreGive(bitcache_mutex);
+	
+	return ent;
+}
+
+/*
+ * cache a bitstream and take a reference to it. With copy clear the
+ * cache adopts the malloc'd data, but only if this succeeds - on NULL
+ * the caller still owns it.
+ */
+bitcache_ent_t *bitcache_add(uint32_t crc, uint8_t *data, uint32_t size, uint8_t copy)
+{
+	struct bitcache_ent *ent;
+	
+	if(size > BITCACHE_MAX_BYTES)
+		return NULL;
+	
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	
+	/* already there */
+	if((ent = bitcache_find(crc)))
+	{
+		if(!copy)
+			free(data);
+		ent->refs++;
+		ent->used = ++bitcache_clock;
+		xSemaphoreGive(bitcache_mutex);
+		return ent;
+	}
+	
+	/* make room - copies also need to leave enough heap */
+	while((bitcache_bytes + size > BITCACHE_MAX_BYTES) || (copy &&
+		(heap_caps_get_free_size(MALLOC_CAP_DMA) < size + BITCACHE_HEAP_MIN)))
+		if(!bitcache_evict(1))
+			goto fail;
+	if(!(ent = bitcache_slot()))
+		goto fail;
+	
+	/* heap copy is DMA capable so config needn't bounce it */
+	if(copy)
+	{
+		if(!(ent->data = heap_caps_malloc(size, MALLOC_CAP_DMA)))
+			goto fail;
+		memcpy(ent->data, data, size);
+	}
+	else
+		ent->data = data;
+	
+	ent->mapped = 0;
+	bitcache_fill(ent, crc, size);
+	bitcache_bytes += size;
+	ESP_LOGI(TAG, "Add 0x%08X, %u bytes, %u total", crc, size, bitcache_bytes);
+	xSemaphoreGive(bitcache_mutex);
+	return ent;
+	
+fail:
+	xSemaphoreGive(bitcache_mutex);
+	ESP_LOGW(TAG, "No room for 0x%08X, %u bytes", crc, size);
+	return NULL;
+}
+
+/*
+ * cache a mapped flash slot and take a reference to it. The cache adopts
+ * the mapping, but only if this succeeds - on NULL the caller still owns
+ * it. Costs an entry but no heap.
+ */
+bitcache_ent_t *bitcache_add_map(uint32_t crc, const uint8_t *data, uint32_t size,
+	spi_flash_mmap_handle_t map)
+{
+	struct bitcache_ent *ent;
+	
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	if((ent = bitcache_find(crc)))
+	{
+		/* already cached - the caller's map isn't needed */
+		spi_flash_munmap(map);
+		ent->refs++;
+		ent->used = ++bitcache_clock;
+	}
+	else if((ent = bitcache_slot()))
+	{
+		ent->data = (uint8_t *)data;
+		ent->mapped = 1;
+		ent->map = map;
+		bitcache_fill(ent, crc, size);
+		ESP_LOGI(TAG, "Add 0x%08X, %u bytes mapped", crc, size);
+	}
+	else
+		ESP_LOGW(TAG, "No room for 0x%08X mapped", crc);
+	xSemaphoreGive(bitcache_mutex);
+	
+	return ent;
+}
+
+/*
+ * forget a mapped slot that's about to be rewritten. One that's in use
+ * goes when its last reference does.
+ */
+void bitcache_drop_map(uint32_t crc)
+{
+	struct bitcache_ent *ent;
+	
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	if((ent = bitcache_find(crc)) && ent->mapped)
+	{
+		ESP_LOGI(TAG, "Drop 0x%08X", crc);
+		if(ent->refs)
+			ent->stale = 1;
+		else
+			bitcache_free(ent);
+	}
+	xSemaphoreGive(bitcache_mutex);
+}
+
+/*
+ * bitstream of a referenced entry
+ */
+uint8_t *bitcache_data(bitcache_ent_t *ent, uint32_t *size)
+{
+	*size = ent->size;
+	return ent->data;
+}
+
+/*
+ * release a reference
+ */
+void bitcache_put(bitcache_ent_t *ent)
+{
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	if(!--ent->refs && ent->stale)
+		bitcache_free(ent);
+	xSemaphoreGive(bitcache_mutex);
+}
+
+/*
+ * pin or unpin a cached bitstream - pinned ones are never evicted
+ */
+esp_err_t bitcache_pin(uint32_t crc, uint8_t pin)
+{
+	struct bitcache_ent *ent;
+	
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	if((ent = bitcache_find(crc)))
+		ent->pinned = pin;
+	xSemaphoreGive(bitcache_mutex);
+	
+	return ent ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+/*
+ * snapshot of counters & contents
+ */
+void bitcache_stats(bitcache_stats_t *stats)
+{
+	int i;
+	
+	memset(stats, 0, sizeof(bitcache_stats_t));
+	xSemaphoreTake(bitcache_mutex, portMAX_DELAY);
+	stats->hits = bitcache_hits;
+	stats->misses = bitcache_misses;
+	stats->evictions = bitcache_evictions;
+	stats->bytes = bitcache_bytes;
+	stats->max_bytes = BITCACHE_MAX_BYTES;
+	for(i=0;i<BITCACHE_ENTRIES;i++)
+		if(bitcache[i].data)
+		{
+			stats->ent[stats->count].crc = bitcache[i].crc;
+			stats->ent[stats->count].size = bitcache[i].size;
+			stats->ent[stats->count].pinned = bitcache[i].pinned;
+			stats->ent[stats->count].refs = bitcache[i].refs;
+			stats->count++;
+		}
+	xSemaphoreGive(bitcache_mutex);
+}
@@ -0,0 +1,50 @@
+/*
+ * bitcache.h - RAM cache of recently used FPGA bitstreams
+ * 10-17-26
+ */
+
+#ifndef __BITCACHE__
+#define __BITCACHE__
+
+#include "main.h"
+#include "esp_spi_flash.h"
+
+#define BITCACHE_MAX_BYTES	(160*1024)	// heap held by cached copies - one real image
+#define BITCACHE_ENTRIES	4
+#define BITCACHE_HEAP_MIN	(48*1024)	// heap left for everyone else
+
+/* error bit for a config-by-CRC request that isn't cached */
+#define BITCACHE_MISS_ERR	0x10
+
+typedef struct bitcache_ent bitcache_ent_t;
+
+/* counters & contents - layout is sent as-is to the host */
+typedef struct
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+	uint32_t bytes;
+	uint32_t max_bytes;
+	uint32_t count;
+	struct
+	{
+		uint32_t crc;
+		uint32_t size;
+		uint32_t pinned;
+		uint32_t refs;
+	} ent[BITCACHE_ENTRIES];
+} bitcache_stats_t;
+
+esp_err_t bitcache_init(void);
+bitcache_ent_t *bitcache_get(uint32_t crc);
+bitcache_ent_t *bitcache_add(uint32_t crc, uint8_t *data, uint32_t size, uint8_t copy);
+bitcache_ent_t *bitcache_add_map(uint32_t crc, const uint8_t *data, uint32_t size,
+	spi_flash_mmap_handle_t map);
+void bitcache_drop_map(uint32_t crc);
+uint8_t *bitcache_data(bitcache_ent_t *ent, uint32_t *size);
+void bitcache_put(bitcache_ent_t *ent);
+esp_err_t bitcache_pin(uint32_t crc, uint8_t pin);
+void bitcache_stats(bitcache_stats_t *stats);
+
+#endif
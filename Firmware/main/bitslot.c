@@ -0,0 +1,292 @@
+/*
+ * bitslot.c - FPGA bitstreams in raw flash partitions
+ * 10-17-26
+ *
+ * Each slot is a data partition holding a small header and the raw
+ * bitstream. Configuration runs straight from an mmap of the slot so
+ * the heap needed doesn't grow with bitstream size. The header is
+ * written last so a slot interrupted mid-write never validates and the
+ * SPIFFS copy is used instead. The header keeps the size & mtime of the
+ * SPIFFS file the slot was written with, so boot can tell from a stat
+ * whether the file was replaced some other way and rewrite the slot
+ * without reading the file every time.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include "bitslot.h"
+#include "bitcache.h"
+#include "rom/crc.h"
+
+#define BITSLOT_MAGIC		0x56454349		// "ICEV"
+#define BITSLOT_SUBTYPE		0x40			// custom data subtype
+#define BITSLOT_MIGRATE_SZ	4096
+
+static const char* TAG = "bitslot";
+
+/* partition labels & the SPIFFS files they replace */
+static const char *bitslot_label[BITSLOT_NUM] =
+{
+	"fpga_cfg", "fpga_pass"
+};
+
+/*
+ * look up a slot
+ */
+static const esp_partition_t *bitslot_part(uint8_t slot)
+{
+	if(slot >= BITSLOT_NUM)
+		return NULL;
+	
+	return esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+		(esp_partition_subtype_t)BITSLOT_SUBTYPE, bitslot_label[slot]);
+}
+
+/*
+ * slot for one of the SPIFFS bitstream file names, -1 if none
+ */
+int8_t bitslot_find(const char *filename)
+{
+	if(!strcmp(filename, cfg_file))
+		return BITSLOT_CFG;
+	else if(!strcmp(filename, spipass_file))
+		return BITSLOT_PASS;
+	else
+		return -1;
+}
+
+/*
+ * read a slot header, checking it looks like one
+ */
+static esp_err_t bitslot_hdr(uint8_t slot, bitslot_hdr_t *hdr)
+{
+	const esp_partition_t *part = bitslot_part(slot);
+	esp_err_t ret;
+	
+	if(!part)
+		return ESP_ERR_NOT_FOUND;
+	if((ret = esp_partition_read(part, 0, hdr, sizeof(bitslot_hdr_t))) != ESP_OK)
+		return ret;
+	if((hdr->magic != BITSLOT_MAGIC) || !hdr->len ||
+		(hdr->len > part->size - sizeof(bitslot_hdr_t)))
+		return ESP_ERR_NOT_FOUND;
+	
+	return ESP_OK;
+}
+
+/*
+ * CRC & size from a slot header without touching the data
+ */
+esp_err_t bitslot_info(uint8_t slot, uint32_t *crc, uint32_t *len)
+{
+	bitslot_hdr_t hdr;
+	esp_err_t ret;
+	
+	if((ret = bitslot_hdr(slot, &hdr)) != ESP_OK)
+		return ret;
+	
+	*crc = hdr.crc;
+	*len = hdr.len;
+	return ESP_OK;
+}
+
+/*
+ * map a valid slot. bitmap points into flash and stays valid until
+ * bitslot_unmap().
+ */
+esp_err_t bitslot_map(uint8_t slot, const uint8_t **bitmap, uint32_t *len,
+	spi_flash_mmap_handle_t *handle)
+{
+	const esp_partition_t *part = bitslot_part(slot);
+	const void *ptr;
+	uint32_t crc;
+	esp_err_t ret;
+	
+	/* header first so a blank slot isn't mapped */
+	if((ret = bitslot_info(slot, &crc, len)) != ESP_OK)
+		return ret;
+	
+	if((ret = esp_partition_mmap(part, 0, *len + sizeof(bitslot_hdr_t),
+		SPI_FLASH_MMAP_DATA, &ptr, handle)) != ESP_OK)
+		return ret;
+	
+	*bitmap = (const uint8_t *)ptr + sizeof(bitslot_hdr_t);
+	
+	if(crc32_le(0, *bitmap, *len) != crc)
+	{
+		ESP_LOGW(TAG, "Slot %d CRC mismatch", slot);
+		spi_flash_munmap(*handle);
+		return ESP_ERR_INVALID_CRC;
+	}
+	
+	return ESP_OK;
+}
+
+/*
+ * release a mapped slot
+ */
+void bitslot_unmap(spi_flash_mmap_handle_t handle)
+{
+	spi_flash_munmap(handle);
+}
+
+/*
+ * erase a slot and get ready to append len bytes
+ */
+esp_err_t bitslot_open(uint8_t slot, uint32_t len, bitslot_wr_t *wr)
+{
+	const esp_partition_t *part = bitslot_part(slot);
+	uint32_t crc, old;
+	
+	if(!part)
+		return ESP_ERR_NOT_FOUND;
+	if(len > part->size - sizeof(bitslot_hdr_t))
+		return ESP_ERR_INVALID_SIZE;
+	
+	/* a cached map of the old contents is about to go bad */
+	if(!bitslot_info(slot, &crc, &old))
+		bitcache_drop_map(crc);
+	
+	wr->part = part;
+	wr->len = 0;
+	wr->crc = 0;
+	
+	/* erase enough for header + data */
+	return esp_partition_erase_range(part, 0,
+		(len + sizeof(bitslot_hdr_t) + SPI_FLASH_SEC_SIZE-1) & ~(SPI_FLASH_SEC_SIZE-1));
+}
+
+/*
+ * add data to an open slot
+ */
+esp_err_t bitslot_append(bitslot_wr_t *wr, const uint8_t *data, uint32_t len)
+{
+	esp_err_t ret;
+	
+	if((ret = esp_partition_write(wr->part, sizeof(bitslot_hdr_t) + wr->len, data, len)) != ESP_OK)
+		return ret;
+	
+	wr->crc = crc32_le(wr->crc, data, len);
+	wr->len += len;
+	return ESP_OK;
+}
+
+/*
+ * finish a slot by writing its header, noting the SPIFFS file that holds
+ * the same data as it is now
+ */
+esp_err_t bitslot_close(bitslot_wr_t *wr, const char *filename)
+{
+	bitslot_hdr_t hdr =
+	{
+		.magic = BITSLOT_MAGIC,
+		.len = wr->len,
+		.crc = wr->crc,
+		.mtime = 0xFFFFFFFF,
+	};
+	struct stat st;
+	
+	if(filename && (stat(filename, &st) == 0))
+		hdr.mtime = st.st_mtime;
+	return esp_partition_write(wr->part, 0, &hdr, sizeof(hdr));
+}
+
+/*
+ * write a whole bitstream to a slot
+ */
+esp_err_t bitslot_save(uint8_t slot, const uint8_t *data, uint32_t len)
+{
+	bitslot_wr_t wr;
+	esp_err_t ret;
+	
+	if(!(ret = bitslot_open(slot, len, &wr)) &&
+		!(ret = bitslot_append(&wr, data, len)))
+		ret = bitslot_close(&wr, NULL);
+	
+	if(ret)
+		ESP_LOGW(TAG, "Slot %d save failed (%s)", slot, esp_err_to_name(ret));
+	else
+		ESP_LOGI(TAG, "Slot %d saved %d bytes, CRC32 = 0x%08X", slot, len, wr.crc);
+	return ret;
+}
+
+/*
+ * copy a SPIFFS bitstream into its slot a sector at a time
+ */
+static esp_err_t bitslot_migrate(uint8_t slot, const char *filename)
+{
+	bitslot_wr_t wr;
+	uint8_t *buffer;
+	uint32_t sz;
+	size_t act;
+	esp_err_t ret;
+	FILE *f;
+	
+	if(!(f = fopen(filename, "rb")))
+		return ESP_ERR_NOT_FOUND;
+	fseek(f, 0L, SEEK_END);
+	sz = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	
+	if(!(buffer = malloc(BITSLOT_MIGRATE_SZ)))
+	{
+		fclose(f);
+		return ESP_ERR_NO_MEM;
+	}
+	
+	ret = bitslot_open(slot, sz, &wr);
+	while(!ret && ((act = fread(buffer, 1, BITSLOT_MIGRATE_SZ, f)) > 0))
+		ret = bitslot_append(&wr, buffer, act);
+	if(!ret)
+		ret = (wr.len == sz) ? bitslot_close(&wr, filename) : ESP_FAIL;
+	
+	free(buffer);
+	fclose(f);
+	return ret;
+}
+
+/*
+ * fill empty or out of date slots from the SPIFFS copies so later boots
+ * skip SPIFFS
+ */
+void bitslot_init(void)
+{
+	const char *files[BITSLOT_NUM] = { cfg_file, spipass_file };
+	spi_flash_mmap_handle_t handle;
+	const uint8_t *bitmap;
+	bitslot_hdr_t hdr;
+	struct stat st;
+	uint32_t len;
+	uint8_t slot, nofile;
+	esp_err_t ret;
+	
+	for(slot=0;slot<BITSLOT_NUM;slot++)
+	{
+		if(!bitslot_part(slot))
+		{
+			ESP_LOGW(TAG, "No partition for slot %d - using SPIFFS", slot);
+			continue;
+		}
+		
+		/* an intact slot is kept if it was written from the file SPIFFS has now */
+		nofile = stat(files[slot], &st) != 0;
+		if(!bitslot_map(slot, &bitmap, &len, &handle))
+		{
+			bitslot_unmap(handle);
+			bitslot_hdr(slot, &hdr);
+			if(nofile || ((hdr.len == st.st_size) && (hdr.mtime == (uint32_t)st.st_mtime)))
+			{
+				ESP_LOGI(TAG, "Slot %d: %d bytes", slot, hdr.len);
+				continue;
+			}
+			ESP_LOGI(TAG, "Slot %d: %d bytes, mtime %u - %s has %ld, %u",
+				slot, hdr.len, hdr.mtime, files[slot], st.st_size, (uint32_t)st.st_mtime);
+		}
+		
+		if((ret = bitslot_migrate(slot, files[slot])))
+			ESP_LOGW(TAG, "Slot %d migrate from %s failed (%s)", slot, files[slot],
+				esp_err_to_name(ret));
+		else
+			ESP_LOGI(TAG, "Slot %d migrated from %s", slot, files[slot]);
+	}
+}
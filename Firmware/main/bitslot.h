@@ -0,0 +1,46 @@
+/*
+ * bitslot.h - FPGA bitstreams in raw flash partitions
+ * 10-17-26
+ */
+
+#ifndef __BITSLOT__
+#define __BITSLOT__
+
+#include "main.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+
+/* slots - match the fpga_* partitions in partitions.csv */
+#define BITSLOT_CFG			0	// default power-on design
+#define BITSLOT_PASS		1	// spi_pass design
+#define BITSLOT_NUM			2
+
+/* header at the start of each slot, data follows */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t len;
+	uint32_t crc;			// CRC32 of the data, matches linux crc32 cmd
+	uint32_t mtime;			// of the SPIFFS file it came from
+} bitslot_hdr_t;
+
+/* in-progress slot write */
+typedef struct
+{
+	const esp_partition_t *part;
+	uint32_t len;
+	uint32_t crc;
+} bitslot_wr_t;
+
+int8_t bitslot_find(const char *filename);
+esp_err_t bitslot_info(uint8_t slot, uint32_t *crc, uint32_t *len);
+esp_err_t bitslot_map(uint8_t slot, const uint8_t **bitmap, uint32_t *len,
+	spi_flash_mmap_handle_t *handle);
+void bitslot_unmap(spi_flash_mmap_handle_t handle);
+esp_err_t bitslot_open(uint8_t slot, uint32_t len, bitslot_wr_t *wr);
+esp_err_t bitslot_append(bitslot_wr_t *wr, const uint8_t *data, uint32_t len);
+esp_err_t bitslot_close(bitslot_wr_t *wr, const char *filename);
+esp_err_t bitslot_save(uint8_t slot, const uint8_t *data, uint32_t len);
+void bitslot_init(void);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * cfgtask.c - FPGA configuration worker task
+ * 10-17-26
+ *
+ * Configuration requests from the socket, serial and boot code are queued
+ * here and run one at a time by a dedicated task which holds ice_mutex
+ * only while the bitstream is going out. Each job can name a queue that
+ * gets the status & timing when it finishes; the event group tells
+ * anyone else when the worker has gone idle.
+ */
+
+#include <string.h>
+#include "cfgtask.h"
+#include "ice.h"
+#include "cfgz.h"
+
+#define CFGTASK_DEPTH		4
+#define CFGTASK_STACK		3072
+#define CFGTASK_PRIO		5
+
+/* queued job */
+typedef struct
+{
+	uint8_t *bitmap;
+	uint32_t size;
+	uint8_t flags;
+	uint8_t retries;
+	uint32_t id;
+	QueueHandle_t reply;
+	spi_flash_mmap_handle_t map;
+	bitcache_ent_t *cache;
+} cfgtask_job_t;
+
+static const char* TAG = "cfgtask";
+static QueueHandle_t cfgtask_queue;
+static uint32_t cfgtask_id, cfgtask_pending;
+static SemaphoreHandle_t cfgtask_lock;
+static cfgtask_result_t cfgtask_last;
+EventGroupHandle_t cfgtask_events;
+
+/*
+ * one less job outstanding - signal idle when none are left
+ */
+static void cfgtask_done(void)
+{
+	xSemaphoreTake(cfgtask_lock, portMAX_DELAY);
+	if(!--cfgtask_pending)
+		xEventGroupSetBits(cfgtask_events, CFGTASK_IDLE);
+	xSemaphoreGive(cfgtask_lock);
+}
+
+/*
+ * let go of a job's bitstream
+ */
+static void cfgtask_release(cfgtask_job_t *job)
+{
+	if(job->flags & CFGTASK_FREE)
+		free(job->bitmap);
+	if(job->flags & CFGTASK_UNMAP)
+		spi_flash_munmap(job->map);
+	if(job->flags & CFGTASK_CACHE)
+		bitcache_put(job->cache);
+}
+
+/*
+ * configure from a plain or compressed bitstream
+ */
+static uint8_t cfgtask_config(cfgtask_job_t *job, uint32_t *raw)
+{
+	if(cfgz_check(job->bitmap, job->size))
+		return cfgz_config(job->bitmap, job->size, raw);
+	
+	*raw = job->size;
+	return ICE_FPGA_Config(job->bitmap, job->size);
+}
+
+/*
+ * worker - runs queued configuration jobs forever
+ */
+static void cfgtask_task(void *pvParameters)
+{
+	cfgtask_job_t job;
+	cfgtask_result_t result;
+	
+	while(1)
+	{
+		xQueueReceive(cfgtask_queue, &job, portMAX_DELAY);
+		
+		/* only hold the FPGA port for the config itself */
+		ICE_Lock(portMAX_DELAY);
+		/* a damaged container (3) won't do any better next time */
+		while((result.status = cfgtask_config(&job, &result.raw)) &&
+			(result.status != 3) && job.retries--)
+			ESP_LOGW(TAG, "Job %u config ERROR - status = %d", job.id, result.status);
+		ICE_Unlock();
+		
+		result.id = job.id;
+		result.size = job.size;
+		result.us = ICE_FPGA_Config_Time(&result.hz);
+		if(result.status)
+			ESP_LOGW(TAG, "Job %u config ERROR - giving up", job.id);
+		else
+			ESP_LOGI(TAG, "Job %u configured OK - %u us @ %d Hz", job.id, result.us, result.hz);
+		
+		cfgtask_release(&job);
+		
+		/* notify */
+		xSemaphoreTake(cfgtask_lock, portMAX_DELAY);
+		cfgtask_last = result;
+		xSemaphoreGive(cfgtask_lock);
+		if(job.reply)
+			xQueueSend(job.reply, &result, 0);
+		cfgtask_done();
+	}
+}
+
+/*
+ * start the worker
+ */
+esp_err_t cfgtask_init(void)
+{
+	cfgtask_last.status = 255;
+	cfgtask_queue = xQueueCreate(CFGTASK_DEPTH, sizeof(cfgtask_job_t));
+	cfgtask_events = xEventGroupCreate();
+	cfgtask_lock = xSemaphoreCreateMutex();
+	if(!cfgtask_queue || !cfgtask_events || !cfgtask_lock)
+		return ESP_ERR_NO_MEM;
+	xEventGroupSetBits(cfgtask_events, CFGTASK_IDLE);
+	
+	if(xTaskCreate(cfgtask_task, "fpgacfg", CFGTASK_STACK, NULL, CFGTASK_PRIO, NULL) != pdPASS)
+		return ESP_FAIL;
+	else
+		return ESP_OK;
+}
+
+/*
+ * assign an id and queue a job, releasing its bitstream if that fails
+ */
+static uint32_t cfgtask_queue_job(cfgtask_job_t *job)
+{
+	/* id 0 is reserved for failure */
+	xSemaphoreTake(cfgtask_lock, portMAX_DELAY);
+	if(!++cfgtask_id)
+		cfgtask_id++;
+	job->id = cfgtask_id;
+	cfgtask_pending++;
+	xEventGroupClearBits(cfgtask_events, CFGTASK_IDLE);
+	xSemaphoreGive(cfgtask_lock);
+	
+	if(xQueueSend(cfgtask_queue, job, 0) != pdTRUE)
+	{
+		ESP_LOGW(TAG, "Job queue full");
+		cfgtask_release(job);
+		cfgtask_done();
+		return 0;
+	}
+	
+	return job->id;
+}
+
+/*
+ * queue a bitstream for configuration. With CFGTASK_FREE the worker owns
+ * the buffer from here on, even on failure. Returns the job id or 0 if the
+ * queue is full.
+ */
+uint32_t cfgtask_submit(uint8_t *bitmap, uint32_t size, uint8_t flags,
+	uint8_t retries, QueueHandle_t reply)
+{
+	cfgtask_job_t job;
+	
+	job.bitmap = bitmap;
+	job.size = size;
+	job.flags = flags & CFGTASK_FREE;
+	job.retries = retries;
+	job.reply = reply;
+	
+	return cfgtask_queue_job(&job);
+}
+
+/*
+ * queue a bitstream mapped from flash. The worker owns the mapping and
+ * unmaps it when done, even on failure.
+ */
+uint32_t cfgtask_submit_map(const uint8_t *bitmap, uint32_t size,
+	spi_flash_mmap_handle_t map, uint8_t retries, QueueHandle_t reply)
+{
+	cfgtask_job_t job;
+	
+	/* read-only - config never writes to the bitstream */
+	job.bitmap = (uint8_t *)bitmap;
+	job.size = size;
+	job.flags = CFGTASK_UNMAP;
+	job.retries = retries;
+	job.reply = reply;
+	job.map = map;
+	
+	return cfgtask_queue_job(&job);
+}
+
+/*
+ * queue a cached bitstream. The worker owns the reference and releases
+ * it when done, even on failure.
+ */
+uint32_t cfgtask_submit_cached(bitcache_ent_t *ent, uint8_t retries, QueueHandle_t reply)
+{
+	cfgtask_job_t job;
+	
+	job.bitmap = bitcache_data(ent, &job.size);
+	job.flags = CFGTASK_CACHE;
+	job.retries = retries;
+	job.reply = reply;
+	job.cache = ent;
+	
+	return cfgtask_queue_job(&job);
+}
+
+/*
+ * wait on a reply queue for the result of a given job, dropping stale
+ * results of earlier jobs that timed out
+ */
+esp_err_t cfgtask_result(QueueHandle_t reply, uint32_t id, cfgtask_result_t *result,
+	TickType_t wait)
+{
+	while(xQueueReceive(reply, result, wait) == pdTRUE)
+		if(result->id == id)
+			return ESP_OK;
+	
+	return ESP_ERR_TIMEOUT;
+}
+
+/*
+ * wait for the worker to finish everything queued, returns the last result
+ */
+esp_err_t cfgtask_wait_idle(cfgtask_result_t *last, TickType_t wait)
+{
+	if(!(xEventGroupWaitBits(cfgtask_events, CFGTASK_IDLE, pdFALSE, pdTRUE, wait) & CFGTASK_IDLE))
+		return ESP_ERR_TIMEOUT;
+	
+	if(last)
+		*last = cfgtask_last;
+	return ESP_OK;
+}
+
+/*
+ * result of the most recent job, status 255 if none has run
+ */
+void cfgtask_get_last(cfgtask_result_t *last)
+{
+	xSemaphoreTake(cfgtask_lock, portMAX_DELAY);
+	*last = cfgtask_last;
+	xSemaphoreGive(cfgtask_lock);
+}
@@ -0,0 +1,47 @@
+/*
+ * cfgtask.h - FPGA configuration worker task
+ * 10-17-26
+ */
+
+#ifndef __CFGTASK__
+#define __CFGTASK__
+
+#include "main.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "esp_spi_flash.h"
+#include "bitcache.h"
+
+/* job flags */
+#define CFGTASK_FREE		(1<<0)	// worker frees the bitstream when done
+#define CFGTASK_UNMAP		(1<<1)	// worker unmaps the flash bitstream when done
+#define CFGTASK_CACHE		(1<<2)	// worker releases the cache entry when done
+
+/* event group bits */
+#define CFGTASK_IDLE		(1<<0)	// no jobs queued or running
+
+/* job completion report */
+typedef struct
+{
+	uint32_t id;			// from cfgtask_submit()
+	uint8_t status;			// ICE_FPGA_Config() result, 255 if never run
+	uint32_t us;			// config time incl. clock step-downs
+	int hz;					// config clock that was used
+	uint32_t size;			// bitstream size as stored / sent
+	uint32_t raw;			// bitstream size after decompression
+} cfgtask_result_t;
+
+extern EventGroupHandle_t cfgtask_events;
+
+esp_err_t cfgtask_init(void);
+uint32_t cfgtask_submit(uint8_t *bitmap, uint32_t size, uint8_t flags,
+	uint8_t retries, QueueHandle_t reply);
+uint32_t cfgtask_submit_map(const uint8_t *bitmap, uint32_t size,
+	spi_flash_mmap_handle_t map, uint8_t retries, QueueHandle_t reply);
+uint32_t cfgtask_submit_cached(bitcache_ent_t *ent, uint8_t retries, QueueHandle_t reply);
+esp_err_t cfgtask_result(QueueHandle_t reply, uint32_t id, cfgtask_result_t *result,
+	TickType_t wait);
+esp_err_t cfgtask_wait_idle(cfgtask_result_t *last, TickType_t wait);
+void cfgtask_get_last(cfgtask_result_t *last);
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * cfgz.c - compressed FPGA bitstream container
+ * 10-17-26
+ *
+ * iCE40 bitstreams are mostly runs of zeros so they're stored and sent
+ * as an LZSS stream made by python/cfgz.py. The stream is decoded into a
+ * window-sized ring which goes out to the FPGA each time it fills, so
+ * only CFGZ_WIN bytes of RAM are needed whatever the bitstream size.
+ *
+ * Stream format: a flag byte covers the next 8 items, LSB first. A set
+ * bit is one literal byte, a clear bit is a 2-byte match:
+ *   byte 0 = distance-1 bits 7:0
+ *   byte 1 = distance-1 bits 11:8 in 7:4, length-3 in 3:0
+ * A length field of 15 is followed by a byte that's added to the length.
+ *
+ * The decoder takes a container a piece at a time, so the same code
+ * unpacks payloads that are sent compressed as they come off the wire and
+ * stored containers, which are fed to it whole.
+ */
+
+#include <string.h>
+#include "cfgz.h"
+#include "ice.h"
+#include "rom/crc.h"
+#include "esp_heap_caps.h"
+
+#define CFGZ_MIN_MATCH		3
+#define CFGZ_EXT_LEN		15
+
+/* streaming decoder states */
+enum
+{
+	CFGZ_S_ITEM,		// flag byte, literal or first match byte
+	CFGZ_S_M1,			// second match byte
+	CFGZ_S_MEXT,		// extended match length
+};
+
+/* a stored container being decoded whole */
+typedef struct
+{
+	const uint8_t *data;
+	uint32_t size;
+	cfgz_out_t out;
+} cfgz_feed_t;
+
+static const char* TAG = "cfgz";
+
+/*
+ * check for a container header that matches the data size
+ */
+uint8_t cfgz_check(const uint8_t *data, uint32_t size)
+{
+	cfgz_hdr_t hdr;
+	
+	if(size < sizeof(hdr))
+		return 0;
+	
+	/* may be unaligned or in flash */
+	memcpy(&hdr, data, sizeof(hdr));
+	return (hdr.magic == CFGZ_MAGIC) && (hdr.zlen == size - sizeof(hdr));
+}
+
+/*
+ * start a streaming decode, NULL if there's no memory
+ */
+cfgz_stream_t *cfgz_stream_new(void)
+{
+	cfgz_stream_t *z;
+	
+	if(!(z = calloc(1, sizeof(cfgz_stream_t))))
+		return NULL;
+	
+	/* ring goes straight to the SPI DMA */
+	if(!(z->ring = heap_caps_malloc(CFGZ_WIN, MALLOC_CAP_DMA)))
+	{
+		free(z);
+		return NULL;
+	}
+	z->state = CFGZ_S_ITEM;
+	return z;
+}
+
+/*
+ * take container header bytes, returns how many were used
+ */
+uint32_t cfgz_stream_hdr(cfgz_stream_t *z, const uint8_t *data, uint32_t len)
+{
+	uint32_t sz = sizeof(cfgz_hdr_t) - z->hdrsz;
+	
+	sz = sz <= len ? sz : len;
+	memcpy((uint8_t *)&z->hdr + z->hdrsz, data, sz);
+	z->hdrsz += sz;
+	return sz;
+}
+
+/*
+ * pass on what's been decoded since last time
+ */
+static void cfgz_stream_flush(cfgz_stream_t *z, cfgz_out_t out, void *ctx)
+{
+	uint8_t *chunk = z->ring + (z->done % CFGZ_WIN);
+	uint32_t len = z->out - z->done;
+	
+	if(!len)
+		return;
+	z->crc = crc32_le(z->crc, chunk, len);
+	z->done = z->out;
+	out(ctx, chunk, len);
+}
+
+/*
+ * one decoded byte, passing on the ring each time it fills
+ */
+static inline void cfgz_stream_put(cfgz_stream_t *z, uint8_t b, cfgz_out_t out, void *ctx)
+{
+	z->ring[z->out++ % CFGZ_WIN] = b;
+	if(!(z->out % CFGZ_WIN))
+		cfgz_stream_flush(z, out, ctx);
+}
+
+/*
+ * decode the next piece of stream after the header
+ */
+void cfgz_stream_write(cfgz_stream_t *z, const uint8_t *data, uint32_t len,
+	cfgz_out_t out, void *ctx)
+{
+	uint8_t b;
+	
+	while(len-- && !z->err)
+	{
+		b = *data++;
+		if(z->state == CFGZ_S_ITEM)
+		{
+			if(!z->nflags)
+			{
+				z->flags = b;
+				z->nflags = 8;
+				continue;
+			}
+			if(z->out >= z->hdr.len)
+			{
+				/* more stream than bitstream */
+				z->err = 1;
+				break;
+			}
+			
+			z->nflags--;
+			if(z->flags & 1)
+				cfgz_stream_put(z, b, out, ctx);
+			else
+			{
+				z->b0 = b;
+				z->state = CFGZ_S_M1;
+			}
+			z->flags >>= 1;
+			continue;
+		}
+		else if(z->state == CFGZ_S_M1)
+		{
+			z->mdist = (((b & 0xF0) << 4) | z->b0) + 1;
+			z->mlen = (b & 0x0F) + CFGZ_MIN_MATCH;
+			if((b & 0x0F) == CFGZ_EXT_LEN)
+			{
+				z->state = CFGZ_S_MEXT;
+				continue;
+			}
+		}
+		else
+			z->mlen += b;
+		
+		/* match complete - can't reach back before the start or past the end */
+		z->state = CFGZ_S_ITEM;
+		if((z->mdist > z->out) || (z->mlen > z->hdr.len - z->out))
+		{
+			z->err = 1;
+			break;
+		}
+		while(z->mlen--)
+			cfgz_stream_put(z, z->ring[(z->out - z->mdist) % CFGZ_WIN], out, ctx);
+	}
+}
+
+/*
+ * pass on the rest, returns nonzero if the stream was incomplete or damaged
+ */
+uint8_t cfgz_stream_end(cfgz_stream_t *z, cfgz_out_t out, void *ctx)
+{
+	if(!z->err)
+		cfgz_stream_flush(z, out, ctx);
+	
+	if(z->err || (z->hdrsz != sizeof(cfgz_hdr_t)) || (z->out != z->hdr.len) ||
+		(z->crc != z->hdr.crc) || (z->state != CFGZ_S_ITEM))
+	{
+		ESP_LOGW(TAG, "Bad stream @ %u of %u bytes", z->out, z->hdr.len);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * done with a streaming decode
+ */
+void cfgz_stream_free(cfgz_stream_t *z)
+{
+	free(z->ring);
+	free(z);
+}
+
+/*
+ * decoded data goes nowhere on the check pass
+ */
+static void cfgz_check_out(void *ctx, uint8_t *data, uint32_t len)
+{
+}
+
+/*
+ * decoded data goes straight to the FPGA
+ */
+static void cfgz_config_out(void *ctx, uint8_t *data, uint32_t len)
+{
+	ICE_FPGA_Config_Write(data, len);
+}
+
+/*
+ * decode the whole container, also a config pass feed. 3 if it was damaged.
+ */
+static uint8_t cfgz_decode(void *ctx)
+{
+	cfgz_feed_t *feed = ctx;
+	cfgz_stream_t *z;
+	uint32_t sz;
+	uint8_t bad;
+	
+	if(!(z = cfgz_stream_new()))
+		return 3;
+	sz = cfgz_stream_hdr(z, feed->data, feed->size);
+	cfgz_stream_write(z, feed->data + sz, feed->size - sz, feed->out, NULL);
+	bad = cfgz_stream_end(z, feed->out, NULL);
+	cfgz_stream_free(z);
+	return bad ? 3 : 0;
+}
+
+/*
+ * configure the FPGA from a container. Returns the ICE_FPGA_Config()
+ * status or 3 if the stream was damaged. raw gets the decompressed size.
+ * The stream is decoded and its CRC checked before the FPGA is reset, so
+ * a damaged one leaves the running design alone.
+ */
+uint8_t cfgz_config(const uint8_t *data, uint32_t size, uint32_t *raw)
+{
+	cfgz_feed_t feed = { data, size, cfgz_check_out };
+	cfgz_hdr_t hdr;
+	uint8_t result;
+	
+	memcpy(&hdr, data, sizeof(hdr));
+	*raw = hdr.len;
+	
+	if((result = cfgz_decode(&feed)))
+		return result;
+	
+	feed.out = cfgz_config_out;
+	if(!(result = ICE_FPGA_Config_Feed(cfgz_decode, &feed)))
+		ESP_LOGI(TAG, "Decompressed %u -> %u bytes, ratio %u.%02u", size, hdr.len,
+			hdr.len/size, (100*(hdr.len%size))/size);
+	return result;
+}
@@ -0,0 +1,48 @@
+/*
+ * cfgz.h - compressed FPGA bitstream container
+ * 10-17-26
+ */
+
+#ifndef __CFGZ__
+#define __CFGZ__
+
+#include "main.h"
+
+#define CFGZ_MAGIC			0x5A454349	// "ICEZ"
+#define CFGZ_WIN			4096		// history window & output chunk
+
+/* container header, compressed stream follows */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t len;			// decompressed bitstream size
+	uint32_t crc;			// CRC32 of the decompressed bitstream
+	uint32_t zlen;			// compressed stream size
+} cfgz_hdr_t;
+
+/* streaming decoder output, gets the data a ring's worth at a time */
+typedef void (*cfgz_out_t)(void *ctx, uint8_t *data, uint32_t len);
+
+/* streaming decoder for a container that arrives in pieces */
+typedef struct
+{
+	cfgz_hdr_t hdr;
+	uint32_t hdrsz;			// header bytes in so far
+	uint8_t *ring;
+	uint32_t out, done;		// decoded & passed on
+	uint32_t crc;
+	uint8_t state, flags, nflags, b0;
+	uint32_t mdist, mlen;
+	uint8_t err;
+} cfgz_stream_t;
+
+uint8_t cfgz_check(const uint8_t *data, uint32_t size);
+uint8_t cfgz_config(const uint8_t *data, uint32_t size, uint32_t *raw);
+cfgz_stream_t *cfgz_stream_new(void);
+uint32_t cfgz_stream_hdr(cfgz_stream_t *z, const uint8_t *data, uint32_t len);
+void cfgz_stream_write(cfgz_stream_t *z, const uint8_t *data, uint32_t len,
+	cfgz_out_t out, void *ctx);
+uint8_t cfgz_stream_end(cfgz_stream_t *z, cfgz_out_t out, void *ctx);
+void cfgz_stream_free(cfgz_stream_t *z);
+
+#endif
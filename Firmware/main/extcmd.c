@@ -0,0 +1,390 @@
+/*
+ * extcmd.c - extended commands shared by the TCP and USB interfaces
+ * 10-17-26
+ *
+ * Command 7 carries an extended opcode in the first payload word so new
+ * functions don't use up the few remaining header command nybbles. Each
+ * handler returns the usual error bits and an optional variable length
+ * reply which the caller sends after the error byte and a 32-bit length.
+ */
+
+#include <string.h>
+#include "extcmd.h"
+#include "ice.h"
+#include "cfgtask.h"
+#include "bitcache.h"
+#include "upload.h"
+#include "script.h"
+#include "timedq.h"
+#include "sampler.h"
+#include "psops.h"
+
+/* longest a register poll may tie up a connection */
+#define EXTCMD_POLL_MAX_US	(10*1000*1000)
+
+/* most sample data in one reply */
+#define EXTCMD_SAMPLE_READ_SZ	4096
+
+static const char* TAG = "extcmd";
+
+/*
+ * bus profiler snapshot: class count, bin count, then the classes
+ */
+static uint8_t extcmd_stats(uint8_t **reply, uint32_t *replysz)
+{
+	uint32_t *hdr;
+	
+	*replysz = 8 + ICE_PROF_NUM*sizeof(ice_prof_t);
+	if(!(*reply = malloc(*replysz)))
+		return 1;
+	
+	hdr = (uint32_t *)*reply;
+	hdr[0] = ICE_PROF_NUM;
+	hdr[1] = ICE_PROF_BINS;
+	ICE_Prof_Get((ice_prof_t *)(*reply + 8));
+	
+	return 0;
+}
+
+/*
+ * last config: id, status, time, clock, stored & decompressed sizes
+ */
+static uint8_t extcmd_cfg_info(uint8_t **reply, uint32_t *replysz)
+{
+	cfgtask_result_t last;
+	uint32_t *info;
+	
+	/* doesn't wait - a job in progress reports the one before */
+	cfgtask_get_last(&last);
+	
+	*replysz = 6*sizeof(uint32_t);
+	if(!(*reply = malloc(*replysz)))
+		return 1;
+	
+	info = (uint32_t *)*reply;
+	info[0] = last.id;
+	info[1] = last.status;
+	info[2] = last.us;
+	info[3] = last.hz;
+	info[4] = last.size;
+	info[5] = last.raw;
+	
+	return 0;
+}
+
+/*
+ * bitstream cache snapshot
+ */
+static uint8_t extcmd_cache_stats(uint8_t **reply, uint32_t *replysz)
+{
+	*replysz = sizeof(bitcache_stats_t);
+	if(!(*reply = malloc(*replysz)))
+		return 1;
+	
+	bitcache_stats((bitcache_stats_t *)*reply);
+	return 0;
+}
+
+/*
+ * pin (args CRC, 1) or unpin (args CRC, 0) a cached bitstream
+ */
+static uint8_t extcmd_cache_pin(uint8_t *args, uint32_t argsz)
+{
+	uint32_t crc, pin;
+	
+	if(argsz < 8)
+		return 8;
+	memcpy(&crc, args, 4);
+	memcpy(&pin, args+4, 4);
+	
+	if(bitcache_pin(crc, pin ? 1 : 0))
+		return BITCACHE_MISS_ERR;
+	
+	ESP_LOGI(TAG, "%s 0x%08X", pin ? "Pinned" : "Unpinned", crc);
+	return 0;
+}
+
+/*
+ * argument words that follow each register vector op
+ */
+static int8_t extcmd_vec_args(uint8_t type)
+{
+	switch(type)
+	{
+		case EXTCMD_VEC_READ:	return 0;
+		case EXTCMD_VEC_WRITE:	return 1;
+		case EXTCMD_VEC_RMW:	return 2;
+		case EXTCMD_VEC_SET:	return 1;
+		case EXTCMD_VEC_CLR:	return 1;
+		default:				return -1;
+	}
+}
+
+/*
+ * run a vector of register ops back to back, reply is a word per read.
+ * The whole vector is one turn at the FPGA.
+ */
+static uint8_t extcmd_reg_vec(uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	uint32_t i, nreads = 0, w[2], Data, *rptr;
+	int8_t nargs;
+	
+	/* check it all before touching the FPGA */
+	for(i=0;i<argsz;i+=2+4*nargs)
+	{
+		if((i+2 > argsz) || ((nargs = extcmd_vec_args(args[i])) < 0))
+			return 8;
+		nreads += (args[i] == EXTCMD_VEC_READ);
+	}
+	if(i != argsz)
+		return 8;
+	
+	*replysz = 4*nreads;
+	if(nreads && !(*reply = malloc(*replysz)))
+		return 1;
+	rptr = (uint32_t *)*reply;
+	if(ICE_Lock((TickType_t)100) != pdTRUE)
+	{
+		ESP_LOGW(TAG, "Couldn't get FPGA access");
+		free(*reply);
+		*reply = NULL;
+		*replysz = 0;
+		return 1;
+	}
+	
+	for(i=0;i<argsz;i+=2+4*nargs)
+	{
+		uint8_t type = args[i], Reg = args[i+1] & 0x7f;
+		
+		nargs = extcmd_vec_args(type);
+		memcpy(w, &args[i+2], 4*nargs);
+		if(type == EXTCMD_VEC_WRITE)
+		{
+			ICE_FPGA_Serial_Write(Reg, w[0]);
+			continue;
+		}
+		
+		ICE_FPGA_Serial_Read(Reg, &Data);
+		if(type == EXTCMD_VEC_READ)
+			*rptr++ = Data;
+		else
+		{
+			if(type == EXTCMD_VEC_RMW)
+				Data = (Data & ~w[0]) | (w[1] & w[0]);
+			else if(type == EXTCMD_VEC_SET)
+				Data |= w[0];
+			else
+				Data &= ~w[0];
+			ICE_FPGA_Serial_Write(Reg, Data);
+		}
+	}
+	ICE_Unlock();
+	
+	ESP_LOGI(TAG, "Register vector: %d bytes, %d reads", argsz, nreads);
+	return 0;
+}
+
+/*
+ * poll a register (args reg, mask, expected, timeout us, optional interval
+ * us) until (value & mask) == expected. Replies with the last value, the
+ * number of reads and the time taken whether it matched or not.
+ */
+static uint8_t extcmd_reg_poll(uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	uint32_t w[5] = {0};
+	ice_poll_t *poll;
+	uint8_t err;
+	
+	if((argsz != 16) && (argsz != 20))
+		return 8;
+	memcpy(w, args, argsz);
+	if(w[3] > EXTCMD_POLL_MAX_US)
+		return 8;
+	
+	if(!(poll = malloc(sizeof(ice_poll_t))))
+		return 1;
+	err = ICE_FPGA_Serial_Poll(w[0] & 0x7f, w[1], w[2], w[3], w[4], poll);
+	
+	*reply = (uint8_t *)poll;
+	*replysz = sizeof(ice_poll_t);
+	ESP_LOGI(TAG, "Poll reg %d: 0x%08X after %u reads, %u us%s", w[0] & 0x7f,
+		poll->Data, poll->polls, poll->us, err ? " - no match" : "");
+	return err;
+}
+
+/*
+ * run stored script (args number) or one sent as the args, reply is how
+ * far it got
+ */
+static uint8_t extcmd_script_run(uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	script_result_t *result;
+	uint8_t err;
+	
+	if(argsz < 4)
+		return 8;
+	if(!(result = malloc(sizeof(script_result_t))))
+		return 1;
+	
+	if(argsz == 4)
+		err = script_run(*(uint32_t *)args, result);
+	else
+		err = script_exec(args, argsz, result);
+	
+	*reply = (uint8_t *)result;
+	*replysz = sizeof(script_result_t);
+	return err;
+}
+
+/*
+ * chunked upload ops - all reply with where the upload is up to
+ */
+static uint8_t extcmd_upload(uint32_t op, uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	upload_status_t *status;
+	uint8_t err = 0;
+	
+	if(!(status = malloc(sizeof(upload_status_t))))
+		return 1;
+	
+	if(op == EXTCMD_UPLOAD_BEGIN)
+		err = upload_begin(args, argsz, status);
+	else if(op == EXTCMD_UPLOAD_CHUNK)
+		err = upload_chunk(args, argsz, status);
+	else
+		upload_status(status);
+	
+	*reply = (uint8_t *)status;
+	*replysz = sizeof(upload_status_t);
+	return err;
+}
+
+/*
+ * register sampler ops - start (period, then register bytes) and stop
+ * reply with the stats as they are after, read with a batch of samples
+ */
+static uint8_t extcmd_sample(uint32_t op, uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	uint8_t err = 0;
+	
+	if(op == EXTCMD_SAMPLE_READ)
+	{
+		if(!(*reply = malloc(EXTCMD_SAMPLE_READ_SZ)))
+			return 1;
+		*replysz = sampler_read(*reply, EXTCMD_SAMPLE_READ_SZ);
+		return 0;
+	}
+	
+	if(op == EXTCMD_SAMPLE_START)
+		err = argsz > 4 ? sampler_start(*(uint32_t *)args, args+4, argsz-4) : 8;
+	else if(op == EXTCMD_SAMPLE_STOP)
+		sampler_stop();
+	
+	if(!(*reply = malloc(sizeof(sampler_stats_t))))
+		return err | 1;
+	sampler_stats((sampler_stats_t *)*reply);
+	*replysz = sizeof(sampler_stats_t);
+	return err;
+}
+
+/*
+ * PSRAM ops - fill (addr, len, pattern), copy (dst, src, len) and CRC
+ * (addr, len) with the CRC as the reply
+ */
+static uint8_t extcmd_psram(uint32_t op, uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	uint32_t w[3];
+	uint8_t err;
+	
+	if(argsz < (op == EXTCMD_PS_CRC ? 8 : 12))
+		return 8;
+	memcpy(w, args, op == EXTCMD_PS_CRC ? 8 : 12);
+	
+	if(op == EXTCMD_PS_FILL)
+		return psops_fill(w[0], w[1], w[2]);
+	if(op == EXTCMD_PS_COPY)
+		return psops_copy(w[0], w[1], w[2]);
+	
+	if(!(*reply = malloc(4)))
+		return 1;
+	err = psops_crc(w[0], w[1], (uint32_t *)*reply);
+	*replysz = 4;
+	ESP_LOGI(TAG, "PSRAM CRC 0x%08X + 0x%X = 0x%08X", w[0], w[1], *(uint32_t *)*reply);
+	return err;
+}
+
+/*
+ * dispatch an extended command. *reply is malloc'd by the handler and
+ * must be freed by the caller.
+ */
+uint8_t extcmd_handle(uint8_t *buffer, uint32_t txsz, uint8_t **reply, uint32_t *replysz)
+{
+	uint32_t op;
+	
+	*reply = NULL;
+	*replysz = 0;
+	
+	if(txsz < 4)
+		return 8;
+	op = *(uint32_t *)buffer;
+	
+	switch(op)
+	{
+		case EXTCMD_STATS:
+			return extcmd_stats(reply, replysz);
+		
+		case EXTCMD_STATS_RESET:
+			ICE_Prof_Reset();
+			return 0;
+		
+		case EXTCMD_CFG_INFO:
+			return extcmd_cfg_info(reply, replysz);
+		
+		case EXTCMD_CACHE_STATS:
+			return extcmd_cache_stats(reply, replysz);
+		
+		case EXTCMD_CACHE_PIN:
+			return extcmd_cache_pin(buffer+4, txsz-4);
+		
+		case EXTCMD_REG_VEC:
+			return extcmd_reg_vec(buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_REG_POLL:
+			return extcmd_reg_poll(buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_SCRIPT_SAVE:
+			if(txsz < 8)
+				return 8;
+			return script_save(*(uint32_t *)(buffer+4), buffer+8, txsz-8);
+		
+		case EXTCMD_SCRIPT_RUN:
+			return extcmd_script_run(buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_SCRIPT_STOP:
+			script_stop();
+			return 0;
+		
+		case EXTCMD_TIMED:
+			return timedq_run(buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_SAMPLE_START:
+		case EXTCMD_SAMPLE_STOP:
+		case EXTCMD_SAMPLE_STATS:
+		case EXTCMD_SAMPLE_READ:
+			return extcmd_sample(op, buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_PS_FILL:
+		case EXTCMD_PS_COPY:
+		case EXTCMD_PS_CRC:
+			return extcmd_psram(op, buffer+4, txsz-4, reply, replysz);
+		
+		case EXTCMD_UPLOAD_BEGIN:
+		case EXTCMD_UPLOAD_CHUNK:
+		case EXTCMD_UPLOAD_STATUS:
+			return extcmd_upload(op, buffer+4, txsz-4, reply, replysz);
+		
+		default:
+			ESP_LOGW(TAG, "Unknown extended command 0x%02X", op);
+			return 8;
+	}
+}
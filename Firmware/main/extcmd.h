@@ -0,0 +1,47 @@
+/*
+ * extcmd.h - extended commands shared by the TCP and USB interfaces
+ * 10-17-26
+ */
+
+#ifndef __EXTCMD__
+#define __EXTCMD__
+
+#include "main.h"
+
+/* header command nybble for extended commands */
+#define EXTCMD_CMD			7
+
+/* extended opcodes - first word of the payload */
+#define EXTCMD_STATS		0x00	// read bus profiler
+#define EXTCMD_STATS_RESET	0x01	// clear bus profiler
+#define EXTCMD_CFG_INFO		0x02	// last FPGA config result
+#define EXTCMD_CACHE_STATS	0x03	// bitstream cache counters & contents
+#define EXTCMD_CACHE_PIN	0x04	// pin / unpin a cached bitstream by CRC
+#define EXTCMD_REPLY_MODE	0x05	// USB only: 0 = text, 1 = binary frames
+#define EXTCMD_REG_VEC		0x06	// vector of register ops in one FPGA turn
+#define EXTCMD_UPLOAD_BEGIN	0x07	// start a chunked upload: cmd, size, CRC32
+#define EXTCMD_UPLOAD_CHUNK	0x08	// next chunk: offset, CRC32, data
+#define EXTCMD_UPLOAD_STATUS	0x09	// where the upload is up to
+#define EXTCMD_REG_POLL		0x0A	// read a register until it matches
+#define EXTCMD_SCRIPT_SAVE	0x0B	// store a script: number, script
+#define EXTCMD_SCRIPT_RUN	0x0C	// run a stored script, or one sent along
+#define EXTCMD_TIMED		0x0D	// ops fired at set times, results logged
+#define EXTCMD_SAMPLE_START	0x0E	// sample registers: period us, registers
+#define EXTCMD_SAMPLE_STOP	0x0F	// stop sampling
+#define EXTCMD_SAMPLE_STATS	0x10	// sampler counters
+#define EXTCMD_SAMPLE_READ	0x11	// samples from the ring, for USB
+#define EXTCMD_PS_FILL		0x12	// PSRAM addr, len filled with a word
+#define EXTCMD_PS_COPY		0x13	// PSRAM dst, src, len
+#define EXTCMD_PS_CRC		0x14	// CRC32 of PSRAM addr, len
+#define EXTCMD_SCRIPT_STOP	0x15	// stop the command script that's running
+
+/* register vector ops - type byte, register byte, then the listed words */
+#define EXTCMD_VEC_READ		0x00	// none - value goes in the reply
+#define EXTCMD_VEC_WRITE	0x01	// data
+#define EXTCMD_VEC_RMW		0x02	// mask, data - masked bits replaced
+#define EXTCMD_VEC_SET		0x03	// bits to set
+#define EXTCMD_VEC_CLR		0x04	// bits to clear
+
+uint8_t extcmd_handle(uint8_t *buffer, uint32_t txsz, uint8_t **reply, uint32_t *replysz);
+
+#endif
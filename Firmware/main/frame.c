@@ -0,0 +1,88 @@
+/*
+ * frame.c - COBS framed binary replies for the USB interface
+ * 10-17-26
+ *
+ * In binary reply mode the USB interface sends each reply as a frame
+ * instead of a text line, so PSRAM and extended command data come back
+ * as raw bytes rather than 64-byte base64 lines. Before encoding a frame
+ * is:
+ *   type (1), body length (2), body, CRC32 of all before it (4)
+ * all little endian. It's COBS encoded so it has no zero bytes and is
+ * followed by a single zero, which lets the host find the next frame
+ * after a bad one.
+ */
+
+#include "frame.h"
+#include "rom/crc.h"
+
+/* encoder state */
+typedef struct
+{
+	uint8_t *out;
+	uint32_t n;			// next output byte
+	uint32_t code;		// where the current block's code byte goes
+	uint32_t crc;
+} frame_enc_t;
+
+/*
+ * COBS encode raw frame bytes
+ */
+static void frame_put(frame_enc_t *enc, const uint8_t *data, uint32_t len)
+{
+	enc->crc = crc32_le(enc->crc, data, len);
+	
+	while(len--)
+	{
+		if(*data)
+		{
+			enc->out[enc->n++] = *data;
+			
+			/* block is full at 254 bytes - start another without a zero */
+			if(enc->n - enc->code == 0xff)
+			{
+				enc->out[enc->code] = 0xff;
+				enc->code = enc->n++;
+			}
+		}
+		else
+		{
+			/* zero ends the block */
+			enc->out[enc->code] = enc->n - enc->code;
+			enc->code = enc->n++;
+		}
+		data++;
+	}
+}
+
+/*
+ * build a frame in out, which must hold FRAME_ENC_SZ(len). Returns the
+ * encoded size including the trailing zero.
+ */
+uint32_t frame_encode(uint8_t type, const uint8_t *body, uint32_t len, uint8_t *out)
+{
+	frame_enc_t enc;
+	uint8_t hdr[3], crc[4];
+	
+	enc.out = out;
+	enc.code = 0;
+	enc.n = 1;
+	enc.crc = 0;
+	
+	hdr[0] = type;
+	hdr[1] = len & 0xff;
+	hdr[2] = (len >> 8) & 0xff;
+	frame_put(&enc, hdr, 3);
+	frame_put(&enc, body, len);
+	
+	crc[0] = enc.crc & 0xff;
+	crc[1] = (enc.crc >> 8) & 0xff;
+	crc[2] = (enc.crc >> 16) & 0xff;
+	crc[3] = (enc.crc >> 24) & 0xff;
+	frame_put(&enc, crc, 4);
+	
+	/* close the last block and delimit */
+	out[enc.code] = enc.n - enc.code;
+	out[enc.n++] = 0;
+	
+	return enc.n;
+}
@@ -0,0 +1,24 @@
+/*
+ * frame.h - COBS framed binary replies for the USB interface
+ * 10-17-26
+ */
+
+#ifndef __FRAME__
+#define __FRAME__
+
+#include "main.h"
+
+#define FRAME_MAX			4096	// most body bytes in one frame
+
+/* worst case encoded size of a frame with n body bytes */
+#define FRAME_ENC_SZ(n)		((n) + 7 + ((n) + 7)/254 + 2)
+
+/* frame types */
+#define FRAME_STATUS		0x01	// error byte, 32-bit data
+#define FRAME_DATA			0x02	// block of reply data
+#define FRAME_END			0x03	// no more data frames
+#define FRAME_TEXT			0x04	// error byte, text
+
+uint32_t frame_encode(uint8_t type, const uint8_t *body, uint32_t len, uint8_t *out);
+
+#endif
@@ -11,6 +11,10 @@
 #include "soc/spi_periph.h"
 #include "esp_rom_gpio.h"
 #include "hal/gpio_hal.h"
+#include "esp_heap_caps.h"
+#include "soc/soc_memory_layout.h"
+#include "soc/gpio_sig_map.h"
+#include "esp_timer.h"
 
 /**
   * @brief  SPI Interface pins
@@ -23,20 +27,175 @@
 #define ICE_CDONE_PIN		0 //5
 #define ICE_CRST_PIN		1 //4
 
-#define ICE_SPI_CS_LOW()	gpio_set_level(ICE_SPI_CS_PIN,0)
-#define ICE_SPI_CS_HIGH()	gpio_set_level(ICE_SPI_CS_PIN,1)
+#define ICE_SPI_CS_LOW()	do{ICE_SPI_CS_Route(ICE_CS_GPIO);gpio_set_level(ICE_SPI_CS_PIN,0);}while(0)
+#define ICE_SPI_CS_HIGH()	do{ICE_SPI_CS_Route(ICE_CS_GPIO);gpio_set_level(ICE_SPI_CS_PIN,1);}while(0)
 #define ICE_CRST_LOW()		gpio_set_level(ICE_CRST_PIN,0)
 #define ICE_CRST_HIGH()		gpio_set_level(ICE_CRST_PIN,1)
 #define ICE_CDONE_GET()		gpio_get_level(ICE_CDONE_PIN)
 #define ICE_SPI_DUMMY_BYTE	0xFF
 #define ICE_SPI_MAX_XFER	4096
+#define ICE_SPI_NUM_BUFS	2
+#define ICE_SPI_NUM_TRANS	6
+#define ICE_SPI_POLL_MAX	64
+
+/* CS owners - hardware owners match the CS slot of their device, which */
+/* are handed out in the order devices are added. Slot 0 is the GPIO-  */
+/* framed bulk device and slot 5 the GPIO-framed config device.         */
+#define ICE_CS_GPIO			0
+#define ICE_CS_REG			1
+#define ICE_CS_PSRAM_WR		2
+#define ICE_CS_PSRAM_RD		3
+#define ICE_CS_DUAL			4
+
+/* LY68L6400 PSRAM access */
+#define ICE_PSRAM_CLK_HZ	(40*1000*1000)
+#define ICE_PSRAM_PAGE		1024	// wrap boundary of linear bursts
+#define ICE_PSRAM_TCEM_NS	8000	// max CS low time
+#define ICE_PSRAM_HDR_BITS	48		// cmd + addr + dummy + timing margin
+#define ICE_PSRAM_BURST_MAX	32		// max burst for 0x02/0x03 class cmds
+#define ICE_PSRAM_WRITE		0x02
+#define ICE_PSRAM_FAST_READ	0x0B
+
+/* slave config clock steps - fastest first, 10MHz is the original rate */
+#define ICE_CFG_NUM_CLK		4
+static const int ice_cfg_clk[ICE_CFG_NUM_CLK] =
+{
+	40*1000*1000, 80*1000*1000/3, 20*1000*1000, 10*1000*1000
+};
+#define ICE_CFG_TCR_US		1200	// CRESET_B high to first SCK
+#define ICE_CFG_LEAD_CLKS	8		// dummy clocks with CS high before data
+#define ICE_CFG_TRAIL_CLKS	160		// clocks after data to start user mode
+
+/* dual I/O bulk path in spi_dual.v */
+#define ICE_DUAL_CLK_HZ		(20*1000*1000)
+#define ICE_DUAL_WRITE		0x7F
+#define ICE_DUAL_READ		0xFF
+#define ICE_DUAL_TURN_BITS	8		// turnaround clocks before read data
 
 static const char* TAG = "ice";
-static spi_device_handle_t spi;
+static spi_device_handle_t spi, spi_reg, spi_psram_wr, spi_psram_rd, spi_dual;
+static spi_device_handle_t spi_cfg;
+static uint8_t ice_cfg_step;
+static uint32_t ice_cfg_us, ice_cfg_bytes;
+static int64_t ice_cfg_start;
+static uint8_t ice_cs_owner;
+static uint32_t ice_psram_burst;
+
+/* ping-pong buffers & transaction ring for the queued block engine */
+static uint8_t *ice_dma_buf[ICE_SPI_NUM_BUFS];
+static spi_transaction_t ice_dma_trans[ICE_SPI_NUM_TRANS];
+static spi_device_handle_t ice_dma_dev;
+static uint8_t ice_dma_next, ice_dma_pending;
 
 /* resource locking */
 xSemaphoreHandle ice_mutex;
 
+/* bus profiler */
+static ice_prof_t ice_prof[ICE_PROF_NUM];
+static portMUX_TYPE ice_prof_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * add one operation that began at start to a profiler class
+ */
+static void ICE_Prof_Add(uint8_t cls, int64_t start, uint32_t bytes)
+{
+	uint32_t us = esp_timer_get_time() - start, bin = 0;
+	ice_prof_t *p = &ice_prof[cls];
+	
+	while(us >> bin && bin < ICE_PROF_BINS-1)
+		bin++;
+	
+	portENTER_CRITICAL(&ice_prof_mux);
+	p->count++;
+	p->bytes += bytes;
+	p->total_us += us;
+	if(us > p->max_us)
+		p->max_us = us;
+	p->hist[bin]++;
+	portEXIT_CRITICAL(&ice_prof_mux);
+}
+
+/*
+ * snapshot of all profiler classes
+ */
+void ICE_Prof_Get(ice_prof_t *prof)
+{
+	portENTER_CRITICAL(&ice_prof_mux);
+	memcpy(prof, ice_prof, sizeof(ice_prof));
+	portEXIT_CRITICAL(&ice_prof_mux);
+}
+
+/*
+ * clear all profiler classes
+ */
+void ICE_Prof_Reset(void)
+{
+	portENTER_CRITICAL(&ice_prof_mux);
+	memset(ice_prof, 0, sizeof(ice_prof));
+	portEXIT_CRITICAL(&ice_prof_mux);
+}
+
+/*
+ * take the FPGA port, counting the wait in the profiler
+ */
+BaseType_t ICE_Lock(TickType_t wait)
+{
+	int64_t start = esp_timer_get_time();
+	BaseType_t result = xSemaphoreTake(ice_mutex, wait);
+	
+	ICE_Prof_Add(ICE_PROF_MUTEX, start, 0);
+	return result;
+}
+
+/*
+ * release the FPGA port
+ */
+void ICE_Unlock(void)
+{
+	xSemaphoreGive(ice_mutex);
+}
+
+/*
+ * Give the CS pad to the hardware CS of a register/PSRAM device or to
+ * GPIO for the manually framed config & block transfers. Only touches
+ * the GPIO matrix when the owner changes.
+ */
+static void ICE_SPI_CS_Route(uint8_t owner)
+{
+	if(owner == ice_cs_owner)
+		return;
+	
+	if(owner != ICE_CS_GPIO)
+		esp_rom_gpio_connect_out_signal(ICE_SPI_CS_PIN,
+			spi_periph_signal[ICE_SPI_HOST].spics_out[owner], false, false);
+	else
+		esp_rom_gpio_connect_out_signal(ICE_SPI_CS_PIN, SIG_GPIO_OUT_IDX, false, false);
+	ice_cs_owner = owner;
+}
+
+/*
+ * (re)attach the config stream device at a new clock. Its slot is the
+ * last one so removing & adding it again doesn't disturb the others.
+ */
+static void ICE_SPI_Cfg_Clock(int hz)
+{
+    esp_err_t ret;
+    spi_device_interface_config_t cfgcfg={
+        .clock_speed_hz=hz,
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=-1,                       //CS is GPIO framed
+        .queue_size=ICE_SPI_NUM_TRANS+1,
+    };
+	
+	if(spi_cfg)
+	{
+		ret=spi_bus_remove_device(spi_cfg);
+		ESP_ERROR_CHECK(ret);
+	}
+    ret=spi_bus_add_device(ICE_SPI_HOST, &cfgcfg, &spi_cfg);
+    ESP_ERROR_CHECK(ret);
+}
+
 /*
  * init the FPGA interface
  */
@@ -57,6 +216,43 @@ void ICE_Init(void)
         .spics_io_num=-1,                       //CS pin not used
         .queue_size=7,                          //We want to be able to queue 7 transactions at a time
     };
+    spi_device_interface_config_t regcfg={
+        .command_bits=8,                        //R/W bit + 7-bit register address
+        .clock_speed_hz=10*1000*1000,           //Clock out at 10 MHz
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=ICE_SPI_CS_PIN,           //hardware CS for registers
+        .queue_size=1,
+    };
+    spi_device_interface_config_t pswrcfg={
+        .command_bits=8,
+        .address_bits=24,
+        .clock_speed_hz=ICE_PSRAM_CLK_HZ,
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=ICE_SPI_CS_PIN,           //hardware CS per burst
+        .flags=SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_NO_DUMMY,
+        .queue_size=1,                          //bursts are polled
+    };
+    spi_device_interface_config_t psrdcfg={
+        .command_bits=8,
+        .address_bits=24,
+        .dummy_bits=8,                          //fast read wait cycles
+        .clock_speed_hz=ICE_PSRAM_CLK_HZ,
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=ICE_SPI_CS_PIN,           //hardware CS per burst
+        .input_delay_ns=25,                     //round trip thru spi_pass
+        .flags=SPI_DEVICE_HALFDUPLEX,
+        .queue_size=1,                          //bursts are polled
+    };
+    spi_device_interface_config_t dualcfg={
+        .command_bits=8,                        //single-bit mode command
+        .clock_speed_hz=ICE_DUAL_CLK_HZ,
+        .mode=0,                                //SPI mode 0
+        .spics_io_num=ICE_SPI_CS_PIN,           //hardware CS per block
+        .input_delay_ns=10,                     //FPGA negedge clk->out
+        .flags=SPI_DEVICE_HALFDUPLEX,
+        .queue_size=1,
+    };
+	uint8_t i;
 	
 	/* create the mutex for access to the FPGA port */
 	vSemaphoreCreateBinary(ice_mutex);
@@ -72,12 +268,44 @@ void ICE_Init(void)
     /* Attach the SPI bus */
     ret=spi_bus_add_device(ICE_SPI_HOST, &devcfg, &spi);
     ESP_ERROR_CHECK(ret);
+	
+	/* Attach the register, PSRAM & dual devices - CS is routed back to GPIO below */
+    ret=spi_bus_add_device(ICE_SPI_HOST, &regcfg, &spi_reg);
+    ESP_ERROR_CHECK(ret);
+    ret=spi_bus_add_device(ICE_SPI_HOST, &pswrcfg, &spi_psram_wr);
+    ESP_ERROR_CHECK(ret);
+    ret=spi_bus_add_device(ICE_SPI_HOST, &psrdcfg, &spi_psram_rd);
+    ESP_ERROR_CHECK(ret);
+    ret=spi_bus_add_device(ICE_SPI_HOST, &dualcfg, &spi_dual);
+    ESP_ERROR_CHECK(ret);
+	
+	/* PSRAM bursts must fit in tCEM along with their header */
+	ice_psram_burst = (((uint64_t)ICE_PSRAM_TCEM_NS * ICE_PSRAM_CLK_HZ) / 1000000000ULL
+		- ICE_PSRAM_HDR_BITS) / 8;
+	if(ice_psram_burst > ICE_PSRAM_BURST_MAX)
+		ice_psram_burst = ICE_PSRAM_BURST_MAX;
+	ESP_LOGI(TAG, "PSRAM burst %d bytes @ %d Hz", ice_psram_burst, ICE_PSRAM_CLK_HZ);
+	
+	/* DMA-capable bounce buffers for the block engine */
+	for(i=0;i<ICE_SPI_NUM_BUFS;i++)
+	{
+		ice_dma_buf[i] = heap_caps_malloc(ICE_SPI_MAX_XFER, MALLOC_CAP_DMA);
+		assert(ice_dma_buf[i] != NULL);
+	}
+	ice_dma_next = 0;
+	ice_dma_pending = 0;
+	
+	/* config device goes in the last slot - start at the fastest clock */
+	ice_cfg_step = 0;
+	ice_cfg_us = 0;
+	ICE_SPI_Cfg_Clock(ice_cfg_clk[ice_cfg_step]);
 
     /* Initialize non-SPI GPIOs */
 	/* pins 4-7 must be reset prior to use to get out of JTAG mode */
     ESP_LOGI(TAG, "Initialize GPIO");
 	gpio_reset_pin(ICE_SPI_CS_PIN);
     gpio_set_direction(ICE_SPI_CS_PIN, GPIO_MODE_OUTPUT);
+	ice_cs_owner = ICE_CS_GPIO;
 	ICE_SPI_CS_HIGH();
 	gpio_reset_pin(ICE_CRST_PIN);
 	gpio_set_direction(ICE_CRST_PIN, GPIO_MODE_OUTPUT);
@@ -87,82 +315,198 @@ void ICE_Init(void)
 }
 
 /*
- * Write a block of bytes to the ICE SPI
+ * wait for the oldest queued block transaction to complete
  */
-void ICE_SPI_WriteBlk(uint8_t *Data, uint32_t Count)
+static void ICE_SPI_Wait(void)
 {
     esp_err_t ret;
-    spi_transaction_t t = {0};
+	spi_transaction_t *rt;
+	
+	ret=spi_device_get_trans_result(ice_dma_dev, &rt, portMAX_DELAY);
+	assert(ret==ESP_OK);
+	
+	/* bounced receive data goes back to the caller's buffer */
+	if(rt->user)
+		memcpy(rt->user, rt->rx_buffer, rt->rxlength/8);
+	
+	ice_dma_pending--;
+}
+
+/*
+ * get the next free transaction slot, waiting for the oldest one if
+ * depth transactions are already on the bus. Returns the slot number.
+ */
+static uint8_t ICE_SPI_NextTrans(spi_device_handle_t dev, uint8_t depth,
+	spi_transaction_t **t)
+{
+	uint8_t slot;
+	
+	/* slots are used in order so the oldest pending is always reused */
+	if(ice_dma_pending == depth)
+		ICE_SPI_Wait();
+	
+	slot = ice_dma_next;
+	ice_dma_next = (ice_dma_next + 1) % ICE_SPI_NUM_TRANS;
+	ice_dma_dev = dev;
+	*t = &ice_dma_trans[slot];
+	memset(*t, 0, sizeof(spi_transaction_t));
+	
+	return slot;
+}
+
+/*
+ * put a prepared transaction on the bus queue
+ */
+static void ICE_SPI_Queue(spi_transaction_t *t)
+{
+    esp_err_t ret;
+	
+	ret=spi_device_queue_trans(ice_dma_dev, t, portMAX_DELAY);
+	assert(ret==ESP_OK);
+	ice_dma_pending++;
+}
+
+/*
+ * wait for all queued block transactions to complete
+ */
+static void ICE_SPI_Flush(void)
+{
+	while(ice_dma_pending)
+		ICE_SPI_Wait();
+}
+
+/*
+ * Write a block of bytes to the ICE SPI on a GPIO-framed device
+ * Large blocks are queued to the DMA engine two at a time so the next
+ * chunk is ready when the current one finishes and the calling task
+ * sleeps (rather than spins) while the bus is busy.
+ */
+static void ICE_SPI_TxBlk(spi_device_handle_t dev, uint8_t *Data, uint32_t Count)
+{
+    esp_err_t ret;
+    spi_transaction_t *t;
+	uint8_t *buf;
 	uint32_t bytes;
 	
+	/* short transfers aren't worth the interrupt overhead */
+	if(Count <= ICE_SPI_POLL_MAX)
+	{
+		spi_transaction_t pt = {0};
+		
+		pt.length=8*Count;
+		pt.tx_buffer=Data;
+		ret=spi_device_polling_transmit(dev, &pt);  //Transmit!
+		assert(ret==ESP_OK);            //Should have had no issues.
+		return;
+	}
+	
 	while(Count)
 	{
 		bytes = (Count > ICE_SPI_MAX_XFER) ? ICE_SPI_MAX_XFER : Count;
 		
-		memset(&t, 0, sizeof(spi_transaction_t));
-		t.length=8*bytes;	
-		t.tx_buffer=Data;               //The data is the cmd itself
-		ret=spi_device_polling_transmit(spi, &t);  //Transmit!
-		assert(ret==ESP_OK);            //Should have had no issues.
+		buf = ice_dma_buf[ICE_SPI_NextTrans(dev, ICE_SPI_NUM_BUFS, &t) % ICE_SPI_NUM_BUFS];
+		t->length=8*bytes;
+		if(esp_ptr_dma_capable(Data))
+			t->tx_buffer=Data;			// DMA straight from caller
+		else
+		{
+			memcpy(buf, Data, bytes);	// bounce from flash etc.
+			t->tx_buffer=buf;
+		}
+		ICE_SPI_Queue(t);
 		
 		Count -= bytes;
 		Data += bytes;
 	}
+	
+	ICE_SPI_Flush();
+}
+
+/*
+ * Write a block of bytes to the ICE SPI
+ */
+void ICE_SPI_WriteBlk(uint8_t *Data, uint32_t Count)
+{
+	ICE_SPI_TxBlk(spi, Data, Count);
 }
 
 /*
  * Read a block of bytes from the ICE SPI
+ * Same queued scheme as writes. Destinations that DMA can't land in
+ * directly are received in the ping-pong buffers and copied out.
  */
 void ICE_SPI_ReadBlk(uint8_t *Data, uint32_t Count)
 {
     esp_err_t ret;
-    spi_transaction_t t = {0};
+    spi_transaction_t *t;
+	uint8_t *buf;
 	uint32_t bytes;
 	
+	/* short transfers aren't worth the interrupt overhead */
+	if(Count <= ICE_SPI_POLL_MAX)
+	{
+		spi_transaction_t pt = {0};
+		
+		pt.length=8*Count;
+		pt.rxlength = pt.length;
+		pt.rx_buffer = Data;
+		ret=spi_device_polling_transmit(spi, &pt);  //Transmit!
+		assert(ret==ESP_OK);            //Should have had no issues.
+		return;
+	}
+	
 	while(Count)
 	{
 		bytes = (Count > ICE_SPI_MAX_XFER) ? ICE_SPI_MAX_XFER : Count;
 		
-		memset(&t, 0, sizeof(spi_transaction_t));
-		t.length=8*bytes;
-		t.rxlength = t.length;
-		t.rx_buffer = Data;
-		ret=spi_device_polling_transmit(spi, &t);  //Transmit!
-		assert(ret==ESP_OK);            //Should have had no issues.
+		buf = ice_dma_buf[ICE_SPI_NextTrans(spi, ICE_SPI_NUM_BUFS, &t) % ICE_SPI_NUM_BUFS];
+		t->length=8*bytes;
+		t->rxlength = t->length;
+		if(esp_ptr_dma_capable(Data) && !((uintptr_t)Data & 3) && !(bytes & 3))
+			t->rx_buffer = Data;		// DMA straight to caller
+		else
+		{
+			t->rx_buffer = buf;			// copied out in ICE_SPI_Wait()
+			t->user = Data;
+		}
+		ICE_SPI_Queue(t);
 		
 		Count -= bytes;
 		Data += bytes;
 	}
+	
+	ICE_SPI_Flush();
 }
 
 /*
- * Bitbang the SPI_SCK - used for new timing config
+ * send clocks with CS high using the config device
  */
-void ICE_SPI_ClkToggle(uint32_t cycles)
+static void ICE_SPI_Cfg_Clocks(uint32_t cycles)
 {
-	/* configure SCK pin for GPIO output */
-    esp_rom_gpio_pad_select_gpio(ICE_SPI_SCK_PIN);
-	gpio_set_direction(ICE_SPI_SCK_PIN, GPIO_MODE_OUTPUT);
+	uint8_t dummy[ICE_CFG_TRAIL_CLKS/8];
 	
-	/* toggle for cycles */
-	while(cycles--)
-	{
-		gpio_set_level(ICE_SPI_SCK_PIN, 1);
-		gpio_set_level(ICE_SPI_SCK_PIN, 0);
-	}
-	
-	/* restore SCK pin to SPI control */
-    esp_rom_gpio_connect_out_signal(ICE_SPI_SCK_PIN, spi_periph_signal[ICE_SPI_HOST].spiclk_out, false, false);
-    esp_rom_gpio_connect_in_signal(ICE_SPI_SCK_PIN, spi_periph_signal[ICE_SPI_HOST].spiclk_in, false);
+	memset(dummy, ICE_SPI_DUMMY_BYTE, sizeof(dummy));
+	ICE_SPI_TxBlk(spi_cfg, dummy, (cycles+7)/8);
 }
 
 /*
- * configure the FPGA
+ * start a slave config pass at config clock step. Returns 1 if the FPGA
+ * didn't respond to reset.
  */
 /* New version is closer to Lattice timing */
-uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
+static uint8_t ICE_FPGA_Config_Start(uint8_t step)
 {
 	uint32_t timeout;
+	
+	/* only touch the config device when the clock changes */
+	if(step != ice_cfg_step)
+	{
+		ice_cfg_step = step;
+		ICE_SPI_Cfg_Clock(ice_cfg_clk[step]);
+	}
+	
+	ice_cfg_start = esp_timer_get_time();
+	ice_cfg_bytes = 0;
 
 	/* drop reset bit */
 	ICE_CRST_LOW();
@@ -185,6 +529,7 @@ uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
 	if(!timeout)
 	{
 		/* Done bit didn't respond to Reset */
+		ICE_SPI_CS_HIGH();
 		return 1;
 	}
 
@@ -192,68 +537,156 @@ uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
 	ICE_CRST_HIGH();
 	
 	/* delay >1200us to allow FPGA to clear */
-	ets_delay_us(1200);
+	ets_delay_us(ICE_CFG_TCR_US);
 	
 	/* send 8 dummy clocks with CS high */
 	ICE_SPI_CS_HIGH();
-	ICE_SPI_ClkToggle(8);
+	ICE_SPI_Cfg_Clocks(ICE_CFG_LEAD_CLKS);
 	ICE_SPI_CS_LOW();
 	
-	/* send the bitstream */
-	ICE_SPI_WriteBlk(bitmap, size);
+	return 0;
+}
+
+/*
+ * start a streamed config pass at the fastest config clock, or with safe
+ * set at the original 10MHz one for a bitstream that can't be sent again
+ */
+uint8_t ICE_FPGA_Config_Begin(uint8_t safe)
+{
+	return ICE_FPGA_Config_Start(safe ? ICE_CFG_NUM_CLK-1 : 0);
+}
 
+/*
+ * send the next piece of the bitstream
+ */
+void ICE_FPGA_Config_Write(uint8_t *data, uint32_t size)
+{
+	ICE_SPI_TxBlk(spi_cfg, data, size);
+	ice_cfg_bytes += size;
+}
+
+/*
+ * finish a config pass. Returns 2 if CDONE didn't rise.
+ */
+uint8_t ICE_FPGA_Config_End(void)
+{
+	uint8_t result = 0;
+	
     /* raise CS */
 	ICE_SPI_CS_HIGH();
 
-	/* bitbang clock */
-	ICE_SPI_ClkToggle(160);
+	/* trailing clocks from the SPI peripheral too */
+	ICE_SPI_Cfg_Clocks(ICE_CFG_TRAIL_CLKS);
 
     /* error if DONE not asserted */
     if(ICE_CDONE_GET()==0)
-    {
-		return 2;
-	}
+		result = 2;
 	
-	/* no error handling for now */
-	return 0;
+	ice_cfg_us = esp_timer_get_time() - ice_cfg_start;
+	ICE_Prof_Add(ICE_PROF_CFG, ice_cfg_start, ice_cfg_bytes);
+	
+	return result;
 }
 
 /*
- * Write a long to the FPGA SPI port
+ * give up on a config pass part way, when the rest of the bitstream never
+ * came. The FPGA is left unconfigured and the clock isn't blamed.
  */
-void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data)
+void ICE_FPGA_Config_Abort(void)
 {
-	uint8_t tx[5] = {0};
+	ICE_SPI_CS_HIGH();
+	ESP_LOGW(TAG, "Config abandoned after %u bytes", ice_cfg_bytes);
+}
 
-	/* Drop CS */
-	ICE_SPI_CS_LOW();
+/*
+ * one pass of the slave config sequence at config clock step
+ */
+static uint8_t ICE_FPGA_Config_Pass(ice_cfg_feed_t feed, void *ctx, uint8_t step)
+{
+	uint8_t result;
 	
-	/* msbit of byte 0 is 0 for write */
-	tx[0] = (Reg & 0x7f);
+	if(ICE_FPGA_Config_Start(step))
+		return 1;
+	
+	/* a feed that gives up isn't the clock's fault */
+	if((result = feed(ctx)))
+	{
+		ICE_FPGA_Config_Abort();
+		return result;
+	}
 
-	/* send next four bytes */
-	tx[1] = ((Data>>24) & 0xff);
-	tx[2] = ((Data>>16) & 0xff);
-	tx[3] = ((Data>> 8) & 0xff);
-	tx[4] = ((Data>> 0) & 0xff);
+	return ICE_FPGA_Config_End();
+}
+
+/*
+ * configure the FPGA from a bitstream feed
+ * Starts at the fastest clock and steps down to a slower one each time
+ * CDONE fails to rise, feeding the bitstream again for each pass. Each
+ * config starts over, so a bad bitstream doesn't slow down the ones after
+ * it. Achieved time is kept for ICE_FPGA_Config_Time().
+ */
+uint8_t ICE_FPGA_Config_Feed(ice_cfg_feed_t feed, void *ctx)
+{
+	uint8_t result, step = 0;
+	int64_t start = esp_timer_get_time();
 	
-	/* tx SPI transaction */
-    esp_err_t ret;
-    spi_transaction_t t = {0};
+	while(((result = ICE_FPGA_Config_Pass(feed, ctx, step)) == 2) &&
+		(step < ICE_CFG_NUM_CLK-1))
+	{
+		step++;
+		ESP_LOGW(TAG, "Config failed - stepping down to %d Hz", ice_cfg_clk[step]);
+	}
 	
-    t.length=5*8;                   //Command is 40 bits
-    t.tx_buffer=tx;             	//The data is the cmd itself
-    ret=spi_device_polling_transmit(spi, &t);  //Transmit!
-    assert(ret==ESP_OK);            //Should have had no issues.
+	ice_cfg_us = esp_timer_get_time() - start;
+	if(!result)
+		ESP_LOGI(TAG, "Config %u bytes @ %d Hz in %u us", ice_cfg_bytes,
+			ice_cfg_clk[ice_cfg_step], ice_cfg_us);
 	
-	/* Raise CS */
-	ICE_SPI_CS_HIGH();
+	return result;
 }
 
+/* whole bitstream in memory */
+typedef struct
+{
+	uint8_t *bitmap;
+	uint32_t size;
+} ice_cfg_flat_t;
+
 /*
- * Read a long from the FPGA SPI port
+ * feed for a bitstream that's all in memory - one write per pass
  */
-void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data)
+static uint8_t ICE_FPGA_Config_Flat(void *ctx)
+{
+	ice_cfg_flat_t *flat = ctx;
+	
+	ICE_FPGA_Config_Write(flat->bitmap, flat->size);
+	return 0;
+}
+
+/*
+ * configure the FPGA from a bitstream in memory
+ */
+uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size)
+{
+	ice_cfg_flat_t flat = { bitmap, size };
+	
+	return ICE_FPGA_Config_Feed(ICE_FPGA_Config_Flat, &flat);
+}
+
+/*
+ * time & clock of the last configuration attempt
+ */
+uint32_t ICE_FPGA_Config_Time(int *hz)
+{
+	if(hz)
+		*hz = ice_cfg_clk[ice_cfg_step];
+	return ice_cfg_us;
+}
+
+/*
+ * Read a long from the FPGA SPI port with GPIO CS (used for benchmarking)
+ */
+static void ICE_FPGA_Serial_Read_Manual(uint8_t Reg, uint32_t *Data)
 {
 	uint8_t tx[5] = {0}, rx[5] = {0};
 	
@@ -280,58 +713,292 @@ void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data)
 	ICE_SPI_CS_HIGH();
 }
 
-/***********************************************************************/
-/* I know that ESP32 SPI ports can do memory cmd/addr/data sequencing  */
-/* but I'm handling it manually here to avoid constantly reconfiguring */
-/***********************************************************************/
+/*
+ * Write a long to the FPGA SPI port
+ * Uses hardware CS and the command phase for the R/W + address byte
+ */
+void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data)
+{
+    esp_err_t ret;
+    spi_transaction_t t = {0};
+	int64_t start = esp_timer_get_time();
+	
+	ICE_SPI_CS_Route(ICE_CS_REG);
+	
+	/* msbit of command is 0 for write */
+	t.cmd = Reg & 0x7f;
+	t.flags = SPI_TRANS_USE_TXDATA;
+	t.length = 32;
+	t.tx_data[0] = ((Data>>24) & 0xff);
+	t.tx_data[1] = ((Data>>16) & 0xff);
+	t.tx_data[2] = ((Data>> 8) & 0xff);
+	t.tx_data[3] = ((Data>> 0) & 0xff);
+    ret=spi_device_polling_transmit(spi_reg, &t);
+    assert(ret==ESP_OK);
+	
+	ICE_Prof_Add(ICE_PROF_REG_WR, start, 4);
+}
+
+/*
+ * Read a long from the FPGA SPI port
+ * Uses hardware CS and the command phase for the R/W + address byte
+ */
+void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data)
+{
+    esp_err_t ret;
+    spi_transaction_t t = {0};
+	int64_t start = esp_timer_get_time();
+	
+	ICE_SPI_CS_Route(ICE_CS_REG);
+	
+	/* msbit of command is 1 for read */
+	t.cmd = Reg | 0x80;
+	t.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+	t.length = 32;
+	t.rxlength = 32;
+    ret=spi_device_polling_transmit(spi_reg, &t);
+    assert(ret==ESP_OK);
+	
+	/* assemble result */
+	*Data = (t.rx_data[0]<<24) | (t.rx_data[1]<<16) | (t.rx_data[2]<<8) | t.rx_data[3];
+	
+	ICE_Prof_Add(ICE_PROF_REG_RD, start, 4);
+}
+
+/*
+ * Compare register read rates of the GPIO CS and hardware CS paths
+ */
+void ICE_FPGA_Reg_Bench(uint8_t Reg, uint32_t count)
+{
+	int64_t start, manual, hw;
+	uint32_t i, Data;
+	
+	start = esp_timer_get_time();
+	for(i=0;i<count;i++)
+		ICE_FPGA_Serial_Read_Manual(Reg, &Data);
+	manual = esp_timer_get_time() - start;
+	
+	start = esp_timer_get_time();
+	for(i=0;i<count;i++)
+		ICE_FPGA_Serial_Read(Reg, &Data);
+	hw = esp_timer_get_time() - start;
+	
+	ESP_LOGI(TAG, "Reg bench: %u reads of reg %d", count, Reg);
+	ESP_LOGI(TAG, "  GPIO CS: %lld us, %lld reads/sec", (long long)manual,
+		manual ? (1000000LL*count)/manual : 0LL);
+	ESP_LOGI(TAG, "  HW CS:   %lld us, %lld reads/sec", (long long)hw,
+		hw ? (1000000LL*count)/hw : 0LL);
+}
+
+/*
+ * Read a register until (value & mask) == expect or timeout_us passes,
+ * interval_us apart. The port is only held for each read so other users
+ * get in between, and a tight poll sleeps a tick every ten so lower
+ * priority tasks still run. Don't call with the port held.
+ */
+uint8_t ICE_FPGA_Serial_Poll(uint8_t Reg, uint32_t mask, uint32_t expect,
+	uint32_t timeout_us, uint32_t interval_us, ice_poll_t *poll)
+{
+	const int64_t tick_us = 1000LL*portTICK_PERIOD_MS;
+	int64_t start, now, sleep_at;
+	uint8_t err = 0;
+	
+	memset(poll, 0, sizeof(ice_poll_t));
+	start = sleep_at = esp_timer_get_time();
+	while(1)
+	{
+		if(ICE_Lock((TickType_t)100) != pdTRUE)
+		{
+			err = 1;
+			break;
+		}
+		ICE_FPGA_Serial_Read(Reg, &poll->Data);
+		ICE_Unlock();
+		now = esp_timer_get_time();
+		poll->polls++;
+		poll->us = now - start;
+		
+		if((poll->Data & mask) == expect)
+			break;
+		if(now - start >= timeout_us)
+		{
+			err = ICE_POLL_TIMEOUT_ERR;
+			break;
+		}
+		
+		if(interval_us >= tick_us)
+			vTaskDelay((TickType_t)(interval_us / tick_us));
+		else
+		{
+			if(interval_us)
+				ets_delay_us(interval_us);
+			if(now - sleep_at >= 10*tick_us)
+			{
+				vTaskDelay(1);
+				sleep_at = esp_timer_get_time();
+			}
+		}
+	}
+	
+	return err;
+}
+
 /*
  * Write a block of data to the FPGA attached PSRAM via SPI port
+ * The block is split into bursts that don't cross a page boundary or
+ * hold CS low past tCEM. Each burst is one hardware-CS transaction with
+ * the command & address phases done by the SPI peripheral. Bursts are
+ * only a few us on the bus, so they're polled with the bus held rather
+ * than queued - an interrupt and task wakeup per burst cost more than
+ * the burst itself.
  */
 void ICE_PSRAM_Write(uint32_t Addr, uint8_t *Data, uint32_t size)
 {
-	uint8_t header[4];
-	
-	/* build the PSRAM Write header */
-	header[0] = 0x02;					// slow write command
-	header[1] = (Addr >> 16) & 0xff;
-	header[2] = (Addr >>  8) & 0xff;
-	header[3] = (Addr >>  0) & 0xff;
+    esp_err_t ret;
+	spi_transaction_t t;
+	uint32_t bytes;
+	uint32_t total = size;
+	int64_t start = esp_timer_get_time();
 	
-	/* Drop CS */
-	ICE_SPI_CS_LOW();
+	ICE_SPI_CS_Route(ICE_CS_PSRAM_WR);
+	ret=spi_device_acquire_bus(spi_psram_wr, portMAX_DELAY);
+	assert(ret==ESP_OK);
 	
-	/* send header */
-	ICE_SPI_WriteBlk(header, 4);
+	while(size)
+	{
+		bytes = ICE_PSRAM_PAGE - (Addr % ICE_PSRAM_PAGE);
+		bytes = bytes > ice_psram_burst ? ice_psram_burst : bytes;
+		bytes = bytes > size ? size : bytes;
+		
+		memset(&t, 0, sizeof(spi_transaction_t));
+		t.cmd = ICE_PSRAM_WRITE;
+		t.addr = Addr;
+		t.length = 8*bytes;
+		if(esp_ptr_dma_capable(Data))
+			t.tx_buffer = Data;
+		else
+		{
+			memcpy(ice_dma_buf[0], Data, bytes);
+			t.tx_buffer = ice_dma_buf[0];
+		}
+		ret=spi_device_polling_transmit(spi_psram_wr, &t);
+		assert(ret==ESP_OK);
+		
+		size -= bytes;
+		Data += bytes;
+		Addr += bytes;
+	}
 	
-	/* send data */
-	ICE_SPI_WriteBlk(Data, size);
+	spi_device_release_bus(spi_psram_wr);
 	
-	/* Raise CS */
-	ICE_SPI_CS_HIGH();	
+	ICE_Prof_Add(ICE_PROF_PSRAM_WR, start, total);
 }
 
 /*
  * Read a block of data from the FPGA attached PSRAM via SPI port
+ * Split into page/tCEM bursts like writes, using fast read and polled
+ * the same way. Bursts land in the bounce buffer and are copied out.
  */
 void ICE_PSRAM_Read(uint32_t Addr, uint8_t *Data, uint32_t size)
 {
-	uint8_t header[4];
+    esp_err_t ret;
+	spi_transaction_t t;
+	uint32_t bytes;
+	uint32_t total = size;
+	int64_t start = esp_timer_get_time();
 	
-	/* build the PSRAM Read header */
-	header[0] = 0x03;					// slow read command
-	header[1] = (Addr >> 16) & 0xff;
-	header[2] = (Addr >>  8) & 0xff;
-	header[3] = (Addr >>  0) & 0xff;
+	ICE_SPI_CS_Route(ICE_CS_PSRAM_RD);
+	ret=spi_device_acquire_bus(spi_psram_rd, portMAX_DELAY);
+	assert(ret==ESP_OK);
 	
-	/* Drop CS */
-	ICE_SPI_CS_LOW();
+	while(size)
+	{
+		bytes = ICE_PSRAM_PAGE - (Addr % ICE_PSRAM_PAGE);
+		bytes = bytes > ice_psram_burst ? ice_psram_burst : bytes;
+		bytes = bytes > size ? size : bytes;
+		
+		memset(&t, 0, sizeof(spi_transaction_t));
+		t.cmd = ICE_PSRAM_FAST_READ;
+		t.addr = Addr;
+		t.rxlength = 8*bytes;
+		t.rx_buffer = ice_dma_buf[0];
+		ret=spi_device_polling_transmit(spi_psram_rd, &t);
+		assert(ret==ESP_OK);
+		memcpy(Data, ice_dma_buf[0], bytes);
+		
+		size -= bytes;
+		Data += bytes;
+		Addr += bytes;
+	}
 	
-	/* send header */
-	ICE_SPI_WriteBlk(header, 4);
+	spi_device_release_bus(spi_psram_rd);
+	
+	ICE_Prof_Add(ICE_PROF_PSRAM_RD, start, total);
+}
+
+/*
+ * Write a block to the FPGA dual I/O loopback buffer - link test only
+ * The command goes out single-bit, then data uses MOSI & MISO as a 2-bit
+ * bus. The buffer address restarts at 0 for each block so the whole block
+ * is one hardware-CS transaction. Returns 1 if it doesn't fit.
+ */
+uint8_t ICE_FPGA_Dual_Write(uint8_t *Data, uint32_t size)
+{
+    esp_err_t ret;
+    spi_transaction_t t = {0};
+	int64_t start = esp_timer_get_time();
 	
-	/* get data */
-	ICE_SPI_ReadBlk(Data, size);
+	if(!size || (size > ICE_DUAL_BUF_SZ))
+		return 1;
 	
-	/* Raise CS */
-	ICE_SPI_CS_HIGH();
+	ICE_SPI_CS_Route(ICE_CS_DUAL);
+	
+	t.cmd = ICE_DUAL_WRITE;
+	t.flags = SPI_TRANS_MODE_DIO;
+	t.length = 8*size;
+	if(esp_ptr_dma_capable(Data))
+		t.tx_buffer = Data;
+	else
+	{
+		memcpy(ice_dma_buf[0], Data, size);
+		t.tx_buffer = ice_dma_buf[0];
+	}
+    ret=spi_device_transmit(spi_dual, &t);
+    assert(ret==ESP_OK);
+	
+	ICE_Prof_Add(ICE_PROF_DUAL_WR, start, size);
+	return 0;
+}
+
+/*
+ * Read a block back from the FPGA dual I/O loopback buffer
+ * Single-bit command and turnaround clocks, then 2-bit data from the
+ * start of the buffer. Returns 1 if the size doesn't fit.
+ */
+uint8_t ICE_FPGA_Dual_Read(uint8_t *Data, uint32_t size)
+{
+    esp_err_t ret;
+    spi_transaction_ext_t t = {0};
+	uint8_t direct;
+	int64_t start = esp_timer_get_time();
+	
+	if(!size || (size > ICE_DUAL_BUF_SZ))
+		return 1;
+	
+	ICE_SPI_CS_Route(ICE_CS_DUAL);
+	
+	direct = esp_ptr_dma_capable(Data) && !((uintptr_t)Data & 3) && !(size & 3);
+	t.base.cmd = ICE_DUAL_READ;
+	t.base.flags = SPI_TRANS_MODE_DIO | SPI_TRANS_VARIABLE_DUMMY;
+	t.base.rxlength = 8*size;
+	t.base.rx_buffer = direct ? Data : ice_dma_buf[0];
+	t.dummy_bits = ICE_DUAL_TURN_BITS;
+    ret=spi_device_transmit(spi_dual, &t.base);
+    assert(ret==ESP_OK);
+	
+	if(!direct)
+		memcpy(Data, ice_dma_buf[0], size);
+	
+	ICE_Prof_Add(ICE_PROF_DUAL_RD, start, size);
+	return 0;
 }
@@ -9,13 +9,80 @@
 #include "main.h"
 #include "esp_event.h"
 
+/*
+ * size of the FPGA dual I/O buffer - max block for ICE_FPGA_Dual_*. In the
+ * factory design it's loopback scratch that the fabric can't see, so the
+ * dual path is a link test, not a way to move data. Bulk data goes to PSRAM.
+ */
+#define ICE_DUAL_BUF_SZ 2048
+
+/* profiler operation classes */
+enum
+{
+	ICE_PROF_CFG,
+	ICE_PROF_REG_RD,
+	ICE_PROF_REG_WR,
+	ICE_PROF_PSRAM_RD,
+	ICE_PROF_PSRAM_WR,
+	ICE_PROF_DUAL_RD,
+	ICE_PROF_DUAL_WR,
+	ICE_PROF_MUTEX,
+	ICE_PROF_NUM
+};
+
+/* latency histogram bin n>0 holds [2^(n-1), 2^n) us, last bin is open */
+#define ICE_PROF_BINS 16
+
+/* error bit for a register poll that ran out of time */
+#define ICE_POLL_TIMEOUT_ERR	0x40
+
+/* outcome of ICE_FPGA_Serial_Poll() - layout is sent as-is to the host */
+typedef struct
+{
+	uint32_t Data;			// last value read
+	uint32_t polls;			// reads made
+	uint32_t us;			// from the first read to the last
+} ice_poll_t;
+
+/* per-class profile - layout is sent as-is to the host */
+typedef struct
+{
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t bytes;
+	uint64_t total_us;
+	uint32_t hist[ICE_PROF_BINS];
+} ice_prof_t;
+
+/*
+ * bitstream feed for ICE_FPGA_Config_Feed() - sends the whole bitstream
+ * with ICE_FPGA_Config_Write(), once per config pass. A nonzero return
+ * abandons the pass and is the config result.
+ */
+typedef uint8_t (*ice_cfg_feed_t)(void *ctx);
+
 extern xSemaphoreHandle ice_mutex;
 
 void ICE_Init(void);
+BaseType_t ICE_Lock(TickType_t wait);
+void ICE_Unlock(void);
+void ICE_Prof_Get(ice_prof_t *prof);
+void ICE_Prof_Reset(void);
 uint8_t ICE_FPGA_Config(uint8_t *bitmap, uint32_t size);
+uint8_t ICE_FPGA_Config_Feed(ice_cfg_feed_t feed, void *ctx);
+uint8_t ICE_FPGA_Config_Begin(uint8_t safe);
+void ICE_FPGA_Config_Write(uint8_t *data, uint32_t size);
+uint8_t ICE_FPGA_Config_End(void);
+void ICE_FPGA_Config_Abort(void);
+uint32_t ICE_FPGA_Config_Time(int *hz);
 void ICE_FPGA_Serial_Write(uint8_t Reg, uint32_t Data);
 void ICE_FPGA_Serial_Read(uint8_t Reg, uint32_t *Data);
+void ICE_FPGA_Reg_Bench(uint8_t Reg, uint32_t count);
+uint8_t ICE_FPGA_Serial_Poll(uint8_t Reg, uint32_t mask, uint32_t expect,
+	uint32_t timeout_us, uint32_t interval_us, ice_poll_t *poll);
 void ICE_PSRAM_Write(uint32_t Addr, uint8_t *Data, uint32_t size);
 void ICE_PSRAM_Read(uint32_t Addr, uint8_t *Data, uint32_t size);
+uint8_t ICE_FPGA_Dual_Write(uint8_t *Data, uint32_t size);
+uint8_t ICE_FPGA_Dual_Read(uint8_t *Data, uint32_t size);
 
 #endif
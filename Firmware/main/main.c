@@ -12,9 +12,20 @@
 #include "wifi.h"
 #include "adc_c3.h"
 #include "sercmd.h"
+#include "cfgtask.h"
+#include "bitslot.h"
+#include "bitcache.h"
+#include "psread.h"
+#include "upload.h"
+#include "script.h"
+#include "timedq.h"
+#include "sampler.h"
 
 #define LED_PIN 10
 
+/* uncomment to benchmark FPGA register access after power-on config */
+//#define ICE_BENCH
+
 static const char* TAG = "main";
 
 /* build version in simple format */
@@ -28,34 +39,84 @@ const char *bdate = __DATE__;
 const char *btime = __TIME__;
 
 /*
- * common FPGA file loader
+ * common FPGA file loader - queues a config job from the RAM cache if the
+ * file's flash slot holds a bitstream that's cached, otherwise caches the
+ * slot's mmap or a copy of the SPIFFS file. Falls back to configuring
+ * straight from the slot or a heap copy of the file when the cache is full.
+ * Returns the job id or 0 if nothing was queued.
  */
-esp_err_t load_fpga(const char *filename)
+uint32_t load_fpga(const char *filename, QueueHandle_t reply)
 {
+	spi_flash_mmap_handle_t map;
+	const uint8_t *bitmap;
+	bitcache_ent_t *ent;
 	uint8_t *bin = NULL;
-	uint32_t sz;
+	uint32_t sz, crc;
+	int8_t slot;
 	
-	ESP_LOGI(TAG, "Configuring FPGA from file %s", filename);
-	if(!spiffs_read((char *)filename, &bin, &sz))
+	if((slot = bitslot_find(filename)) >= 0)
 	{
-		uint8_t cfg_stat;
+		/* the slot header has the CRC so a hit never reads the data */
+		if(!bitslot_info(slot, &crc, &sz) && (ent = bitcache_get(crc)))
+		{
+			ESP_LOGI(TAG, "Configuring FPGA from cache 0x%08X", crc);
+			return cfgtask_submit_cached(ent, 4, reply);
+		}
 		
-		/* loop on config failure */
-		int8_t retry = 4;
-		while((cfg_stat = ICE_FPGA_Config(bin, sz)) && (retry--))
-			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
-		if(retry)
-			ESP_LOGI(TAG, "FPGA configured OK - status = %d", cfg_stat);
-		else
-			ESP_LOGW(TAG, "FPGA configured ERROR - giving up");
+		if(!bitslot_map(slot, &bitmap, &sz, &map))
+		{
+			/* the cache keeps the map - no heap copy */
+			if((ent = bitcache_add_map(crc, bitmap, sz, map)))
+				return cfgtask_submit_cached(ent, 4, reply);
+			
+			/* zero-copy from flash */
+			ESP_LOGI(TAG, "Configuring FPGA from slot %d", slot);
+			return cfgtask_submit_map(bitmap, sz, map, 4, reply);
+		}
+	}
+	
+	ESP_LOGI(TAG, "Configuring FPGA from file %s", filename);
+	if(!spiffs_read((char *)filename, &bin, &sz))
+		return upload_fpga(bin, sz, 4, reply);
+	
+	ESP_LOGI(TAG, "Configuration file %s not found", filename);
+	return 0;
+}
 
+/*
+ * configure from a malloc'd bitstream which the job takes over, through
+ * the cache so a repeat of the same image is kept in RAM only once.
+ * Returns the job id or 0 if nothing was queued.
+ */
+uint32_t upload_fpga(uint8_t *bin, uint32_t sz, uint8_t retries, QueueHandle_t reply)
+{
+	uint32_t crc = crc32_le(0, bin, sz);
+	bitcache_ent_t *ent;
+	
+	if((ent = bitcache_get(crc)))
+	{
 		free(bin);
-		
-		return ESP_OK;
+		return cfgtask_submit_cached(ent, retries, reply);
 	}
+	else if((ent = bitcache_add(crc, bin, sz, 0)))
+		return cfgtask_submit_cached(ent, retries, reply);
+	else
+		return cfgtask_submit(bin, sz, CFGTASK_FREE, retries, reply);
+}
+
+/*
+ * configure from a cached bitstream by its CRC.
+ * Returns the job id or 0 if it isn't cached or nothing was queued.
+ */
+uint32_t cached_fpga(uint32_t crc, QueueHandle_t reply)
+{
+	bitcache_ent_t *ent;
 	
-	ESP_LOGI(TAG, "Configuration file %s not found", filename);
-	return ESP_FAIL;
+	if(!(ent = bitcache_get(crc)))
+		return 0;
+	
+	ESP_LOGI(TAG, "Configuring FPGA from cache 0x%08X", crc);
+	return cfgtask_submit_cached(ent, 0, reply);
 }
 
 /*
@@ -80,6 +141,21 @@ void app_main(void)
 	ICE_Init();
     ESP_LOGI(TAG, "FPGA SPI port initialized");
 	
+	/* start the FPGA config worker & its cache - slot writes update the cache */
+	if(bitcache_init() || cfgtask_init())
+		ESP_LOGE(TAG, "FPGA config worker failed");
+	
+	/* copy bitstreams into their flash slots if needed */
+	bitslot_init();
+	
+	/* PSRAM read helper */
+	if(psread_init())
+		ESP_LOGE(TAG, "PSRAM read helper failed");
+	
+	/* chunked uploads */
+	if(upload_init())
+		ESP_LOGE(TAG, "Upload init failed");
+	
 	/* preload PSRAM */
     ESP_LOGI(TAG, "Pre-Loading PSRAM from file %s", psram_file);
 	if(!spiffs_get_fsz((char *)psram_file, &sz))
@@ -87,7 +163,8 @@ void app_main(void)
 		if(sz > 4)
 		{
 			/* preload FPGA with SPI Pass-thru design */
-			load_fpga(spipass_file);
+			if(load_fpga(spipass_file, NULL))
+				cfgtask_wait_idle(NULL, portMAX_DELAY);
 			
 			/* Get data from file and send */
 			{
@@ -150,8 +227,26 @@ void app_main(void)
     else
 		ESP_LOGI(TAG, "PSRAM file not found");
 	
-	/* configure FPGA from SPIFFS file */
-	load_fpga(cfg_file);
+	/* configure FPGA from SPIFFS file - runs while the rest starts up */
+	load_fpga(cfg_file, NULL);
+	
+	/* timed op queue */
+	if(timedq_init())
+		ESP_LOGE(TAG, "Timed queue init failed");
+	
+	/* register sampler - streams once WiFi is up */
+	if(sampler_init())
+		ESP_LOGE(TAG, "Sampler init failed");
+	
+	/* command scripts */
+	if(script_init())
+		ESP_LOGE(TAG, "Script init failed");
+	
+#ifdef ICE_BENCH
+	/* register read rates - GPIO CS vs hardware CS */
+	cfgtask_wait_idle(NULL, portMAX_DELAY);
+	ICE_FPGA_Reg_Bench(0, 10000);
+#endif
 	
     /* init ADC for Vbat readings */
     if(!adc_c3_init())
@@ -180,6 +275,9 @@ void app_main(void)
 		ESP_LOGE(TAG, "Serial Command Init Failed");
 #endif
 	
+	/* bring-up script - runs by itself once that config is done */
+	script_boot();
+	
 	/* wait here forever and blink */
     ESP_LOGI(TAG, "Looping...", btime);
 	gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
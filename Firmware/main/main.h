@@ -11,6 +11,7 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
 #include "esp_log.h"
 
@@ -19,6 +20,8 @@ extern const char *cfg_file;
 extern const char *spipass_file;
 extern const char *psram_file;
 
-esp_err_t load_fpga(const char *filename);
+uint32_t load_fpga(const char *filename, QueueHandle_t reply);
+uint32_t upload_fpga(uint8_t *bin, uint32_t sz, uint8_t retries, QueueHandle_t reply);
+uint32_t cached_fpga(uint32_t crc, QueueHandle_t reply);
 
 #endif
\ No newline at end of file
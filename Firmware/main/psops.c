@@ -0,0 +1,166 @@
+/*
+ * psops.c - PSRAM fill, copy and CRC run on the device
+ * 10-17-26
+ *
+ * Clearing, moving or checking a PSRAM image from the host means pushing
+ * every byte over the link. These do it locally a large piece at a time,
+ * taking the FPGA port for each piece so other clients still get a turn.
+ * CRCs use the double-buffered reader so the CRC of one piece overlaps
+ * the read of the next. CRCs match zlib.crc32() on the host.
+ */
+
+#include <string.h>
+#include "psops.h"
+#include "psread.h"
+#include "ice.h"
+#include "rom/crc.h"
+#include "esp_heap_caps.h"
+
+#define PSOPS_MIN			1024	// smallest piece worth trying
+
+static const char* TAG = "psops";
+
+/*
+ * range must be inside the part
+ */
+static uint8_t psops_range(uint32_t Addr, uint32_t len)
+{
+	if((Addr >= PSOPS_SIZE) || (len > PSOPS_SIZE - Addr))
+	{
+		ESP_LOGW(TAG, "0x%08X + 0x%X is outside PSRAM", Addr, len);
+		return 8;
+	}
+	return 0;
+}
+
+/*
+ * a buffer of up to want bytes, smaller if memory is short
+ */
+static uint8_t *psops_buffer(uint32_t want, uint32_t *sz)
+{
+	uint8_t *buf;
+	
+	*sz = want < PSOPS_PIECE ? want : PSOPS_PIECE;
+	while(!(buf = heap_caps_malloc(*sz, MALLOC_CAP_DMA)))
+	{
+		/* whole words so fill patterns stay lined up */
+		if((*sz = (*sz / 2) & ~3) < PSOPS_MIN)
+		{
+			ESP_LOGE(TAG, "No memory for buffer");
+			return NULL;
+		}
+	}
+	return buf;
+}
+
+/*
+ * take the FPGA port for one piece
+ */
+static uint8_t psops_lock(void)
+{
+	if(ICE_Lock((TickType_t)100) == pdTRUE)
+		return 0;
+	ESP_LOGW(TAG, "Couldn't get FPGA access");
+	return 1;
+}
+
+/*
+ * fill len bytes from Addr with a repeated little endian word
+ */
+uint8_t psops_fill(uint32_t Addr, uint32_t len, uint32_t pattern)
+{
+	uint32_t i, sz, piece;
+	uint8_t *buf;
+	
+	if(psops_range(Addr, len))
+		return 8;
+	if(!len)
+		return 0;
+	
+	/* pieces are whole words so the pattern lines up in each */
+	if(!(buf = psops_buffer((len + 3) & ~3, &piece)))
+		return 1;
+	for(i=0;i<piece;i+=4)
+		memcpy(buf+i, &pattern, 4);
+	
+	while(len)
+	{
+		sz = len < piece ? len : piece;
+		if(psops_lock())
+		{
+			free(buf);
+			return 1;
+		}
+		ICE_PSRAM_Write(Addr, buf, sz);
+		ICE_Unlock();
+		
+		Addr += sz;
+		len -= sz;
+	}
+	
+	free(buf);
+	return 0;
+}
+
+/*
+ * copy len bytes from Src to Dst, overlapping ranges too
+ */
+uint8_t psops_copy(uint32_t Dst, uint32_t Src, uint32_t len)
+{
+	uint32_t sz, piece, off;
+	uint8_t *buf, down;
+	
+	if(psops_range(Src, len) || psops_range(Dst, len))
+		return 8;
+	if(!len || (Dst == Src))
+		return 0;
+	if(!(buf = psops_buffer(len, &piece)))
+		return 1;
+	
+	/* work from the top when the end of Src would be overwritten first */
+	down = (Dst > Src) && (Dst - Src < len);
+	off = down ? len : 0;
+	while(len)
+	{
+		sz = len < piece ? len : piece;
+		if(down)
+			off -= sz;
+		if(psops_lock())
+		{
+			free(buf);
+			return 1;
+		}
+		ICE_PSRAM_Read(Src + off, buf, sz);
+		ICE_PSRAM_Write(Dst + off, buf, sz);
+		ICE_Unlock();
+		
+		if(!down)
+			off += sz;
+		len -= sz;
+	}
+	
+	free(buf);
+	return 0;
+}
+
+/*
+ * reader output - add each piece to the CRC
+ */
+static uint8_t psops_crc_out(void *ctx, uint8_t *data, uint32_t len)
+{
+	uint32_t *crc = ctx;
+	
+	*crc = crc32_le(*crc, data, len);
+	return 0;
+}
+
+/*
+ * CRC32 of len bytes from Addr
+ */
+uint8_t psops_crc(uint32_t Addr, uint32_t len, uint32_t *crc)
+{
+	*crc = 0;
+	if(psops_range(Addr, len))
+		return 8;
+	return psread_stream(Addr, len, PSOPS_PIECE, psops_crc_out, crc);
+}
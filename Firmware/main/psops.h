@@ -0,0 +1,18 @@
+/*
+ * psops.h - PSRAM fill, copy and CRC run on the device
+ * 10-17-26
+ */
+
+#ifndef __PSOPS__
+#define __PSOPS__
+
+#include "main.h"
+
+#define PSOPS_PIECE			16384		// most moved per turn at the FPGA
+#define PSOPS_SIZE			(8*1024*1024)	// PSRAM on the board
+
+uint8_t psops_fill(uint32_t Addr, uint32_t len, uint32_t pattern);
+uint8_t psops_copy(uint32_t Dst, uint32_t Src, uint32_t len);
+uint8_t psops_crc(uint32_t Addr, uint32_t len, uint32_t *crc);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * psread.c - double-buffered PSRAM reads
+ * 10-17-26
+ *
+ * Long PSRAM reads are split into chunks which a helper task reads into
+ * one of two buffers while the caller is still sending the other one, so
+ * the SPI bus and the network or USB link are busy at the same time.
+ * The helper only holds ice_mutex for one chunk at a time so other
+ * clients get a turn at the FPGA during a long read. Each stream has its
+ * own reply queue, so streams from several clients share the helper a
+ * chunk at a time instead of waiting for each other to finish.
+ */
+
+#include "psread.h"
+#include "ice.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+
+#define PSREAD_STACK		2048
+#define PSREAD_PRIO			5
+#define PSREAD_MIN			256		// smallest chunk worth trying
+#define PSREAD_DEPTH		4		// streams waiting on the helper
+
+/* one chunk to read, sent back on reply when it's in */
+typedef struct
+{
+	uint32_t Addr;
+	uint8_t *buf;
+	uint32_t len;
+	QueueHandle_t reply;
+} psread_req_t;
+
+static const char* TAG = "psread";
+static QueueHandle_t psread_req;
+
+/*
+ * helper - reads chunks as they're asked for
+ */
+static void psread_task(void *pvParameters)
+{
+	psread_req_t req;
+	
+	while(1)
+	{
+		xQueueReceive(psread_req, &req, portMAX_DELAY);
+		
+		/* anyone waiting gets the FPGA before the next chunk */
+		ICE_Lock(portMAX_DELAY);
+		ICE_PSRAM_Read(req.Addr, req.buf, req.len);
+		ICE_Unlock();
+		taskYIELD();
+		
+		xQueueSend(req.reply, &req, portMAX_DELAY);
+	}
+}
+
+/*
+ * start the helper
+ */
+esp_err_t psread_init(void)
+{
+	if(!(psread_req = xQueueCreate(PSREAD_DEPTH, sizeof(psread_req_t))))
+		return ESP_ERR_NO_MEM;
+	
+	if(xTaskCreate(psread_task, "psread", PSREAD_STACK, NULL, PSREAD_PRIO, NULL) != pdPASS)
+		return ESP_FAIL;
+	else
+		return ESP_OK;
+}
+
+/*
+ * ask for the next chunk
+ */
+static void psread_next(uint32_t *Addr, uint32_t *left, uint32_t chunk, uint8_t *buf,
+	QueueHandle_t reply)
+{
+	psread_req_t req;
+	
+	req.reply = reply;
+	req.Addr = *Addr;
+	req.buf = buf;
+	req.len = *left > chunk ? chunk : *left;
+	*Addr += req.len;
+	*left -= req.len;
+	xQueueSend(psread_req, &req, portMAX_DELAY);
+}
+
+/*
+ * read size bytes of PSRAM from Addr, passing them to out() at most chunk
+ * bytes at a time, or less if memory is short. Caller must not hold
+ * ice_mutex. Returns 0 if all was read and taken, 1 if there was no
+ * memory or 4 if out() stopped it.
+ */
+uint8_t psread_stream(uint32_t Addr, uint32_t size, uint32_t chunk,
+	psread_out_t out, void *ctx)
+{
+	psread_req_t done;
+	QueueHandle_t reply;
+	uint8_t *bufs, which = 0, err = 0;
+	uint32_t busy = 0;
+	
+	if(!size)
+		return 0;
+	if(!(reply = xQueueCreate(1, sizeof(psread_req_t))))
+		return 1;
+	
+	/* smaller chunks if memory is short */
+	while(!(bufs = heap_caps_malloc(2*chunk, MALLOC_CAP_DMA)))
+	{
+		if((chunk /= 2) < PSREAD_MIN)
+		{
+			ESP_LOGE(TAG, "No memory for read buffers");
+			vQueueDelete(reply);
+			return 1;
+		}
+	}
+	
+	/* first chunk */
+	psread_next(&Addr, &size, chunk, bufs, reply);
+	busy++;
+	
+	while(busy)
+	{
+		xQueueReceive(reply, &done, portMAX_DELAY);
+		busy--;
+		
+		/* start on the next one before passing this one on */
+		which ^= 1;
+		if(size && !err)
+		{
+			psread_next(&Addr, &size, chunk, bufs + which*chunk, reply);
+			busy++;
+		}
+		
+		if(!err && out(ctx, done.buf, done.len))
+		{
+			ESP_LOGW(TAG, "Read stopped with %u left", size);
+			err = 4;
+		}
+	}
+	
+	vQueueDelete(reply);
+	free(bufs);
+	return err;
+}
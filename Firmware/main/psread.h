@@ -0,0 +1,18 @@
+/*
+ * psread.h - double-buffered PSRAM reads
+ * 10-17-26
+ */
+
+#ifndef __PSREAD__
+#define __PSREAD__
+
+#include "main.h"
+
+/* takes each filled buffer in order, returns nonzero to stop early */
+typedef uint8_t (*psread_out_t)(void *ctx, uint8_t *data, uint32_t len);
+
+esp_err_t psread_init(void);
+uint8_t psread_stream(uint32_t Addr, uint32_t size, uint32_t chunk,
+	psread_out_t out, void *ctx);
+
+#endif
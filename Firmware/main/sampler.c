@@ -0,0 +1,339 @@
+/*
+ * sampler.c - periodic FPGA register sampling streamed over TCP
+ * 10-17-26
+ *
+ * A periodic esp_timer wakes the sample task, which reads a set of
+ * registers in one turn at the FPGA port and puts them in a RAM ring with
+ * a sequence number and timestamp. A client connected to the stream port
+ * gets the ring drained to it in batches as it fills. Samples wait in the
+ * ring until something reads them, here or over a command, and are counted
+ * as overflow when it's full. The stream sends batches back to back while
+ * the ring has samples and only sleeps once it's empty. Periods that go by while the last sample is
+ * still being taken, or while someone else has the port, are counted as
+ * missed.
+ */
+
+#include <string.h>
+#include "sampler.h"
+#include "ice.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+
+#define SAMPLER_STACK		2560
+#define SAMPLER_PRIO		7			// above the socket handlers
+#define SAMPLER_BATCH_SZ	4096		// most sent at once
+#define SAMPLER_DRAIN_TICKS	1			// stream checks an empty ring this often
+
+/* sampling setup and the ring it fills */
+typedef struct
+{
+	uint8_t running, gen;		// gen changes with each start
+	uint8_t regs[SAMPLER_MAX_REGS];
+	uint32_t period_us, nregs;
+	uint8_t *ring;
+	uint32_t recsz, nslots, head, tail;
+	uint32_t seq, overflow, missed;
+	uint64_t sum_us;
+	uint32_t max_us;
+	uint32_t drained;			// samples sent to the stream
+	uint64_t drain_us;			// time spent reading and sending them
+	int64_t t0;
+} sampler_t;
+
+static const char* TAG = "sampler";
+static SemaphoreHandle_t sampler_mutex;
+static esp_timer_handle_t sampler_timer;
+static TaskHandle_t sampler_handle;
+static sampler_t sampler;
+
+/*
+ * timer callback - runs in the esp_timer task so just wakes the sampler
+ */
+static void sampler_tick(void *arg)
+{
+	xTaskNotifyGive(sampler_handle);
+}
+
+/*
+ * take the samples, one per wakeup
+ */
+static void sampler_sample_task(void *pvParameters)
+{
+	uint32_t rec[2+SAMPLER_MAX_REGS], nregs, wakes, i, us;
+	uint8_t regs[SAMPLER_MAX_REGS], gen;
+	int64_t start;
+	
+	while(1)
+	{
+		wakes = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		/* take a copy of the setup in case of a restart */
+		xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+		if(!sampler.running)
+		{
+			xSemaphoreGive(sampler_mutex);
+			continue;
+		}
+		sampler.missed += wakes - 1;
+		gen = sampler.gen;
+		nregs = sampler.nregs;
+		memcpy(regs, sampler.regs, nregs);
+		xSemaphoreGive(sampler_mutex);
+		
+		start = esp_timer_get_time();
+		if(ICE_Lock((TickType_t)1) != pdTRUE)
+		{
+			xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+			sampler.missed++;
+			xSemaphoreGive(sampler_mutex);
+			continue;
+		}
+		for(i=0;i<nregs;i++)
+			ICE_FPGA_Serial_Read(regs[i], &rec[2+i]);
+		ICE_Unlock();
+		us = esp_timer_get_time() - start;
+		
+		xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+		if(sampler.running && (sampler.gen == gen))
+		{
+			rec[0] = sampler.seq++;
+			rec[1] = start - sampler.t0;
+			sampler.sum_us += us;
+			sampler.max_us = us > sampler.max_us ? us : sampler.max_us;
+			if(sampler.head - sampler.tail == sampler.nslots)
+				sampler.overflow++;
+			else
+			{
+				memcpy(sampler.ring + (sampler.head % sampler.nslots)*sampler.recsz,
+					rec, sampler.recsz);
+				sampler.head++;
+			}
+		}
+		xSemaphoreGive(sampler_mutex);
+	}
+}
+
+/*
+ * create the lock, timer and sample task
+ */
+esp_err_t sampler_init(void)
+{
+	esp_timer_create_args_t args =
+	{
+		.callback = sampler_tick,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "sampler",
+	};
+	
+	if(!(sampler_mutex = xSemaphoreCreateMutex()))
+		return ESP_ERR_NO_MEM;
+	if(xTaskCreate(sampler_sample_task, "sampler", SAMPLER_STACK, NULL,
+		SAMPLER_PRIO, &sampler_handle) != pdPASS)
+		return ESP_ERR_NO_MEM;
+	return esp_timer_create(&args, &sampler_timer);
+}
+
+/*
+ * start sampling regs every period_us, dropping anything not yet read
+ */
+uint8_t sampler_start(uint32_t period_us, const uint8_t *regs, uint32_t nregs)
+{
+	uint32_t i;
+	
+	if(!nregs || (nregs > SAMPLER_MAX_REGS) || (period_us < SAMPLER_MIN_US) ||
+		(period_us > SAMPLER_MAX_US))
+		return 8;
+	
+	sampler_stop();
+	xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+	if(!sampler.ring && !(sampler.ring = malloc(SAMPLER_RING_SZ)))
+	{
+		xSemaphoreGive(sampler_mutex);
+		return 1;
+	}
+	for(i=0;i<nregs;i++)
+		sampler.regs[i] = regs[i] & 0x7f;
+	sampler.nregs = nregs;
+	sampler.period_us = period_us;
+	sampler.recsz = 4*(2 + nregs);
+	sampler.nslots = SAMPLER_RING_SZ / sampler.recsz;
+	sampler.head = sampler.tail = 0;
+	sampler.seq = sampler.overflow = sampler.missed = sampler.max_us = 0;
+	sampler.sum_us = sampler.drain_us = 0;
+	sampler.drained = 0;
+	sampler.gen++;
+	sampler.running = 1;
+	sampler.t0 = esp_timer_get_time();
+	xSemaphoreGive(sampler_mutex);
+	
+	esp_timer_start_periodic(sampler_timer, period_us);
+	ESP_LOGI(TAG, "Sampling %u registers every %u us", nregs, period_us);
+	return 0;
+}
+
+/*
+ * stop taking samples - what's in the ring can still be read
+ */
+void sampler_stop(void)
+{
+	esp_timer_stop(sampler_timer);
+	xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+	if(sampler.running)
+		ESP_LOGI(TAG, "Stopped after %u samples, %u lost, %u missed", sampler.seq,
+			sampler.overflow, sampler.missed);
+	sampler.running = 0;
+	xSemaphoreGive(sampler_mutex);
+}
+
+/*
+ * snapshot of the counters
+ */
+void sampler_stats(sampler_stats_t *stats)
+{
+	xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+	stats->running = sampler.running;
+	stats->period_us = sampler.period_us;
+	stats->nregs = sampler.nregs;
+	stats->samples = sampler.seq;
+	stats->overflow = sampler.overflow;
+	stats->missed = sampler.missed;
+	stats->queued = sampler.head - sampler.tail;
+	stats->mean_us = sampler.seq ? sampler.sum_us / sampler.seq : 0;
+	stats->max_us = sampler.max_us;
+	stats->max_hz = sampler.sum_us ? 1000000ULL * sampler.seq / sampler.sum_us : 0;
+	if(sampler.drain_us && (1000000ULL * sampler.drained / sampler.drain_us < stats->max_hz))
+		stats->max_hz = 1000000ULL * sampler.drained / sampler.drain_us;
+	xSemaphoreGive(sampler_mutex);
+}
+
+/*
+ * take as many samples out of the ring as fit in sz bytes after a batch
+ * header. Returns the bytes used, 0 if sz won't hold the header.
+ */
+uint32_t sampler_read(uint8_t *buf, uint32_t sz)
+{
+	sampler_batch_t *hdr = (sampler_batch_t *)buf;
+	uint8_t *out = buf + sizeof(sampler_batch_t);
+	uint32_t count = 0, i;
+	
+	if(sz < sizeof(sampler_batch_t))
+		return 0;
+	
+	xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+	if(sampler.ring)
+	{
+		count = (sz - sizeof(sampler_batch_t)) / sampler.recsz;
+		if(count > sampler.head - sampler.tail)
+			count = sampler.head - sampler.tail;
+		for(i=0;i<count;i++)
+		{
+			memcpy(out, sampler.ring + (sampler.tail % sampler.nslots)*sampler.recsz,
+				sampler.recsz);
+			out += sampler.recsz;
+			sampler.tail++;
+		}
+	}
+	hdr->magic = SAMPLER_MAGIC;
+	hdr->count = count;
+	hdr->nregs = sampler.nregs;
+	hdr->overflow = sampler.overflow;
+	xSemaphoreGive(sampler_mutex);
+	
+	return out - buf;
+}
+
+/*
+ * stream to one subscriber at a time, until it hangs up. Batches go out
+ * back to back while there are samples waiting, so the rate isn't capped
+ * at a batch per tick.
+ */
+static void sampler_stream(int sock, uint8_t *buf)
+{
+	uint32_t len, count;
+	uint8_t *wptr;
+	int written;
+	int64_t start;
+	char c;
+	int got;
+	
+	while(1)
+	{
+		/* nothing is expected from the client - a hang-up or socket error ends it */
+		got = recv(sock, &c, 1, MSG_DONTWAIT);
+		if(!got || ((got < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+			return;
+		
+		start = esp_timer_get_time();
+		len = sampler_read(buf, SAMPLER_BATCH_SZ);
+		if(!(count = ((sampler_batch_t *)buf)->count))
+		{
+			vTaskDelay(SAMPLER_DRAIN_TICKS);
+			continue;
+		}
+		for(wptr = buf; len; wptr += written, len -= written)
+		{
+			if((written = send(sock, wptr, len, 0)) < 0)
+			{
+				ESP_LOGW(TAG, "Stream send failed: errno %d", errno);
+				return;
+			}
+		}
+		
+		/* how fast the stream drains, for max_hz */
+		xSemaphoreTake(sampler_mutex, portMAX_DELAY);
+		sampler.drained += count;
+		sampler.drain_us += esp_timer_get_time() - start;
+		xSemaphoreGive(sampler_mutex);
+	}
+}
+
+/*
+ * listen for a subscriber on the stream port
+ */
+void sampler_task(void *pvParameters)
+{
+	static uint8_t buf[SAMPLER_BATCH_SZ];
+	struct sockaddr_in dest_addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(SAMPLER_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	int opt = 1;
+	
+	int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if(listen_sock < 0)
+	{
+		ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+		vTaskDelete(NULL);
+		return;
+	}
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if((bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) ||
+		(listen(listen_sock, 1) != 0))
+	{
+		ESP_LOGE(TAG, "Socket unable to listen: errno %d", errno);
+		close(listen_sock);
+		vTaskDelete(NULL);
+		return;
+	}
+	ESP_LOGI(TAG, "Streaming on TCP port %d", SAMPLER_PORT);
+	
+	while(1)
+	{
+		int sock = accept(listen_sock, NULL, NULL);
+		if(sock < 0)
+		{
+			ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+			continue;
+		}
+		setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+		ESP_LOGI(TAG, "Subscriber connected");
+		
+		sampler_stream(sock, buf);
+		
+		ESP_LOGI(TAG, "Subscriber gone");
+		shutdown(sock, 0);
+		close(sock);
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * sampler.h - periodic FPGA register sampling streamed over TCP
+ * 10-17-26
+ */
+
+#ifndef __SAMPLER__
+#define __SAMPLER__
+
+#include "main.h"
+
+#define SAMPLER_ENABLE		1			// 0 leaves the stream port closed
+#define SAMPLER_PORT		3336
+#define SAMPLER_MAX_REGS	16
+#define SAMPLER_MIN_US		100			// shortest sample period
+#define SAMPLER_MAX_US		(10*1000*1000)
+#define SAMPLER_RING_SZ		32768		// bytes of samples held for the client
+#define SAMPLER_MAGIC		0xCAFE5A70	// batch header
+
+/*
+ * batch header, followed by count samples of a sequence number, the time
+ * in us since the start and one word per register - sent as-is
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t count;			// samples that follow
+	uint32_t nregs;			// registers in each
+	uint32_t overflow;		// samples lost so far to a full ring
+} sampler_batch_t;
+
+/* how sampling is going - sent as-is to the host */
+typedef struct
+{
+	uint32_t running;
+	uint32_t period_us;
+	uint32_t nregs;
+	uint32_t samples;		// taken since the start
+	uint32_t overflow;		// lost because the ring was full
+	uint32_t missed;		// periods skipped, last sample or FPGA port busy
+	uint32_t queued;		// in the ring now
+	uint32_t mean_us;		// time to take a sample
+	uint32_t max_us;
+	uint32_t max_hz;		// fastest rate the reads and the stream could keep up with
+} sampler_stats_t;
+
+esp_err_t sampler_init(void);
+uint8_t sampler_start(uint32_t period_us, const uint8_t *regs, uint32_t nregs);
+void sampler_stop(void);
+void sampler_stats(sampler_stats_t *stats);
+uint32_t sampler_read(uint8_t *buf, uint32_t sz);
+void sampler_task(void *pvParameters);
+
+#endif
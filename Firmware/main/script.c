@@ -0,0 +1,491 @@
+/*
+ * script.c - command scripts stored in SPIFFS
+ * 10-17-26
+ *
+ * A script is a compact list of register writes, PSRAM writes and fills,
+ * bitstream loads, delays, register polls and loops that the firmware
+ * runs by itself, so bring-up of a design doesn't need the host after
+ * every power cycle. Scripts are checked as a whole before anything is
+ * stored or run. Script 0 runs at boot in its own task once the interfaces
+ * are up and the power-on config is done, so a bad one can be stopped.
+ *
+ * The FPGA port is taken for each op, or each piece of a PSRAM op, so
+ * other clients still get a turn while a script runs. Only one script
+ * runs at a time. A run is stopped after too many ops or too much time
+ * spent in delays and polls, and can be stopped by a client.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "script.h"
+#include "ice.h"
+#include "cfgtask.h"
+#include "psops.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "freertos/semphr.h"
+
+#define SCRIPT_FILE			"/spiffs/script%u.bin"
+#define SCRIPT_TMP			"/spiffs/script.tmp"
+#define SCRIPT_PIECE		4096
+#define SCRIPT_CFG_WAIT		(5000/portTICK_PERIOD_MS)
+#define SCRIPT_BUSY_WAIT	((TickType_t)100)
+#define SCRIPT_SLICE_US		100000		// waits check for a stop this often
+#define SCRIPT_STACK		4096
+#define SCRIPT_PRIO			4			// below the socket handlers
+
+static const char* TAG = "script";
+static SemaphoreHandle_t script_mutex;
+static QueueHandle_t script_reply;
+static volatile uint8_t script_stopping;
+
+/*
+ * set up the lock and config reply queue
+ */
+esp_err_t script_init(void)
+{
+	if(!(script_mutex = xSemaphoreCreateMutex()) ||
+		!(script_reply = xQueueCreate(1, sizeof(cfgtask_result_t))))
+		return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+/*
+ * length of the op at s with left bytes to go, -1 if it's bad
+ */
+static int32_t script_op_len(const uint8_t *s, uint32_t left)
+{
+	uint32_t len;
+	
+	switch(s[0])
+	{
+		case SCRIPT_END:		len = 1; break;
+		case SCRIPT_WRITE:		len = 6; break;
+		case SCRIPT_RMW:		len = 10; break;
+		case SCRIPT_PS_WRITE:
+			if(left < 9)
+				return -1;
+			memcpy(&len, s+5, 4);
+			if(len > left - 9)
+				return -1;
+			len += 9;
+			break;
+		case SCRIPT_PS_FILL:	len = 13; break;
+		case SCRIPT_LOAD:
+			if((left < 2) || !s[1] || (s[1] > SCRIPT_NAME_MAX))
+				return -1;
+			len = 2 + s[1];
+			break;
+		case SCRIPT_DELAY:		len = 5; break;
+		case SCRIPT_POLL:		len = 14; break;
+		case SCRIPT_LOOP:		len = 5; break;
+		case SCRIPT_NEXT:		len = 1; break;
+		default:				return -1;
+	}
+	
+	return len <= left ? len : -1;
+}
+
+/*
+ * check a whole script - known ops that fit, loops that match up
+ */
+uint8_t script_check(const uint8_t *s, uint32_t len)
+{
+	uint32_t magic, count, pc = 4;
+	uint8_t depth = 0;
+	int32_t oplen;
+	
+	if(len < 4)
+		return 8;
+	memcpy(&magic, s, 4);
+	if(magic != SCRIPT_MAGIC)
+		return 8;
+	
+	while((pc < len) && (s[pc] != SCRIPT_END))
+	{
+		if((oplen = script_op_len(s+pc, len-pc)) < 0)
+		{
+			ESP_LOGW(TAG, "Bad op 0x%02X at %u", s[pc], pc);
+			return 8;
+		}
+		if(s[pc] == SCRIPT_LOOP)
+		{
+			memcpy(&count, s+pc+1, 4);
+			if(!count || (++depth > SCRIPT_LOOP_DEPTH))
+			{
+				ESP_LOGW(TAG, "Bad loop at %u", pc);
+				return 8;
+			}
+		}
+		else if((s[pc] == SCRIPT_NEXT) && !depth--)
+		{
+			ESP_LOGW(TAG, "Next without loop at %u", pc);
+			return 8;
+		}
+		pc += oplen;
+	}
+	
+	if(depth)
+	{
+		ESP_LOGW(TAG, "Loop without next");
+		return 8;
+	}
+	return 0;
+}
+
+/*
+ * take the FPGA port for one op
+ */
+static uint8_t script_lock(void)
+{
+	if(ICE_Lock((TickType_t)100) == pdTRUE)
+		return 0;
+	ESP_LOGW(TAG, "Couldn't get FPGA access");
+	return 1;
+}
+
+/*
+ * PSRAM from data, a piece at a time
+ */
+static uint8_t script_psram(uint32_t Addr, uint32_t len, const uint8_t *data)
+{
+	uint32_t sz;
+	
+	while(len)
+	{
+		sz = len < SCRIPT_PIECE ? len : SCRIPT_PIECE;
+		if(script_lock())
+			return 1;
+		ICE_PSRAM_Write(Addr, (uint8_t *)data, sz);
+		ICE_Unlock();
+		
+		Addr += sz;
+		len -= sz;
+		data += sz;
+	}
+	
+	return 0;
+}
+
+/*
+ * configure from a SPIFFS bitstream and wait for it
+ */
+static uint8_t script_load(const uint8_t *name, uint8_t namesz)
+{
+	char path[8+SCRIPT_NAME_MAX+1] = "/spiffs/";
+	cfgtask_result_t result;
+	uint32_t id;
+	
+	memcpy(path+8, name, namesz);
+	path[8+namesz] = 0;
+	if(!(id = load_fpga(path, script_reply)))
+		return 8;
+	if(cfgtask_result(script_reply, id, &result, SCRIPT_CFG_WAIT) != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Config job %u timed out", id);
+		return 1;
+	}
+	return result.status ? 8 : 0;
+}
+
+/*
+ * take us out of what's left to wait this run
+ */
+static uint8_t script_budget(uint32_t us, uint32_t *left)
+{
+	if(us > *left)
+	{
+		ESP_LOGW(TAG, "Over %u us of delays & polls", SCRIPT_MAX_US);
+		return 8;
+	}
+	*left -= us;
+	return 0;
+}
+
+/*
+ * wait us, sleeping for whole ticks a slice at a time
+ */
+static uint8_t script_delay(uint32_t us, uint32_t *left)
+{
+	const uint32_t tick_us = 1000*portTICK_PERIOD_MS;
+	uint32_t sz;
+	
+	if(script_budget(us, left))
+		return 8;
+	while((us >= tick_us) && !script_stopping)
+	{
+		sz = us < SCRIPT_SLICE_US ? us : SCRIPT_SLICE_US;
+		vTaskDelay(sz / tick_us);
+		us -= sz - sz % tick_us;
+	}
+	if(us % tick_us)
+		ets_delay_us(us % tick_us);
+	return 0;
+}
+
+/*
+ * poll a slice at a time until it matches, times out or is stopped
+ */
+static uint8_t script_poll(uint8_t Reg, uint32_t *w, uint32_t *left)
+{
+	uint32_t timeout = w[2], sz;
+	ice_poll_t poll;
+	uint8_t err;
+	
+	do
+	{
+		sz = timeout < SCRIPT_SLICE_US ? timeout : SCRIPT_SLICE_US;
+		err = ICE_FPGA_Serial_Poll(Reg, w[0], w[1], sz, 0, &poll);
+		if(script_budget(poll.us, left))
+			return 8;
+		timeout -= sz;
+	}
+	while((err == ICE_POLL_TIMEOUT_ERR) && timeout && !script_stopping);
+	return err;
+}
+
+/*
+ * check then run a script
+ */
+uint8_t script_exec(const uint8_t *s, uint32_t len, script_result_t *result)
+{
+	struct { uint32_t start, left; } loop[SCRIPT_LOOP_DEPTH];
+	uint32_t pc = 4, w[4], Data, left = SCRIPT_MAX_US;
+	int64_t start = esp_timer_get_time();
+	uint8_t err, depth = 0;
+	int32_t oplen;
+	
+	memset(result, 0, sizeof(script_result_t));
+	if((err = script_check(s, len)))
+		return err;
+	
+	if(xSemaphoreTake(script_mutex, SCRIPT_BUSY_WAIT) != pdTRUE)
+	{
+		ESP_LOGW(TAG, "Another script is running");
+		return 1;
+	}
+	script_stopping = 0;
+	while(!err && (pc < len) && (s[pc] != SCRIPT_END))
+	{
+		const uint8_t *op = s + pc;
+		
+		oplen = script_op_len(op, len-pc);
+		result->offset = pc;
+		if(script_stopping)
+		{
+			ESP_LOGW(TAG, "Stopped by request");
+			err = 1;
+			break;
+		}
+		if(++result->ops > SCRIPT_MAX_OPS)
+		{
+			ESP_LOGW(TAG, "Over %u ops", SCRIPT_MAX_OPS);
+			err = 8;
+			break;
+		}
+		switch(op[0])
+		{
+			case SCRIPT_WRITE:
+			case SCRIPT_RMW:
+				memcpy(w, op+2, oplen-2);
+				if((err = script_lock()))
+					break;
+				if(op[0] == SCRIPT_RMW)
+				{
+					ICE_FPGA_Serial_Read(op[1] & 0x7f, &Data);
+					w[0] = (Data & ~w[0]) | (w[1] & w[0]);
+				}
+				ICE_FPGA_Serial_Write(op[1] & 0x7f, w[0]);
+				ICE_Unlock();
+				break;
+			
+			case SCRIPT_PS_WRITE:
+			case SCRIPT_PS_FILL:
+				memcpy(w, op+1, 8);
+				if(op[0] == SCRIPT_PS_FILL)
+				{
+					memcpy(&w[2], op+9, 4);
+					err = psops_fill(w[0], w[1], w[2]);
+				}
+				else
+					err = script_psram(w[0], w[1], op+9);
+				break;
+			
+			case SCRIPT_LOAD:
+				err = script_load(op+2, op[1]);
+				break;
+			
+			case SCRIPT_DELAY:
+				memcpy(w, op+1, 4);
+				err = script_delay(w[0], &left);
+				break;
+			
+			case SCRIPT_POLL:
+				memcpy(w, op+2, 12);
+				err = script_poll(op[1] & 0x7f, w, &left);
+				break;
+			
+			case SCRIPT_LOOP:
+				memcpy(&loop[depth].left, op+1, 4);
+				loop[depth++].start = pc + oplen;
+				break;
+			
+			case SCRIPT_NEXT:
+				if(--loop[depth-1].left)
+				{
+					pc = loop[depth-1].start;
+					continue;
+				}
+				depth--;
+				break;
+		}
+		pc += oplen;
+	}
+	xSemaphoreGive(script_mutex);
+	
+	result->us = esp_timer_get_time() - start;
+	if(err)
+		ESP_LOGW(TAG, "Stopped at op 0x%02X, offset %u, err %d", s[result->offset],
+			result->offset, err);
+	else
+		ESP_LOGI(TAG, "Ran %u ops in %u us", result->ops, result->us);
+	return err;
+}
+
+/*
+ * store a script as number num, replacing the old one when the new one is
+ * complete. An empty script removes it.
+ */
+uint8_t script_save(uint32_t num, const uint8_t *s, uint32_t len)
+{
+	char name[32];
+	struct stat st;
+	uint8_t err;
+	FILE *f;
+	
+	if(num >= SCRIPT_NUM)
+		return 8;
+	sprintf(name, SCRIPT_FILE, num);
+	
+	if(!len)
+	{
+		if(stat(name, &st) == 0)
+			unlink(name);
+		ESP_LOGI(TAG, "Removed %s", name);
+		return 0;
+	}
+	if((err = script_check(s, len)))
+		return err;
+	
+	if(!(f = fopen(SCRIPT_TMP, "wb")))
+	{
+		ESP_LOGE(TAG, "Failed to open %s for writing", SCRIPT_TMP);
+		return 1;
+	}
+	err = fwrite(s, 1, len, f) != len;
+	fclose(f);
+	if(err)
+	{
+		ESP_LOGE(TAG, "Failed writing %s", SCRIPT_TMP);
+		unlink(SCRIPT_TMP);
+		return 1;
+	}
+	
+	if(stat(name, &st) == 0)
+		unlink(name);
+	if(rename(SCRIPT_TMP, name))
+	{
+		ESP_LOGE(TAG, "Failed to rename %s to %s", SCRIPT_TMP, name);
+		return 1;
+	}
+	
+	ESP_LOGI(TAG, "Saved %s, %u bytes", name, len);
+	return 0;
+}
+
+/*
+ * run stored script num
+ */
+uint8_t script_run(uint32_t num, script_result_t *result)
+{
+	uint8_t *s, err;
+	char name[32];
+	long len;
+	FILE *f;
+	
+	memset(result, 0, sizeof(script_result_t));
+	if(num >= SCRIPT_NUM)
+		return 8;
+	sprintf(name, SCRIPT_FILE, num);
+	if(!(f = fopen(name, "rb")))
+	{
+		ESP_LOGW(TAG, "No script %s", name);
+		return 8;
+	}
+	
+	fseek(f, 0L, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if(!(s = malloc(len ? len : 1)))
+	{
+		fclose(f);
+		return 1;
+	}
+	err = fread(s, 1, len, f) != len;
+	fclose(f);
+	
+	if(err)
+		ESP_LOGE(TAG, "Failed reading %s", name);
+	else
+	{
+		ESP_LOGI(TAG, "Running %s", name);
+		err = script_exec(s, len, result);
+	}
+	free(s);
+	return err;
+}
+
+/*
+ * stop the script that's running, if any, at its next op or wait slice
+ */
+void script_stop(void)
+{
+	script_stopping = 1;
+	ESP_LOGI(TAG, "Stop requested");
+}
+
+/*
+ * run script 0 once the FPGA is configured, then go away
+ */
+static void script_boot_task(void *pvParameters)
+{
+	script_result_t result;
+	
+	cfgtask_wait_idle(NULL, portMAX_DELAY);
+	if(script_run(0, &result))
+		ESP_LOGE(TAG, "Boot script failed");
+	vTaskDelete(NULL);
+}
+
+/*
+ * start script 0 if there is one
+ */
+void script_boot(void)
+{
+	char name[32];
+	struct stat st;
+	
+	if(!script_mutex)
+		return;
+	sprintf(name, SCRIPT_FILE, 0);
+	if(stat(name, &st) != 0)
+	{
+		ESP_LOGI(TAG, "No boot script");
+		return;
+	}
+	
+	if(xTaskCreate(script_boot_task, "script", SCRIPT_STACK, NULL, SCRIPT_PRIO,
+		NULL) != pdPASS)
+		ESP_LOGE(TAG, "Boot script task failed");
+}
@@ -0,0 +1,52 @@
+/*
+ * script.h - command scripts stored in SPIFFS
+ * 10-17-26
+ */
+
+#ifndef __SCRIPT__
+#define __SCRIPT__
+
+#include "main.h"
+
+#define SCRIPT_MAGIC		0x53454349	// "ICES"
+#define SCRIPT_NUM			8			// stored scripts, 0 runs at boot
+#define SCRIPT_NAME_MAX		31			// bitstream file name for a load
+#define SCRIPT_LOOP_DEPTH	4			// loops inside loops
+#define SCRIPT_MAX_OPS		1000000		// ops in one run, counting loops
+#define SCRIPT_MAX_US		60000000	// delays & polls in one run
+
+/*
+ * ops - a byte, then the listed args. reg is a byte, the rest are 32-bit
+ * little endian words unless noted.
+ */
+enum
+{
+	SCRIPT_END,			// none - stops here
+	SCRIPT_WRITE,		// reg, data
+	SCRIPT_RMW,			// reg, mask, data - masked bits replaced
+	SCRIPT_PS_WRITE,	// addr, len, len bytes of data
+	SCRIPT_PS_FILL,		// addr, len, pattern word
+	SCRIPT_LOAD,		// name length byte, name of a SPIFFS bitstream
+	SCRIPT_DELAY,		// us
+	SCRIPT_POLL,		// reg, mask, expected, timeout us - stops if no match
+	SCRIPT_LOOP,		// count - ops up to the matching NEXT run count times
+	SCRIPT_NEXT,		// none
+};
+
+/* how a run went - layout is sent as-is to the host */
+typedef struct
+{
+	uint32_t ops;			// ops run, counting each pass of a loop
+	uint32_t us;			// time taken
+	uint32_t offset;		// of the last op run, where it stopped on error
+} script_result_t;
+
+esp_err_t script_init(void);
+uint8_t script_check(const uint8_t *s, uint32_t len);
+uint8_t script_exec(const uint8_t *s, uint32_t len, script_result_t *result);
+uint8_t script_save(uint32_t num, const uint8_t *s, uint32_t len);
+uint8_t script_run(uint32_t num, script_result_t *result);
+void script_stop(void);
+void script_boot(void);
+
+#endif
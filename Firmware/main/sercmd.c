@@ -7,21 +7,58 @@
 #include "spiffs.h"
 #include "adc_c3.h"
 #include <string.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include "uart2.h"
 #include "rom/crc.h"
 #include "esp_vfs_usb_serial_jtag.h"
 #include "wifi.h"
 #include "mbedtls/base64.h"
+#include "extcmd.h"
+#include "cfgtask.h"
+#include "bitslot.h"
+#include "bitcache.h"
+#include "sink.h"
+#include "frame.h"
+#include "psread.h"
+#include "driver/usb_serial_jtag.h"
 
-/* USB Serial doesn't give more than this per call */
+/* binary bytes per line of base64 output */
 #define MAX_RDSZ 64
 
+/* USB receive - driver ring buffer and how much is drained per read */
+#define SER_RING_SZ 8192
+#define SER_RX_SZ 4096
+
+/* give up on a payload after this long without data */
+#define SER_RX_WAIT (1000/portTICK_PERIOD_MS)
+
+/* how long to wait for a config job */
+#define CFG_WAIT (5000/portTICK_PERIOD_MS)
+
 /* uncomment to turn on UART2 debugging */
 //#define SERCMD_DBG
 
 static const char* TAG = "sercmd";
+static QueueHandle_t cfg_reply;
+static uint8_t *rx_buffer, *tx_buffer;
+static uint8_t bin_mode;
+
+/* what's being done with a payload */
+enum
+{
+	SER_BUF,		// short command collected in a buffer
+	SER_SINK,		// long payload streamed into a sink
+	SER_DROP,		// error - discard the rest
+};
+
+/* state of the payload being received */
+typedef struct
+{
+	uint8_t cmd, mode, err, locked;
+	uint32_t txsz, left;
+	uint8_t *buffer, *bufptr;
+	sink_t sink;
+} sercmd_rx_t;
 
 static const uint8_t cmdheader[4] =
 {
@@ -29,56 +66,158 @@ static const uint8_t cmdheader[4] =
 };
 
 /*
- * Command handler for serial
+ * send one binary frame
  */
-void sercmd_handle(uint8_t cmd, uint8_t *buffer, uint32_t txsz)
+static void sercmd_frame(uint8_t type, const uint8_t *body, uint32_t len)
 {
-	uint32_t Data = 0;
-	uint8_t err = 0, cfg_stat;	
+	fwrite(tx_buffer, 1, frame_encode(type, body, len, tx_buffer), stdout);
+}
+
+/*
+ * send the short reply - error status and 32-bit data
+ */
+static void sercmd_reply(uint8_t err, uint32_t Data)
+{
+	uart2_printf("short reply: RX %02X %08X\r\n", err, Data);
+	if(bin_mode)
+	{
+		uint8_t body[5] = {err, Data, Data>>8, Data>>16, Data>>24};
+		sercmd_frame(FRAME_STATUS, body, 5);
+	}
+	else
+		fprintf(stdout, "  RX %02X %08X\n", err, Data);
+}
+
+/*
+ * send a block of binary data as base64 lines or data frames with a
+ * terminator
+ */
+static void sercmd_data_out(uint32_t Addr, uint8_t *data, uint32_t sz)
+{
+	unsigned char output[2*MAX_RDSZ];
+	size_t outlen;
 	
-	uart2_printf("sercmd_handle: cmd %d, bufsz %d\r\n", cmd, txsz);
+	if(bin_mode)
+	{
+		while(sz)
+		{
+			uint32_t rdsz = sz > FRAME_MAX ? FRAME_MAX : sz;
+			sercmd_frame(FRAME_DATA, data, rdsz);
+			data += rdsz;
+			sz -= rdsz;
+		}
+		sercmd_frame(FRAME_END, NULL, 0);
+		return;
+	}
 	
-	if(cmd == 0xf)
+	while(sz)
 	{
-		/* send configuration to FPGA */
-		if((cfg_stat = ICE_FPGA_Config((uint8_t *)buffer, txsz)))
-			err |= 8;
+		uint32_t rdsz = sz > MAX_RDSZ ? MAX_RDSZ : sz;
+		mbedtls_base64_encode(output, 2*MAX_RDSZ, &outlen, data, rdsz);
+		output[outlen] = 0;
+		uart2_printf("  RX %08X %02X %s\r\n", Addr, rdsz, output);
+		fprintf(stdout, "  RX %08X %02X %s\n", Addr, rdsz, output);
+		Addr += rdsz;
+		data += rdsz;
+		sz -= rdsz;
 	}
-	else if(cmd == 0xe)
+	
+	/* end condition */
+	uart2_printf("  RX %08X %02X\r\n", -1, 70);
+	fprintf(stdout, "  RX %08X %02X\n", -1, 70);
+}
+
+/*
+ * PSRAM read output - one data frame or base64 lines per chunk
+ */
+static uint8_t sercmd_ps_out(void *ctx, uint8_t *data, uint32_t len)
+{
+	uint32_t *Addr = ctx;
+	unsigned char output[2*MAX_RDSZ];
+	size_t outlen;
+	
+	if(bin_mode)
 	{
-		/* save configuration to the SPIFFS filesystem */
-		if((cfg_stat = spiffs_write((char *)cfg_file, (uint8_t *)buffer, txsz)))
-			err |= 8;
+		sercmd_frame(FRAME_DATA, data, len);
+		return 0;
+	}
+	
+	while(len)
+	{
+		uint32_t rdsz = len > MAX_RDSZ ? MAX_RDSZ : len;
+		mbedtls_base64_encode(output, 2*MAX_RDSZ, &outlen, data, rdsz);
+		output[outlen] = 0;
+		uart2_printf("  RX %08X %02X %s\r\n", *Addr, rdsz, output);
+		fprintf(stdout, "  RX %08X %02X %s\n", *Addr, rdsz, output);
+		*Addr += rdsz;
+		data += rdsz;
+		len -= rdsz;
 	}
-	else if(cmd == 0xc)
+	return 0;
+}
+
+/*
+ * PSRAM read - takes turns at the FPGA with other clients
+ */
+static void sercmd_ps_read(uint32_t Addr, uint32_t sz)
+{
+	uint8_t err = psread_stream(Addr, sz, FRAME_MAX, sercmd_ps_out, &Addr);
+	
+	/* end condition */
+	if(bin_mode)
 	{
-		/* write block of data to PSRAM via SPI pass-thru */
-		uint32_t Addr = *((uint32_t *)buffer);
-		ICE_PSRAM_Write(Addr, (uint8_t *)buffer+4, txsz-4);
+		if(err)
+			sercmd_reply(err, 0);
+		else
+			sercmd_frame(FRAME_END, NULL, 0);
+	}
+	else
+	{
+		uart2_printf("  RX %08X %02X\r\n", -1, 70);
+		fprintf(stdout, "  RX %08X %02X\n", -1, 70);
+	}
+}
+
+/*
+ * wait for a config job, Data gets the config time in us
+ */
+static uint8_t sercmd_wait_cfg(uint32_t id, uint32_t *Data)
+{
+	cfgtask_result_t result;
+	
+	if(!id || (cfgtask_result(cfg_reply, id, &result, CFG_WAIT) != ESP_OK))
+		return 1;
+	if(result.status)
+		return 8;
+	
+	uart2_printf("config %u us @ %d Hz\r\n", result.us, result.hz);
+	*Data = result.us;
+	return 0;
+}
+
+/*
+ * Command handler for serial. Long payloads for config, save and PSRAM
+ * write are streamed through sink.c instead so don't come here.
+ */
+void sercmd_handle(uint8_t cmd, uint8_t *buffer, uint32_t txsz)
+{
+	uint32_t Data = 0;
+	uint8_t err = 0;
+	
+	uart2_printf("sercmd_handle: cmd %d, bufsz %d\r\n", cmd, txsz);
+	
+	if(cmd == 0xf)
+	{
+		/* just a CRC - configure from the cache if it's there */
+		uint32_t id = cached_fpga(*(uint32_t *)buffer, cfg_reply);
+		err |= id ? sercmd_wait_cfg(id, &Data) : BITCACHE_MISS_ERR;
 	}
 	else if(cmd == 0xb)
 	{
 		/* read block of data from PSRAM via SPI pass-thru */
 		uint32_t Addr = *((uint32_t *)buffer);
-		uint8_t psram_rdbuf[MAX_RDSZ];
 		uint32_t psram_rdsz = *((uint32_t *)(buffer+4));
-		unsigned char output[2*MAX_RDSZ];
-		size_t outlen;
-		while(psram_rdsz)
-		{
-			uint32_t rdsz = psram_rdsz > MAX_RDSZ ? MAX_RDSZ : psram_rdsz;
-			ICE_PSRAM_Read(Addr, (uint8_t *)psram_rdbuf, rdsz);
-			mbedtls_base64_encode(output, 2*MAX_RDSZ, &outlen, psram_rdbuf, rdsz);
-			output[outlen] = 0;
-			uart2_printf("  RX %08X %02X %s\r\n", Addr, rdsz, output);
-			fprintf(stdout, "  RX %08X %02X %s\n", Addr, rdsz, output);
-			Addr += rdsz;
-			psram_rdsz -= rdsz;
-		}
-		
-		/* end condition */
-		uart2_printf("  RX %08X %02X\r\n", -1, 70);
-		fprintf(stdout, "  RX %08X %02X\n", -1, 70);
+		sercmd_ps_read(Addr, psram_rdsz);
 	}
 	else if(cmd == 0xa)
 	{
@@ -126,7 +265,36 @@ void sercmd_handle(uint8_t cmd, uint8_t *buffer, uint32_t txsz)
 	{
         /* Report version and IP addr */
 		uart2_printf("  RX %02X %s %s\r\n", err, fwVersionStr, wifi_ip_addr);
-		fprintf(stdout, "  RX %02X %s %s\n", err, fwVersionStr, wifi_ip_addr);
+		if(bin_mode)
+		{
+			char info[80];
+			info[0] = err;
+			sprintf(info+1, "%s %s", fwVersionStr, wifi_ip_addr);
+			sercmd_frame(FRAME_TEXT, (uint8_t *)info, 1+strlen(info+1));
+		}
+		else
+			fprintf(stdout, "  RX %02X %s %s\n", err, fwVersionStr, wifi_ip_addr);
+	}
+	else if((cmd == EXTCMD_CMD) && (txsz >= 8) &&
+		(*(uint32_t *)buffer == EXTCMD_REPLY_MODE))
+	{
+		/* reply mode - answered in text so any host can read it */
+		fprintf(stdout, "  RX %02X %08X\n", err, 1);
+		bin_mode = *(uint32_t *)&buffer[4] & 1;
+		uart2_printf("reply mode %d\r\n", bin_mode);
+	}
+	else if(cmd == EXTCMD_CMD)
+	{
+		/* extended command - short reply has the length, then the data */
+		uint8_t *reply;
+		
+		err |= extcmd_handle(buffer, txsz, &reply, &Data);
+		sercmd_reply(err, Data);
+		if(reply)
+		{
+			sercmd_data_out(0, reply, Data);
+			free(reply);
+		}
 	}
 	else if(cmd == 6)
 	{
@@ -134,7 +302,7 @@ void sercmd_handle(uint8_t cmd, uint8_t *buffer, uint32_t txsz)
 		uint8_t Reg = *(uint32_t *)buffer & 0x1;
 		uart2_printf("load cfg %d\r\n", Reg);
 		const char *file = (Reg==0) ? cfg_file : spipass_file;
-		load_fpga(file);
+		err |= sercmd_wait_cfg(load_fpga(file, cfg_reply), &Data);
 	}
 	else
 	{
@@ -143,115 +311,116 @@ void sercmd_handle(uint8_t cmd, uint8_t *buffer, uint32_t txsz)
 	}
 
 	/* reply with error status */
-	if((cmd != 0x0b) && (cmd != 5))
+	if((cmd != 0x0b) && (cmd != 5) && (cmd != EXTCMD_CMD))
 	{
-		/* For most commands send reply as text */
-		uart2_printf("short reply: RX %02X %08X\r\n", err, Data);
-		fprintf(stdout, "  RX %02X %08X\n", err, Data);
+		/* For most commands send the short reply */
+		sercmd_reply(err, Data);
 	}
 }
 
 /*
- * special case for handling PSRAM Init message
+ * start a payload once its header is in, z if it's compressed
  */
-static void sercmd_ps_in(int txsz)
+static void sercmd_start(sercmd_rx_t *rx, uint8_t cmd, uint32_t txsz, uint8_t z)
 {
-	char buffer[MAX_RDSZ];
-	size_t bufsz, act, tot, use;
-	int rsz;
-	FILE* f = NULL;
-	uint8_t err = 0;	
+	rx->cmd = cmd;
+	rx->txsz = rx->left = txsz;
+	rx->err = 0;
+	rx->mode = SER_DROP;
 	
-    /* Check if psram file exists before removing */
-    struct stat st;
-    if(stat(psram_file, &st) == 0)
+	if(z && !sink_wants(cmd, txsz))
 	{
-        /* Delete it if it exists */
-        unlink(psram_file);
-		
-#if 0
-		/* do SPIFFS garbage collection (not available in V4.4.2) */
-		if(esp_spiffs_gc(conf.partition_label, len) != ESP_OK)
-		{
-			uart2_printf("SPIFFS GC failed\r\n");			
-			err = 2;
-		}
-#endif
+		uart2_printf("Can't unpack cmd %1d - flushing\r\n", cmd);
+		rx->err |= 8;
 	}
-
-	/* note SPIFFS avail space - only allow 75% utilization per docs */
-	spiffs_info(&tot, &use);
-	tot = ((4*tot)/3) - use;
-	uart2_printf("PS_IN: SPIFFS available: %d\r\n", tot);
-	
-	/* open file if enough space in SPIFFS */
-	if(tot > txsz)
+	else if(sink_wants(cmd, txsz))
 	{
-		f = fopen(psram_file, "wb");
-		if (f != NULL)
-		{
-			uart2_printf("PS_IN: Writing %d to file %s\r\n", txsz, psram_file);
-		}
+		/* long payload - stream it, unpacking on the way if need be */
+		if(z)
+			sink_open_z(&rx->sink, cmd, txsz);
 		else
-		{
-			uart2_printf("Failed to open file for writing\r\n");
-			err = 1;
-		}
+			sink_open(&rx->sink, cmd, txsz);
+		rx->mode = SER_SINK;
+	}
+	else if((rx->buffer = malloc(txsz)))
+	{
+		/* short command - collect it */
+		rx->bufptr = rx->buffer;
+		rx->mode = SER_BUF;
 	}
 	else
 	{
-		uart2_printf("Not enough space in SPIFFS - skipping\r\n");
-		err = 1;
+		uart2_printf("malloc failed - flushing\r\n");
+		rx->err |= 7;
 	}
-		
-	/* loop over receive data */
-	tot = 0;
-	bufsz = txsz < MAX_RDSZ ? txsz : MAX_RDSZ;
-	while(txsz)
+}
+
+/*
+ * hand a piece of payload to wherever it's going
+ */
+static void sercmd_data(sercmd_rx_t *rx, uint8_t *data, uint32_t len)
+{
+	switch(rx->mode)
 	{
-		/* get from socket */
-		size_t bsz = txsz <  bufsz ? txsz : bufsz;
-		rsz = read(STDIN_FILENO, buffer, bsz);
-		//uart2_printf("txsz %d, read %d\r\n", txsz, rsz);
+		case SER_BUF:
+			memcpy(rx->bufptr, data, len);
+			rx->bufptr += len;
+			break;
 		
-		if(rsz>0)
-		{
-			/* write to file (if open) */
-			if(f)
+		case SER_SINK:
+			sink_write(&rx->sink, data, len);
+			break;
+	}
+	
+	rx->left -= len;
+}
+
+/*
+ * payload complete (or given up on) - act on it and reply
+ */
+static void sercmd_finish(sercmd_rx_t *rx)
+{
+	uint32_t Data = 0;
+	
+	if(rx->left)
+	{
+		uart2_printf("timeout waiting for payload - %d left\r\n", rx->left);
+		rx->err |= 2;
+	}
+	
+	switch(rx->mode)
+	{
+		case SER_BUF:
+			//dump_buffer(rx->buffer, rx->txsz);
+			/* lock resources only while the command runs */
+			rx->locked = !rx->left && sink_needs_lock(rx->cmd);
+			if(rx->locked && (ICE_Lock((TickType_t)100) != pdTRUE))
 			{
-				act = fwrite(buffer, 1, rsz, f);
-				if(act != rsz)
-				{
-					uart2_printf("Failed write %d, actual %d\r\n", rsz, act);
-					err |= 4;
-				}
+				/* Someone else had the FPGA for > 1 sec */
+				uart2_printf("Couldn't get FPGA access\r\n");
+				rx->locked = 0;
+				rx->err |= 1;
+				rx->mode = SER_DROP;
 			}
+			else if(!rx->left)
+				sercmd_handle(rx->cmd, rx->buffer, rx->txsz);
+			free(rx->buffer);
+			rx->buffer = NULL;
+			break;
 		
-			txsz -= rsz;
-			tot += rsz;
-		}
-		else
-		{
-			//uart2_printf("Failed read %d, actual %d\r\n", bsz, rsz);
-		}
+		case SER_SINK:
+			rx->err |= sink_close(&rx->sink, &Data, cfg_reply, CFG_WAIT);
+			break;
 	}
 	
-	/* close file */
-	if(f)
-	{
-		fclose(f);
-		uart2_printf("Wrote %d to file %s\r\n", tot, psram_file);
-	}
-	else
-		uart2_printf("flushed %d\r\n", tot);
-
-	/* tried flushing socket here but it hung. Doesn't seem to be needed */
+	/* unlock resources */
+	if(rx->locked)
+		ICE_Unlock();
+	rx->locked = 0;
 	
-	/* return status */
-	uart2_printf("PS_IN replying status %d\r\n", err);
-	fprintf(stdout, "  RX %02X %08X\n", err, 0);
-
-	uart2_printf("PS_IN done\r\n");
+	/* complete short commands reply for themselves */
+	if((rx->mode != SER_BUF) || rx->left)
+		sercmd_reply(rx->err, Data);
 }
 
 /*
@@ -286,9 +455,10 @@ void dump_buffer(uint8_t *buf, uint32_t sz)
  */
 void sercmd_task(void *pvParameters)
 {
-	int newchar;
-	uint8_t cmdstate = 0, cmdval = 0, *buffer = NULL, *bufptr = NULL;
-	uint32_t cmdsz = 0, buffsz = 0;
+	int len, rxidx;
+	uint8_t newchar, cmdstate = 0, cmdval = 0, cmdz = 0;
+	uint32_t cmdsz = 0, sz;
+	sercmd_rx_t rx;
 	
     /* Disable buffering */
     setvbuf(stdin, NULL, _IONBF, 0);
@@ -298,29 +468,58 @@ void sercmd_task(void *pvParameters)
 	esp_vfs_dev_usb_serial_jtag_set_rx_line_endings(ESP_LINE_ENDINGS_LF);
 	esp_vfs_dev_usb_serial_jtag_set_tx_line_endings(ESP_LINE_ENDINGS_LF);
 
-    /* Enable non-blocking mode on stdin and stdout */
-    fcntl(fileno(stdout), F_SETFL, 0);
-    fcntl(fileno(stdin), F_SETFL, 0);
-
+	/* config job results come back here */
+	cfg_reply = xQueueCreate(1, sizeof(cfgtask_result_t));
+	
 	ESP_LOGI(TAG, "Serial Command Handler listening");
 	
 	/* loop forever waiting for serial inputs */
     while(1)
 	{
-		/* character available? */
-		newchar = fgetc(stdin);
-		if(newchar != EOF)
+		/* block until something arrives - don't wait forever mid-payload */
+		len = usb_serial_jtag_read_bytes(rx_buffer, SER_RX_SZ,
+			(cmdstate == 8) ? SER_RX_WAIT : portMAX_DELAY);
+		if(len <= 0)
 		{
+			if(cmdstate == 8)
+			{
+				/* data ceased unexpectedly */
+				sercmd_finish(&rx);
+				cmdstate = 0;
+			}
+			continue;
+		}
+		
+		/* parse the whole block */
+		rxidx = 0;
+		while(rxidx < len)
+		{
+			if(cmdstate == 8)
+			{
+				/* payload - pass on as much as we have */
+				sz = len - rxidx;
+				sz = sz <= rx.left ? sz : rx.left;
+				sercmd_data(&rx, rx_buffer+rxidx, sz);
+				rxidx += sz;
+				
+				if(!rx.left)
+				{
+					sercmd_finish(&rx);
+					cmdstate = 0;
+				}
+				continue;
+			}
+			
+			newchar = rx_buffer[rxidx++];
 			if(cmdstate == 0)
 			{
 				/* look for first byte of header and get command */
-				if((newchar & 0xf0) == (cmdheader[cmdstate] & 0xf0))
+				cmdz = (newchar & 0xf0) == (SINK_Z_MAGIC & 0xf0);
+				if(((newchar & 0xf0) == (cmdheader[cmdstate] & 0xf0)) || cmdz)
 				{
 					cmdval = newchar & 0x0f;
 					cmdstate++;
 				}
-				else
-					cmdstate = 0;
 			}
 			else if(cmdstate<4)
 			{
@@ -333,7 +532,7 @@ void sercmd_task(void *pvParameters)
 				if(cmdstate == 4)
 					uart2_printf("header+cmd %1d\r\n", cmdval);
 			}
-			else if(cmdstate < 8)
+			else
 			{
 				/* gather the size */
 				cmdsz = (cmdsz >> 8) | ((newchar & 0xff) << 24);
@@ -341,108 +540,10 @@ void sercmd_task(void *pvParameters)
 
 				if(cmdstate == 8)
 				{
-					/* Got header so handle payload */
-					buffsz = cmdsz;
-					uart2_printf("buffsz=0x%08X\r\n", buffsz);
-					
-					if(buffsz)
-					{
-						/* lock resources */
-						if(xSemaphoreTake(ice_mutex, (TickType_t)100)==pdTRUE)
-						{							
-							if(cmdval == 0xa)
-							{
-								/* Command 0xA - PSRAM Init is special */
-								sercmd_ps_in(buffsz);
-								buffsz = 0;
-								cmdstate = 0;
-							}
-							else
-							{
-								/* all other commands - alloc buffer for payload */
-								buffer = malloc(buffsz);
-								
-								if(buffer)
-								{
-									/* if malloc succeeded then fill the buffer */
-									bufptr = buffer;
-									
-									/* buffer at a time - USB does 64 bytes max */
-									int bytes, timeout = 0;
-									while(cmdsz)
-									{
-										bytes = read(STDIN_FILENO, bufptr, cmdsz);
-										if(bytes>0)
-										{
-											bufptr += bytes;
-											cmdsz -= bytes;
-											timeout = 0;	// reset timeout
-										}
-										
-										/* don't hang if data ceases unexpectedly */
-										if(timeout++ > 1000)
-										{
-											uart2_printf("timeout waiting for payload\r\n");
-											cmdval = 16;	// force illegal command
-											break;
-										}
-										
-										/*
-										 * was thinking of putting a vTaskDelay() here
-										 * but it would likely slow things down too
-										 * much.
-										 */
-									}
-									
-									//dump_buffer(buffer, buffsz);
-									
-									/* handle command */
-									sercmd_handle(cmdval, buffer, buffsz);
-									
-									/* clean up */
-									free(buffer);
-									buffsz = 0;
-									cmdstate = 0;
-								}
-								else
-								{
-									/* malloc failed - flush stdin */
-									uart2_printf("malloc failed - flushing\r\n");
-									int bytes, timeout = 0;
-									uint8_t dummy_buf[64];
-									while(cmdsz)
-									{
-										int fsz = cmdsz > 64 ? 64 : cmdsz;
-										bytes = read(STDIN_FILENO, dummy_buf, fsz);
-										if(bytes>0)
-										{
-											cmdsz -= bytes;
-											timeout = 0;	// reset timeout
-										}
-										
-										/* don't hang if data ceases unexpectedly */
-										if(timeout++ > 1000)
-										{
-											uart2_printf("timeout waiting for payload\r\n");
-											break;
-										}
-									}
-									
-									/* send error reply */
-									fprintf(stdout, "  RX %02X %08X\n", 7, 0);
-								}
-							}
-							
-							/* unlock resources */
-							xSemaphoreGive(ice_mutex);
-						}
-						else
-						{
-							/* Someone else had the FPGA for > 1 sec */
-							uart2_printf("Couldn't get FPGA access\r\n");
-							cmdstate = 0;
-						}
-					}
+					/* Got header so set up for payload */
+					uart2_printf("buffsz=0x%08X\r\n", cmdsz);
+					if(cmdsz)
+						sercmd_start(&rx, cmdval, cmdsz, cmdz);
 					else
 					{
 						/* no buffer is illegal so just bail out */
@@ -451,12 +552,7 @@ void sercmd_task(void *pvParameters)
 					}
 				}
 			}
-			else
-				cmdstate = 0;	/* illegal state so reset */
 		}
-		
-		/* yield to OS */
-		vTaskDelay(1);
 	}
 	
 	/* clean up - shouldn't get here */
@@ -481,6 +577,18 @@ esp_err_t sercmd_init(void)
 	uart2_printf("sercmd_init: start debug\r\n");
 #endif
 	
+	/* use the driver so reads block on its ring buffer and come in blocks */
+	usb_serial_jtag_driver_config_t usb_cfg = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
+	usb_cfg.rx_buffer_size = SER_RING_SZ;
+	usb_cfg.tx_buffer_size = 1024;
+	if(usb_serial_jtag_driver_install(&usb_cfg) != ESP_OK)
+		return ESP_FAIL;
+	esp_vfs_usb_serial_jtag_use_driver();
+	
+	if(!(rx_buffer = malloc(SER_RX_SZ)) ||
+		!(tx_buffer = malloc(FRAME_ENC_SZ(FRAME_MAX))))
+		return ESP_FAIL;
+	
 	/* start a separate task to monitor serial */
 	if(xTaskCreate(sercmd_task, "sercmd", 4096, NULL, 5, NULL) != pdPASS)
 		return ESP_FAIL;
@@ -0,0 +1,494 @@
+/*
+ * sink.c - streaming payload sinks for long commands
+ * 10-17-26
+ *
+ * Config (0xF), save config (0xE), PSRAM write (0xC) and PSRAM Init (0xA)
+ * payloads are fed here piece by piece as they arrive instead of being
+ * collected in one buffer first, so they aren't limited by free heap and
+ * the FPGA or flash is busy while the next piece is still on its way.
+ *
+ * Plain bitstreams go straight into the FPGA at the fastest config clock
+ * with a copy kept for the bitstream cache when there's room. If that
+ * pass fails the cached copy is retried by the config worker, which
+ * steps the clock down until it works. With no room for a copy there's
+ * nothing to retry, so the bitstream goes in at the original 10MHz clock
+ * that every board manages instead. The FPGA stays locked until the
+ * last byte is in, so a bitstream that stops short is abandoned and
+ * reported as a failed config. Compressed containers are small and are
+ * collected and handed to the worker as before.
+ *
+ * A payload sent with the compressed header magic is a cfgz container of
+ * what the command would normally carry. It's unpacked a ring at a time
+ * on the way in and the pieces are fed on as if they'd arrived raw.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sink.h"
+#include "ice.h"
+#include "spiffs.h"
+#include "cfgtask.h"
+#include "bitcache.h"
+#include "cfgz.h"
+#include "rom/crc.h"
+#include "esp_heap_caps.h"
+
+/* what's being done with the payload */
+enum
+{
+	SINK_HDR,			// gathering leading bytes
+	SINK_DROP,			// error - discard the rest
+	SINK_CFG_STREAM,	// plain bitstream into the FPGA
+	SINK_CFG_BUF,		// collecting a container for the worker
+	SINK_SAVE,			// SPIFFS file & flash slot
+	SINK_PSRAM,			// PSRAM at an advancing address
+	SINK_PS_IN,			// PSRAM Init file
+};
+
+#define SINK_SAVE_TMP		"/spiffs/bitstream.tmp"
+
+static const char* TAG = "sink";
+
+/*
+ * payloads of these commands are streamed
+ */
+uint8_t sink_wants(uint8_t cmd, uint32_t txsz)
+{
+	return ((cmd == 0xf) && (txsz != 4)) || (cmd == 0xe) || (cmd == 0xc) || (cmd == 0xa);
+}
+
+/*
+ * short commands the caller locks the FPGA for once their payload is in -
+ * register read & write. Config jobs lock in the worker or sink, PSRAM
+ * transfers lock a piece at a time, extended commands lock for themselves
+ * and the rest don't touch the FPGA.
+ */
+uint8_t sink_needs_lock(uint8_t cmd)
+{
+	return (cmd == 0) || (cmd == 1);
+}
+
+static void sink_put(sink_t *sink, uint8_t *data, uint32_t len);
+
+/*
+ * the FPGA is locked until sink_close() - a plain bitstream going in
+ */
+uint8_t sink_holds_fpga(sink_t *sink)
+{
+	return sink->mode == SINK_CFG_STREAM;
+}
+
+/*
+ * get ready for the payload once its size is known
+ */
+static void sink_start(sink_t *sink)
+{
+	uint8_t cmd = sink->cmd;
+	uint32_t txsz = sink->txsz;
+	
+	sink->mode = SINK_HDR;
+	if(cmd == 0xe)
+	{
+		size_t tot, use;
+		struct stat st;
+		
+		/* only allow 75% utilization per docs */
+		if(stat(SINK_SAVE_TMP, &st) == 0)
+			unlink(SINK_SAVE_TMP);
+		spiffs_info(&tot, &use);
+		if((((4*tot)/3) - use) <= txsz)
+		{
+			ESP_LOGE(TAG, "Not enough space in SPIFFS for %u", txsz);
+			sink->err |= 8;
+			sink->mode = SINK_DROP;
+			return;
+		}
+		
+		/* old file stays until the new one is complete */
+		if(!(sink->f = fopen(SINK_SAVE_TMP, "wb")))
+		{
+			ESP_LOGE(TAG, "Failed to open %s for writing", SINK_SAVE_TMP);
+			sink->err |= 8;
+			sink->mode = SINK_DROP;
+			return;
+		}
+		
+		/* the boot slot too - SPIFFS covers for it if this fails */
+		if(bitslot_open(BITSLOT_CFG, txsz, &sink->wr))
+			sink->wr.part = NULL;
+		sink->mode = SINK_SAVE;
+	}
+	else if(cmd == 0xa)
+	{
+		size_t tot, use;
+		struct stat st;
+		
+		/* old contents are replaced whatever happens */
+		if(stat(psram_file, &st) == 0)
+			unlink(psram_file);
+		spiffs_info(&tot, &use);
+		if((((4*tot)/3) - use) <= txsz)
+		{
+			ESP_LOGE(TAG, "Not enough space in SPIFFS for %u", txsz);
+			sink->err |= 1;
+			sink->mode = SINK_DROP;
+		}
+		else if(!(sink->f = fopen(psram_file, "wb")))
+		{
+			ESP_LOGE(TAG, "Failed to open %s for writing", psram_file);
+			sink->err |= 1;
+			sink->mode = SINK_DROP;
+		}
+		else
+			sink->mode = SINK_PS_IN;
+	}
+}
+
+/*
+ * start a payload. Errors are kept until sink_close().
+ */
+void sink_open(sink_t *sink, uint8_t cmd, uint32_t txsz)
+{
+	memset(sink, 0, sizeof(sink_t));
+	sink->cmd = cmd;
+	sink->txsz = txsz;
+	sink_start(sink);
+}
+
+/*
+ * start a compressed payload of zsz bytes. The sink proper starts once
+ * the container header says how much there is.
+ */
+void sink_open_z(sink_t *sink, uint8_t cmd, uint32_t zsz)
+{
+	memset(sink, 0, sizeof(sink_t));
+	sink->cmd = cmd;
+	sink->txsz = zsz;
+	sink->mode = SINK_HDR;
+	
+	if(!(sink->z = cfgz_stream_new()))
+	{
+		ESP_LOGW(TAG, "Couldn't alloc decompressor");
+		sink->err |= 1;
+		sink->mode = SINK_DROP;
+	}
+}
+
+/*
+ * unpacked data goes on as if it had arrived that way
+ */
+static void sink_unz_out(void *ctx, uint8_t *data, uint32_t len)
+{
+	sink_put((sink_t *)ctx, data, len);
+}
+
+/*
+ * next piece of a compressed payload
+ */
+static void sink_unz(sink_t *sink, uint8_t *data, uint32_t len)
+{
+	uint32_t sz;
+	
+	if(sink->z->hdrsz < sizeof(cfgz_hdr_t))
+	{
+		sz = cfgz_stream_hdr(sink->z, data, len);
+		data += sz;
+		len -= sz;
+		if(sink->z->hdrsz < sizeof(cfgz_hdr_t))
+			return;
+		
+		/* header in - the real size & the sink can start */
+		if(!cfgz_check((uint8_t *)&sink->z->hdr, sink->txsz))
+		{
+			ESP_LOGW(TAG, "Bad compressed payload header");
+			sink->err |= 8;
+			sink->mode = SINK_DROP;
+			sink->z->err = 1;
+			return;
+		}
+		ESP_LOGI(TAG, "Unpacking %u -> %u bytes", sink->txsz, sink->z->hdr.len);
+		sink->txsz = sink->z->hdr.len;
+		sink_start(sink);
+	}
+	
+	cfgz_stream_write(sink->z, data, len, sink_unz_out, sink);
+}
+
+/*
+ * decide how to handle a config once its leading bytes are in
+ */
+static void sink_cfg_start(sink_t *sink)
+{
+	if((sink->collect || ((sink->hdrsz == SINK_HDR_SZ) && cfgz_check(sink->hdr, sink->txsz))) &&
+		(sink->copy = malloc(sink->txsz)))
+	{
+		/* container or collected upload - for the worker */
+		sink->mode = SINK_CFG_BUF;
+	}
+	else if(sink->collect)
+	{
+		ESP_LOGW(TAG, "Couldn't alloc %u for config", sink->txsz);
+		sink->err |= 1;
+		sink->mode = SINK_DROP;
+		return;
+	}
+	else
+	{
+		/* keep a copy for the cache if it won't crowd the heap */
+		if((sink->txsz <= BITCACHE_MAX_BYTES) &&
+			(heap_caps_get_free_size(MALLOC_CAP_DMA) > sink->txsz + BITCACHE_HEAP_MIN))
+			sink->copy = heap_caps_malloc(sink->txsz, MALLOC_CAP_DMA);
+		
+		if(ICE_Lock((TickType_t)100) != pdTRUE)
+		{
+			ESP_LOGW(TAG, "Couldn't get FPGA access");
+			free(sink->copy);
+			sink->err |= 1;
+			sink->mode = SINK_DROP;
+			return;
+		}
+		
+		/* one pass only without a copy - make it one that works */
+		if(ICE_FPGA_Config_Begin(!sink->copy))
+		{
+			ICE_Unlock();
+			free(sink->copy);
+			sink->err |= 8;
+			sink->mode = SINK_DROP;
+			return;
+		}
+		if(!sink->copy)
+			ESP_LOGI(TAG, "No room to keep %u - config at the safe clock", sink->txsz);
+		sink->mode = SINK_CFG_STREAM;
+	}
+	
+	/* catch up with the leading bytes */
+	sink->got = 0;
+	sink_put(sink, sink->hdr, sink->hdrsz);
+}
+
+/*
+ * feed the next piece of payload
+ */
+void sink_write(sink_t *sink, uint8_t *data, uint32_t len)
+{
+	if(sink->z)
+		sink_unz(sink, data, len);
+	else
+		sink_put(sink, data, len);
+}
+
+/*
+ * next piece of the payload proper
+ */
+static void sink_put(sink_t *sink, uint8_t *data, uint32_t len)
+{
+	uint32_t sz;
+	
+	/* leading bytes - config type check or PSRAM address */
+	if(sink->mode == SINK_HDR)
+	{
+		uint32_t need = (sink->cmd == 0xc) ? 4 : SINK_HDR_SZ;
+		if(need > sink->txsz)
+			need = sink->txsz;
+		
+		sz = need - sink->hdrsz;
+		sz = sz <= len ? sz : len;
+		memcpy(sink->hdr + sink->hdrsz, data, sz);
+		sink->hdrsz += sz;
+		sink->got += sz;
+		data += sz;
+		len -= sz;
+		if(sink->hdrsz < need)
+			return;
+		
+		if(sink->cmd == 0xc)
+		{
+			memcpy(&sink->Addr, sink->hdr, 4);
+			ESP_LOGI(TAG, "PSRAM write: Addr 0x%08X, Len 0x%08X", sink->Addr, sink->txsz-4);
+			sink->mode = SINK_PSRAM;
+		}
+		else
+			sink_cfg_start(sink);
+	}
+	
+	if(!len)
+		return;
+	
+	switch(sink->mode)
+	{
+		case SINK_CFG_STREAM:
+			ICE_FPGA_Config_Write(data, len);
+			sink->crc = crc32_le(sink->crc, data, len);
+			if(sink->copy)
+				memcpy(sink->copy + sink->got, data, len);
+			break;
+		
+		case SINK_CFG_BUF:
+			memcpy(sink->copy + sink->got, data, len);
+			break;
+		
+		case SINK_SAVE:
+			if(fwrite(data, 1, len, sink->f) != len)
+			{
+				ESP_LOGE(TAG, "Failed writing %s", SINK_SAVE_TMP);
+				sink->err |= 8;
+			}
+			if(sink->wr.part && bitslot_append(&sink->wr, data, len))
+				sink->wr.part = NULL;
+			break;
+		
+		case SINK_PSRAM:
+			/* a piece at a time so others get a turn at the FPGA */
+			if(ICE_Lock((TickType_t)100) != pdTRUE)
+			{
+				ESP_LOGW(TAG, "Couldn't get FPGA access");
+				sink->err |= 1;
+				sink->mode = SINK_DROP;
+				break;
+			}
+			ICE_PSRAM_Write(sink->Addr, data, len);
+			ICE_Unlock();
+			taskYIELD();
+			sink->Addr += len;
+			break;
+		
+		case SINK_PS_IN:
+			if(fwrite(data, 1, len, sink->f) != len)
+			{
+				ESP_LOGE(TAG, "Failed writing %s", psram_file);
+				sink->err |= 4;
+			}
+			break;
+	}
+	sink->got += len;
+}
+
+/*
+ * wait for a config job
+ */
+static uint8_t sink_wait_cfg(uint32_t id, QueueHandle_t reply, TickType_t wait, uint32_t *Data)
+{
+	cfgtask_result_t result;
+	
+	if(!id || (cfgtask_result(reply, id, &result, wait) != ESP_OK))
+		return 1;
+	if(result.status)
+		return 8;
+	
+	*Data = result.us;
+	return 0;
+}
+
+/*
+ * finish a payload. Returns the error bits, Data gets the config time.
+ * A short or damaged payload is dropped.
+ */
+uint8_t sink_close(sink_t *sink, uint32_t *Data, QueueHandle_t reply, TickType_t wait)
+{
+	uint8_t short_rx, bad_z = 0;
+	bitcache_ent_t *ent = NULL;
+	uint8_t status;
+	
+	/* the rest of a compressed payload - damage counts as short */
+	if(sink->z)
+	{
+		bad_z = cfgz_stream_end(sink->z, sink_unz_out, sink);
+		cfgz_stream_free(sink->z);
+		sink->z = NULL;
+	}
+	short_rx = (sink->got != sink->txsz) || bad_z || sink->bad;
+	
+	if(short_rx)
+	{
+		ESP_LOGW(TAG, "Payload short or bad - %u of %u", sink->got, sink->txsz);
+		sink->err |= 2;
+	}
+	
+	switch(sink->mode)
+	{
+		case SINK_HDR:
+			/* never got going - too short to tell */
+			if(sink->cmd == 0xf)
+				sink->err |= 8;
+			break;
+		
+		case SINK_CFG_STREAM:
+			if(short_rx)
+			{
+				/* rest never came - a failed config but not the clock's fault */
+				ICE_FPGA_Config_Abort();
+				ICE_Unlock();
+				free(sink->copy);
+				sink->err |= 8;
+				break;
+			}
+			status = ICE_FPGA_Config_End();
+			ICE_Unlock();
+			if(sink->copy && !(ent = bitcache_add(sink->crc, sink->copy, sink->txsz, 0)))
+				free(sink->copy);
+			
+			if(!status)
+			{
+				*Data = ICE_FPGA_Config_Time(NULL);
+				ESP_LOGI(TAG, "Streamed config OK - %u us, CRC32 = 0x%08X", *Data, sink->crc);
+				if(ent)
+					bitcache_put(ent);
+			}
+			else if(ent)
+			{
+				/* worker retries the cached copy, stepping the clock down */
+				ESP_LOGW(TAG, "Streamed config ERROR - status = %d, retrying", status);
+				sink->err |= sink_wait_cfg(cfgtask_submit_cached(ent, 0, reply), reply, wait, Data);
+			}
+			else
+			{
+				ESP_LOGW(TAG, "Streamed config ERROR - status = %d", status);
+				sink->err |= 8;
+			}
+			break;
+		
+		case SINK_CFG_BUF:
+			if(short_rx)
+				free(sink->copy);
+			else
+				sink->err |= sink_wait_cfg(upload_fpga(sink->copy, sink->txsz, 0, reply),
+					reply, wait, Data);
+			break;
+		
+		case SINK_SAVE:
+			fclose(sink->f);
+			if(short_rx || (sink->err & 8))
+			{
+				unlink(SINK_SAVE_TMP);
+				break;
+			}
+			
+			unlink(cfg_file);
+			if(rename(SINK_SAVE_TMP, cfg_file))
+			{
+				/* slot is left without a header so boot fills it from SPIFFS */
+				ESP_LOGE(TAG, "Failed renaming %s", SINK_SAVE_TMP);
+				sink->err |= 8;
+				break;
+			}
+			ESP_LOGI(TAG, "Saved %u to %s", sink->got, cfg_file);
+			if(sink->wr.part && !bitslot_close(&sink->wr, cfg_file))
+				ESP_LOGI(TAG, "Saved %u to slot", sink->got);
+			break;
+		
+		case SINK_PS_IN:
+			fclose(sink->f);
+			if(short_rx)
+			{
+				/* not loaded into PSRAM at the next boot */
+				unlink(psram_file);
+				break;
+			}
+			ESP_LOGI(TAG, "Wrote %u to %s", sink->got, psram_file);
+			break;
+	}
+	
+	return sink->err;
+}
@@ -0,0 +1,43 @@
+/*
+ * sink.h - streaming payload sinks for long commands
+ * 10-17-26
+ */
+
+#ifndef __SINK__
+#define __SINK__
+
+#include "main.h"
+#include "bitslot.h"
+#include "cfgz.h"
+
+#define SINK_HDR_SZ			16		// leading bytes looked at before streaming
+#define SINK_Z_MAGIC		0xCAFEBED0	// header | cmd for a compressed payload
+
+/* state of one streamed payload */
+typedef struct
+{
+	uint8_t cmd;
+	uint8_t err;
+	uint32_t txsz, got;
+	uint8_t hdr[SINK_HDR_SZ];	// leading bytes
+	uint32_t hdrsz;
+	uint8_t mode;
+	uint8_t collect;			// configs go to the worker, never streamed
+	uint8_t bad;				// failed a check by the caller - dropped like a short one
+	uint32_t Addr;				// PSRAM write address
+	FILE *f;					// SPIFFS save
+	bitslot_wr_t wr;
+	uint8_t *copy;				// config buffer / cache copy
+	uint32_t crc;
+	cfgz_stream_t *z;			// compressed payload being unpacked
+} sink_t;
+
+uint8_t sink_needs_lock(uint8_t cmd);
+uint8_t sink_holds_fpga(sink_t *sink);
+uint8_t sink_wants(uint8_t cmd, uint32_t txsz);
+void sink_open(sink_t *sink, uint8_t cmd, uint32_t txsz);
+void sink_open_z(sink_t *sink, uint8_t cmd, uint32_t zsz);
+void sink_write(sink_t *sink, uint8_t *data, uint32_t len);
+uint8_t sink_close(sink_t *sink, uint32_t *Data, QueueHandle_t reply, TickType_t wait);
+
+#endif
@@ -20,6 +20,13 @@
 #include "spiffs.h"
 #include "phy.h"
 #include "adc_c3.h"
+#include "extcmd.h"
+#include "cfgtask.h"
+#include "bitslot.h"
+#include "bitcache.h"
+#include "sink.h"
+#include "psread.h"
+#include "esp_heap_caps.h"
 
 static const char *TAG = "socket";
 
@@ -27,92 +34,183 @@ static const char *TAG = "socket";
 #define KEEPALIVE_IDLE              5
 #define KEEPALIVE_INTERVAL          5
 #define KEEPALIVE_COUNT             3
+#define CFG_WAIT                    (5000/portTICK_PERIOD_MS)
+#define SOCK_RX_SZ                  4096
+#define SOCK_PS_RD_SZ               CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define SOCK_SESS_MAGIC             0xCAFE5E50	// session command header | cmd
+#define SOCK_SESS_REPLY             0xCAFE5E60	// session reply header | cmd
+#define SOCK_SESS_HDR_SZ            12			// magic, size, id
+#define SOCK_HANDLERS               3			// clients served at once
+#define SOCK_HANDLER_STACK          4096
+#define SOCK_CFG_RX_WAIT            2			// secs a streamed config waits for data
+
+/* one handler task and the connection it's serving */
+typedef struct
+{
+	int sock;
+	uint8_t session;			// replies get a header with the request id
+	uint8_t rx_wait;			// receive timeout is set
+	uint32_t id;
+	char *rx_buffer;			// sinks DMA straight out of it
+	QueueHandle_t cfg_reply;	// config job results for this handler
+} sock_conn_t;
+
+/* accepted connections waiting for a handler */
+static QueueHandle_t sock_accepted;
+
+/* command being received */
+typedef struct
+{
+	char cmd, err;
+	uint32_t txsz, got;
+	uint8_t streaming;
+	char *buffer;
+	sink_t sink;
+} sock_cmd_t;
 
 /*
- * handle a message
+ * send a whole buffer, returns 1 if the socket failed
  */
-static void handle_message(const int sock, char *err, char cmd, char *buffer, int txsz)
+static uint8_t send_all(const int sock, void *buffer, int to_write)
 {
-	uint32_t Data = 0;
-	char sbuf[5];
+	uint8_t *wptr = buffer;
 	
-	if(cmd == 0xf)
+	while(to_write > 0)
 	{
-		/* send configuration to FPGA */
-		uint8_t cfg_stat;	
-		if((cfg_stat = ICE_FPGA_Config((uint8_t *)buffer, txsz)))
+		int written = send(sock, wptr, to_write, 0);
+		if(written < 0)
 		{
-			ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", cfg_stat);
-			*err |= 8;
+			ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+			return 1;
 		}
-		else
-			ESP_LOGI(TAG, "FPGA configured OK - status = %d", cfg_stat);
+		to_write -= written;
+		wptr += written;
 	}
-	else if(cmd == 0xe)
+	return 0;
+}
+
+/*
+ * receive the next piece of c's payload, or a header if c is NULL. A
+ * streamed config holds the FPGA so it doesn't get to wait forever.
+ */
+static int sock_recv(sock_conn_t *conn, sock_cmd_t *c)
+{
+	uint8_t wait = c && c->streaming && sink_holds_fpga(&c->sink);
+	struct timeval tv = { .tv_sec = wait ? SOCK_CFG_RX_WAIT : 0 };
+	
+	if(wait != conn->rx_wait)
 	{
-		/* save configuration to the SPIFFS filesystem */
-		uint8_t cfg_stat;	
-		if((cfg_stat = spiffs_write((char *)cfg_file, (uint8_t *)buffer, txsz)))
-		{
-			ESP_LOGW(TAG, "Config write SPIFFS Error - status = %d", cfg_stat);
-			*err |= 8;
-		}
-		else
-			ESP_LOGI(TAG, "Config write SPIFFS wrote OK - status = %d", cfg_stat);
+		setsockopt(conn->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		conn->rx_wait = wait;
+	}
+	return recv(conn->sock, conn->rx_buffer, SOCK_RX_SZ, 0);
+}
+
+/*
+ * PSRAM read output - send each chunk as it's read
+ */
+static uint8_t ps_send(void *ctx, uint8_t *data, uint32_t len)
+{
+	return send_all(((sock_conn_t *)ctx)->sock, data, len);
+}
+
+/*
+ * session reply header: magic | cmd, id, error, data, length of the
+ * payload that follows
+ */
+static uint8_t send_head(sock_conn_t *to, char err, char cmd, uint32_t Data, uint32_t len)
+{
+	uint32_t head[5] = {SOCK_SESS_REPLY | cmd, to->id, (uint8_t)err, Data, len};
+	
+	return send_all(to->sock, head, sizeof(head));
+}
+
+/*
+ * wait for a config job, Data gets the config time in us
+ */
+static void wait_cfg(sock_conn_t *to, char *err, uint32_t id, uint32_t *Data)
+{
+	cfgtask_result_t result;
+	
+	if(!id)
+		*err |= 1;
+	else if(cfgtask_result(to->cfg_reply, id, &result, CFG_WAIT) != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Config job %u timed out", id);
+		*err |= 1;
 	}
-	else if(cmd == 0xc)
+	else if(result.status)
 	{
-		/* write block of data to PSRAM via SPI pass-thru */
-		uint32_t Addr = *((uint32_t *)buffer);
-		ESP_LOGI(TAG, "PSRAM write: Addr 0x%08X, Len 0x%08X", Addr, txsz-4);
-		ICE_PSRAM_Write(Addr, (uint8_t *)buffer+4, txsz-4);
+		ESP_LOGW(TAG, "FPGA configured ERROR - status = %d", result.status);
+		*err |= 8;
+	}
+	else
+	{
+		ESP_LOGI(TAG, "FPGA configured OK - %u us @ %d Hz", result.us, result.hz);
+		*Data = result.us;
+	}
+}
+
+/*
+ * reply to the simpler commands - error status and maybe 32-bit data
+ */
+static void send_status(sock_conn_t *to, char err, char cmd, uint32_t Data)
+{
+	uint8_t has_data = (cmd == 0) || (cmd == 2) || (cmd == 0xf) || (cmd == 6);
+	char sbuf[5];
+	
+	if(to->session)
+		send_head(to, err, cmd, Data, 0);
+	else
+	{
+		sbuf[0] = err;
+		if(has_data)
+			memcpy(&sbuf[1], &Data, 4);
+		send_all(to->sock, sbuf, has_data ? 5 : 1);
+	}
+	
+	/* reply with error status */
+	ESP_LOGI(TAG, "Reply status = %d", err);
+}
+
+/*
+ * handle a message with a short payload - long ones go to a sink
+ */
+static void handle_message(sock_conn_t *to, char *err, char cmd, char *buffer, int txsz)
+{
+	uint32_t Data = 0;
+	char sbuf[5];
+	
+	if(cmd == 0xf)
+	{
+		/* just a CRC - configure from the cache if it's there */
+		uint32_t id = cached_fpga(*(uint32_t *)buffer, to->cfg_reply);
+		if(id)
+			wait_cfg(to, err, id, &Data);
+		else
+			*err |= BITCACHE_MISS_ERR;
 	}
 	else if(cmd == 0xb)
 	{
 		/* read block of data from PSRAM via SPI pass-thru */
 		uint32_t Addr = *((uint32_t *)buffer);
 		uint32_t psram_rdsz = *((uint32_t *)(buffer+4));
-#define MAX_PSRAM_RD 128		
-		uint8_t psram_rdbuf[MAX_PSRAM_RD];
+		uint8_t sent;
 		
 		ESP_LOGI(TAG, "PSRAM read: Addr 0x%08X, Len 0x%08X", Addr, psram_rdsz);
 		
-		/* Send error status */
-		int written;
-		while((written = send(sock, err, 1, 0)) < 1)
-		{
-			if(written < 0)
-			{
-				ESP_LOGE(TAG, "Error sending stat: errno %d", errno);
-			}
-		}
-		
-		/* Send data MAX_PSRAM_RD bytes at a time */
-		while(psram_rdsz)
+		/* Send error status, then the data a send window at a time */
+		if(to->session)
+			sent = !send_head(to, *err, cmd, psram_rdsz, psram_rdsz);
+		else
+			sent = !send_all(to->sock, err, 1);
+		if(sent && psread_stream(Addr, psram_rdsz, SOCK_PS_RD_SZ, ps_send, to) &&
+			to->session)
 		{
-			uint32_t rdsz = psram_rdsz > MAX_PSRAM_RD ? MAX_PSRAM_RD : psram_rdsz;
-			ICE_PSRAM_Read(Addr, (uint8_t *)psram_rdbuf, rdsz);
-			int to_write = rdsz;
-			uint8_t *wptr = psram_rdbuf;
-			while(to_write > 0)
-			{
-				written = send(sock, wptr, to_write, 0);
-				if(written < 0)
-				{
-					ESP_LOGE(TAG, "Error sending data: errno %d", errno);
-				}
-				to_write -= written;
-				wptr += written;
-			}
-			psram_rdsz -= rdsz;
-			Addr += rdsz;
+			/* can't finish the reply so the session is lost */
+			shutdown(to->sock, SHUT_RDWR);
 		}
 	}
-	else if(cmd == 0xa)
-	{
-		ESP_LOGW(TAG, "PSRAM Init handler in handle_message() - shouldn't get here");
-		*err |= 15;
-	}
 	else if(cmd == 0)
 	{
         /* Read SPI register */
@@ -141,13 +239,33 @@ static void handle_message(const int sock, char *err, char cmd, char *buffer, in
 		infostr[0] = *err;		
 		sprintf(infostr+1, "%s %s", fwVersionStr, wifi_ip_addr);
 		ESP_LOGI(TAG, "Info = %s", infostr+1);
-		int to_write = strlen(infostr+1)+1;
-		while (to_write > 0) {
-			int written = send(sock, infostr, to_write, 0);
-			if (written < 0) {
-				ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-			}
-			to_write -= written;
+		if(to->session)
+		{
+			if(!send_head(to, *err, cmd, 0, strlen(infostr+1)))
+				send_all(to->sock, infostr+1, strlen(infostr+1));
+		}
+		else
+			send_all(to->sock, infostr, strlen(infostr+1)+1);
+	}
+	else if(cmd == EXTCMD_CMD)
+	{
+		/* extended command - reply is error, length & data */
+		uint8_t *reply;
+		uint32_t replysz;
+		
+		*err |= extcmd_handle((uint8_t *)buffer, txsz, &reply, &replysz);
+		if(to->session)
+			send_head(to, *err, cmd, replysz, reply ? replysz : 0);
+		else
+		{
+			memcpy(&sbuf[1], &replysz, 4);
+			sbuf[0] = *err;
+			send_all(to->sock, sbuf, 5);
+		}
+		if(reply)
+		{
+			send_all(to->sock, reply, replysz);
+			free(reply);
 		}
 	}
 	else if(cmd == 6)
@@ -156,7 +274,7 @@ static void handle_message(const int sock, char *err, char cmd, char *buffer, in
 		uint8_t Reg = *(uint32_t *)buffer & 0x1;
 		ESP_LOGI(TAG, "Reg read %d = 0x%08X", *(uint32_t *)buffer, Data);
 		const char *file = (Reg==0) ? cfg_file : spipass_file;
-		load_fpga(file);
+		wait_cfg(to, err, load_fpga(file, to->cfg_reply), &Data);
 	}
 	else
 	{
@@ -164,164 +282,196 @@ static void handle_message(const int sock, char *err, char cmd, char *buffer, in
 		*err |= 8;
 	}
 	
-	if((cmd == 0x0b) || (cmd == 5))
+	if((cmd == 0x0b) || (cmd == 5) || (cmd == EXTCMD_CMD))
 	{
 		/* do nothing */
 	}
 	else
+		send_status(to, *err, cmd, Data);
+}
+
+/*
+ * set up for a command's payload once its header is in, z if it's
+ * compressed
+ */
+static void cmd_start(sock_cmd_t *c, char cmd, uint32_t txsz, uint8_t z)
+{
+	c->cmd = cmd;
+	c->txsz = txsz;
+	c->got = 0;
+	c->err = 0;
+	c->streaming = 0;
+	c->buffer = NULL;
+	
+	if(z && !sink_wants(cmd, txsz))
 	{
-		/* other commands are simpler */
-		// send() can return less bytes than supplied length.
-		// Walk-around for robust implementation.
-		int to_write = ((cmd == 0) || (cmd==2)) ? 5 : 1;
-		sbuf[0] = *err;
-		if((cmd==0) || (cmd==2))
-			memcpy(&sbuf[1], &Data, 4);
-		while (to_write > 0) {
-			int written = send(sock, sbuf, to_write, 0);
-			if (written < 0) {
-				ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-			}
-			to_write -= written;
-		}
+		ESP_LOGW(TAG, "Can't unpack cmd %1X", cmd);
+		c->err |= 8;
+	}
+	else if((c->streaming = sink_wants(cmd, txsz)))
+	{
+		/* long payload - stream it, unpacking on the way if need be */
+		if(z)
+			sink_open_z(&c->sink, cmd, txsz);
+		else
+			sink_open(&c->sink, cmd, txsz);
+	}
+	else if(!txsz || !(c->buffer = malloc(txsz)))
+	{
+		ESP_LOGW(TAG, "Couldn't alloc buffer");
+		c->err |= 1;
 	}
-	
-	/* reply with error status */
-	ESP_LOGI(TAG, "Reply status = %d", *err);
 }
 
 /*
- * special case for handling PSRAM Init message
+ * pass on a piece of payload, returns how much was used
  */
-static void handle_ps_in(const int sock, char *err, char *left, int leftsz, int txsz)
+static uint32_t cmd_data(sock_cmd_t *c, char *data, uint32_t len)
 {
-	char *buffer;
-	size_t act, rsz, tot, use, bufsz;
-	FILE* f = NULL;
+	uint32_t sz = c->txsz - c->got;
 	
-    /* Check if psram file exists before removing */
-    struct stat st;
-    if(stat(psram_file, &st) == 0)
+	sz = sz <= len ? sz : len;
+	if(c->streaming)
+		sink_write(&c->sink, (uint8_t *)data, sz);
+	else if(c->buffer)
+		memcpy(c->buffer + c->got, data, sz);
+	c->got += sz;
+	return sz;
+}
+
+/*
+ * payload is all in - act on it and reply
+ */
+static void cmd_finish(sock_cmd_t *c, sock_conn_t *to)
+{
+	if(c->streaming)
 	{
-        /* Delete it if it exists */
-        unlink(psram_file);
+		uint32_t Data = 0;
 		
-#if 0
-		/* do SPIFFS garbage collection (not available in V4.4.2) */
-		if(esp_spiffs_gc(conf.partition_label, len) != ESP_OK)
-		{
-			ESP_LOGE(TAG, "SPIFFS GC failed");			
-			return ESP_FAIL;
-		}
-#endif
+		ESP_LOGI(TAG, "Done - Streamed %d, cmd %1X", c->txsz, c->cmd);
+		c->err |= sink_close(&c->sink, &Data, to->cfg_reply, CFG_WAIT);
+		c->streaming = 0;
+		send_status(to, c->err, c->cmd, Data);
 	}
-
-	/* note SPIFFS avail space - only allow 75% utilization per docs */
-	spiffs_info(&tot, &use);
-	tot = ((4*tot)/3) - use;
-	ESP_LOGI(TAG, "PS_IN: SPIFFS available: %d", tot);
-	
-	/* open file if enough space in SPIFFS */
-	if(tot > txsz)
+	else if(c->buffer)
 	{
-		f = fopen(psram_file, "wb");
-		if (f != NULL)
+		ESP_LOGI(TAG, "Done - Received %d, cmd %1X", c->txsz, c->cmd);
+		
+		/* lock resources only while the command runs */
+		if(sink_needs_lock(c->cmd) && (ICE_Lock((TickType_t)100) != pdTRUE))
 		{
-			ESP_LOGI(TAG, "PS_IN: Writing %d to file %s ", txsz, psram_file);
+			ESP_LOGW(TAG, "Couldn't get FPGA access");
+			c->err |= 1;
+			send_status(to, c->err, c->cmd, 0);
 		}
 		else
 		{
-			ESP_LOGE(TAG, "Failed to open file for writing");
-			*err = 1;
+			handle_message(to, &c->err, c->cmd, c->buffer, c->txsz);
+			if(sink_needs_lock(c->cmd))
+				ICE_Unlock();
 		}
+		free(c->buffer);
+		c->buffer = NULL;
 	}
 	else
+		send_status(to, c->err, c->cmd, 0);
+}
+
+/*
+ * connection dropped mid-payload
+ */
+static void cmd_abort(sock_cmd_t *c, sock_conn_t *to)
+{
+	if(c->streaming)
 	{
-		ESP_LOGE(TAG, "Not enough space in SPIFFS - skipping.");
-		*err = 1;
+		uint32_t Data;
+		sink_close(&c->sink, &Data, to->cfg_reply, CFG_WAIT);
 	}
-	
-	/* write initial remaining data */
-	if(f)
+	if(c->buffer)
 	{
-		if((act = fwrite(left, 1, leftsz, f)) != leftsz)
-		{
-			ESP_LOGE(TAG, "Failed writing remaining %d - actual = %d", leftsz, act);
-			*err |= 2;
-		}
+		free(c->buffer);
+		ESP_LOGW(TAG, "file buffer not properly freed");
 	}
-	txsz -= leftsz;
-	tot = leftsz;
+}
+
+/*
+ * session - any number of commands on one connection, each with an id
+ * that comes back in its reply header. Starts with the 8 header bytes
+ * that were already read and whatever followed them.
+ */
+static void do_session(sock_conn_t *conn, char *hdr, char *left, int leftsz)
+{
+	sock_cmd_t c;
+	uint32_t words[SOCK_SESS_HDR_SZ/4];
+	int hdrsz = 8, len, rxidx;
+	uint8_t active = 0;
+	
+	memcpy(words, hdr, 8);
+	conn->session = 1;
+	ESP_LOGI(TAG, "Session started");
 	
-	/* loop over rest of data. Wifi maxes out at ~4kB per */
-	bufsz = txsz < 4096 ? txsz : 4096;
-	buffer = malloc(bufsz);
-	if(buffer)
+	while(1)
 	{
-		while(txsz)
+		rxidx = 0;
+		while(rxidx < leftsz)
 		{
-			/* get from socket */
-			size_t bsz = txsz <  bufsz ? txsz : bufsz;
-			rsz = recv(sock, buffer, bsz, 0);
-			//ESP_LOGI(TAG, "Received %d", rsz);
-			
-			/* write to file (if open) */
-			if(f)
+			if(hdrsz < SOCK_SESS_HDR_SZ)
 			{
-				act = fwrite(buffer, 1, rsz, f);
-				if(act != rsz)
+				/* gather the header */
+				len = SOCK_SESS_HDR_SZ - hdrsz;
+				len = len <= leftsz-rxidx ? len : leftsz-rxidx;
+				memcpy((char *)words + hdrsz, left+rxidx, len);
+				hdrsz += len;
+				rxidx += len;
+				if(hdrsz < SOCK_SESS_HDR_SZ)
+					break;
+				
+				if((words[0] & 0xFFFFFFF0) != SOCK_SESS_MAGIC)
 				{
-					ESP_LOGE(TAG, "Failed writing %d - actual = %d", rsz, act);
-					*err |= 4;
+					/* lost sync - can't recover on a stream */
+					ESP_LOGW(TAG, "Session: wrong header 0x%08X", words[0]);
+					goto END_SESSION;
 				}
+				conn->id = words[2];
+				cmd_start(&c, words[0] & 0xF, words[1], 0);
+				active = 1;
 			}
+			else
+				rxidx += cmd_data(&c, left+rxidx, leftsz-rxidx);
 			
-			txsz -= rsz;
-			tot += rsz;
+			/* next command */
+			if(c.got == c.txsz)
+			{
+				cmd_finish(&c, conn);
+				active = 0;
+				hdrsz = 0;
+			}
 		}
 		
-		free(buffer);
-	}
-	else
-	{
-		ESP_LOGE(TAG, "Couldn't allocate %d", bufsz);
-		*err |= 8;
-	}
-	
-	/* close file */
-	if(f)
-	{
-		fclose(f);
-		ESP_LOGI(TAG, "Wrote %d to file %s", tot, psram_file);
-	}
-	else
-		ESP_LOGI(TAG, "flushed %d", tot);
-
-	/* tried flushing socket here but it hung. Doesn't seem to be needed */
-	
-	/* return status */
-	ESP_LOGI(TAG, "PS_IN replying status");
-	int to_write = 1;
-	while(to_write > 0)
-	{
-		int written = send(sock, err, to_write, 0);
-		if (written < 0)
-		{
-			ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-		}
-		to_write -= written;
+		/* get more */
+		len = sock_recv(conn, active ? &c : NULL);
+		if(len <= 0)
+			break;
+		left = conn->rx_buffer;
+		leftsz = len;
 	}
 	
-	ESP_LOGI(TAG, "PS_IN done");
+END_SESSION:
+	ESP_LOGI(TAG, "Session ended");
+	if(active)
+		cmd_abort(&c, conn);
 }
 
 /*
- * receive a message
+ * receive a message. Long payloads are streamed into a sink as they
+ * arrive, short ones are collected and handled once complete. A session
+ * header switches the connection over to do_session().
  */
-static void do_getmsg(const int sock)
+static void do_getmsg(sock_conn_t *conn)
 {
-    int len, tot = 0, rxidx, sz, txsz = 0, state = 0;
-    char rx_buffer[128], *filebuffer = NULL, *fptr, err=0, cmd = 0;
+    int len, tot = 0, rxidx, sz, state = 0;
+	char *rx_buffer = conn->rx_buffer;
+	sock_cmd_t c;
 	union u_hdr
 	{
 		char bytes[8];
@@ -331,7 +481,7 @@ static void do_getmsg(const int sock)
     do
 	{
 		/* get latest buffer */
-        len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
+        len = sock_recv(conn, (state == 1) ? &c : NULL);
 		rxidx = 0;
 		
         if(len < 0)
@@ -340,11 +490,6 @@ static void do_getmsg(const int sock)
         }
 		else if(len == 0)
 		{
-			if(filebuffer)
-			{
-				free(filebuffer);
-				ESP_LOGW(TAG, "file buffer not properly freed");
-			}
             ESP_LOGI(TAG, "Connection closed, tot = %d, state = %d", tot, state);
         }
 		else
@@ -359,7 +504,7 @@ static void do_getmsg(const int sock)
 					{
 						/* fill header buffer */
 						sz = rxleft;
-						sz = sz <= 8 ? sz : 8;
+						sz = sz <= 8-tot ? sz : 8-tot;
 						memcpy(&header.bytes[tot], rx_buffer, sz);
 						tot += sz;
 						rxidx += sz;
@@ -370,154 +515,50 @@ static void do_getmsg(const int sock)
 					if(tot == 8)
 					{
 						/* check if header matches */
-						if((header.words[0] & 0xFFFFFFF0) == 0xCAFEBEE0)
+						if((header.words[0] & 0xFFFFFFF0) == SOCK_SESS_MAGIC)
+						{
+							/* the rest of the connection is a session */
+							do_session(conn, header.bytes, rx_buffer+rxidx, rxleft);
+							return;
+						}
+						else if(((header.words[0] & 0xFFFFFFF0) == 0xCAFEBEE0) ||
+							((header.words[0] & 0xFFFFFFF0) == SINK_Z_MAGIC))
 						{
-							cmd = header.words[0] & 0xF;
-							txsz = header.words[1];
-							ESP_LOGI(TAG, "State 0: Found header: cmd %1X, txsz = %d", cmd, txsz);
+							ESP_LOGI(TAG, "State 0: Found header: cmd %1X, txsz = %d",
+								header.words[0] & 0xF, header.words[1]);
+							cmd_start(&c, header.words[0] & 0xF, header.words[1],
+								(header.words[0] & 0xFFFFFFF0) == SINK_Z_MAGIC);
+							rxidx += cmd_data(&c, rx_buffer+rxidx, rxleft);
+							rxleft = len - rxidx;
+							tot = 8 + c.got;
 							
-							if(cmd==0xA)
-							{
-								/* special case for command 0xA - PSRAM_INIT */
-								if(xSemaphoreTake(ice_mutex, (TickType_t)100)==pdTRUE)
-								{
-									/* gather remaining */
-									sz = rxleft;
-									sz = sz <= txsz ? sz : txsz;
-									
-									/* handle the rest */
-									handle_ps_in(sock, &err, rx_buffer+rxidx, sz, txsz);
-								
-									/* unlock resources */
-									xSemaphoreGive(ice_mutex);
-									
-									/* advance state */
-									state = 2;
-								}
-								else
-								{
-									ESP_LOGW(TAG, "Couldn't get FPGA access");
-									err |= 1;
-								}
-							}
-							else
+							/* advance to next state */
+							state = 1;
+							
+							/* check for errors */
+							if(rxleft)
 							{
-								/* all others - lock resources */
-								if(xSemaphoreTake(ice_mutex, (TickType_t)100)==pdTRUE)
-								{							
-									/* allocate a buffer for the data */
-									filebuffer = malloc(txsz);
-									if(filebuffer)
-									{
-										/* save any remaining data in buffer */
-										fptr = filebuffer;
-										sz = rxleft;
-										sz = sz <= txsz ? sz : txsz;
-										memcpy(fptr, rx_buffer+rxidx, sz);
-										//ESP_LOGI(TAG, "State 0: got %d, used %d", rxleft, sz);
-										fptr += sz;
-										tot += sz;
-										rxleft -= sz;
-									}
-									else
-									{
-										ESP_LOGW(TAG, "Couldn't alloc buffer");
-										err |= 1;
-									}
-								}
-								else
-								{
-									ESP_LOGW(TAG, "Couldn't get FPGA access");
-									err |= 1;
-								}
-								
-								/* done? */
-								if((tot-8)==txsz)
-								{
-									/* compute CRC32 to match linux crc32 cmd */
-									uint32_t crc = crc32_le(0, (uint8_t *)filebuffer, txsz);
-									ESP_LOGI(TAG, "State 0: Done - Received %d, CRC32 = 0x%08X", txsz, crc);
-									handle_message(sock, &err, cmd, filebuffer, txsz);
-									
-									/* free the buffer */
-									free(filebuffer);
-									filebuffer = NULL;
-									
-									/* unlock resources */
-									xSemaphoreGive(ice_mutex);
-									
-									/* advance to complete state */
-									state = 2;
-								}
-								else
-								{
-									/* advance to next state */
-									state = 1;
-								}
-								
-								/* check for errors */
-								if(rxleft)
-								{
-									ESP_LOGW(TAG, "Received data > txsz %d", rxleft);
-									err |= 2;
-								}
+								ESP_LOGW(TAG, "Received data > txsz %d", rxleft);
+								c.err |= 2;
 							}
 						}
 						else
 						{
 							ESP_LOGW(TAG, "Wrong Header 0x%08X", header.words[0]);
-							err |= 4;
 						}
 					}
 					break;
 					
 				case 1:
-					/* collecting data in buffer */
-					if(filebuffer)
-					{
-						int fleft = txsz-(fptr-filebuffer);
-						if(fleft<txsz)
-						{
-							sz = len;
-							sz = sz <= fleft ? sz : fleft;
-							memcpy(fptr, rx_buffer, sz);
-							fptr += sz;
-							tot += sz;
-							fleft -= sz;
-							rxleft -= sz;
-							//ESP_LOGI(TAG, "State 1: got %d, used %d, %d left", len, sz, fleft);
-							
-							/* done? */
-							if((tot-8)==txsz)
-							{
-                                /* compute CRC32 to match linux crc32 cmd */
-                                uint32_t crc = crc32_le(0, (uint8_t *)filebuffer, txsz);
-								ESP_LOGI(TAG, "State 1: Done - Received %d, CRC32 = 0x%08X", txsz, crc);
-								
-								/* process it */
-								handle_message(sock, &err, cmd, filebuffer, txsz);
-								
-								/* free the buffer */
-								free(filebuffer);
-								filebuffer = NULL;
-								
-								/* unlock resources */
-								xSemaphoreGive(ice_mutex);
-								
-								/* advance state */
-								state = 2;
-							}
-								
-							/* check for errors */
-							if(rxleft)
-							{
-								ESP_LOGW(TAG, "State 1: Received data past end", rxleft);
-							}
-						}
-					}
-					else
+					/* collecting data */
+					sz = cmd_data(&c, rx_buffer, len);
+					tot += sz;
+					rxleft -= sz;
+					
+					/* check for errors */
+					if(rxleft)
 					{
-						ESP_LOGW(TAG, "State 1: Received %d but no buffer", len);
+						ESP_LOGW(TAG, "State 1: Received data past end", rxleft);
 					}
 					break;
 					
@@ -526,9 +567,44 @@ static void do_getmsg(const int sock)
 					ESP_LOGW(TAG, "State 2 - Received data past end", rxleft);
 					break;
 			}
+			
+			/* done? */
+			if((state == 1) && (c.got == c.txsz))
+			{
+				cmd_finish(&c, conn);
+				
+				/* advance to complete state */
+				state = 2;
+			}
         }
     }
 	while(len > 0);
+	
+	/* connection dropped mid-payload */
+	if(state == 1)
+		cmd_abort(&c, conn);
+}
+
+/*
+ * handler task - serve accepted connections one at a time
+ */
+static void sock_handler(void *pvParameters)
+{
+	sock_conn_t *conn = (sock_conn_t *)pvParameters;
+	
+	while(1)
+	{
+		xQueueReceive(sock_accepted, &conn->sock, portMAX_DELAY);
+		conn->session = 0;
+		conn->id = 0;
+		conn->rx_wait = 0;
+		
+		/* do the thing this socket does */
+		do_getmsg(conn);
+		
+		shutdown(conn->sock, 0);
+		close(conn->sock);
+	}
 }
 
 /*
@@ -564,6 +640,25 @@ void socket_task(void *pvParameters)
 
     ESP_LOGI(TAG, "Socket created");
 
+	/* a small pool of handlers, each with its own buffer and reply queue */
+	sock_accepted = xQueueCreate(SOCK_HANDLERS, sizeof(int));
+	for(int i=0;i<SOCK_HANDLERS;i++)
+	{
+		sock_conn_t *conn = calloc(1, sizeof(sock_conn_t));
+		if(!conn)
+			break;
+		conn->cfg_reply = xQueueCreate(1, sizeof(cfgtask_result_t));
+		conn->rx_buffer = heap_caps_malloc(SOCK_RX_SZ, MALLOC_CAP_DMA);
+		if(!conn->rx_buffer || xTaskCreate(sock_handler, "sock_handler",
+			SOCK_HANDLER_STACK, conn, 5, NULL) != pdPASS)
+		{
+			ESP_LOGE(TAG, "Unable to start handler %d", i);
+			free(conn->rx_buffer);
+			free(conn);
+			break;
+		}
+	}
+
     int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
     if (err != 0) {
         ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
@@ -572,7 +667,7 @@ void socket_task(void *pvParameters)
     }
     ESP_LOGI(TAG, "Socket bound, port %d", PORT);
 
-    err = listen(listen_sock, 1);
+    err = listen(listen_sock, SOCK_HANDLERS);
     if (err != 0) {
         ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
         goto CLEAN_UP;
@@ -596,17 +691,16 @@ void socket_task(void *pvParameters)
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
         setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+        // Small replies go out at once - sessions pipeline behind them
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &keepAlive, sizeof(int));
         // Convert ip address to string
         if (source_addr.ss_family == PF_INET) {
             inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
         }
         ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
 
-		/* do the thing this socket does */
-        do_getmsg(sock);
-
-        shutdown(sock, 0);
-        close(sock);
+		/* hand off to the next free handler */
+		xQueueSend(sock_accepted, &sock, portMAX_DELAY);
     }
 
 CLEAN_UP:
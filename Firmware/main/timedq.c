@@ -0,0 +1,275 @@
+/*
+ * timedq.c - FPGA operations fired at set times by esp_timer
+ * 10-17-26
+ *
+ * The host sends a list of register reads and writes and short PSRAM
+ * writes, each with the time in us after the start that it should happen.
+ * A one-shot esp_timer is armed a little before each op is due. Its
+ * callback only wakes the timedq task, which takes the FPGA port, spins
+ * out the rest so the op starts on the microsecond, then runs any ops
+ * that are due before the timer could fire again. The port is let go
+ * between wakeups and the task sits below lwIP and WiFi, so a run doesn't
+ * stall the network. Each op's value, how late it finished and how long
+ * it took come back in one reply.
+ */
+
+#include <string.h>
+#include "timedq.h"
+#include "ice.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+#define TIMEDQ_LEAD_US		100		// timer fires this early, then spins
+#define TIMEDQ_START_US		1000	// from arming to time 0
+#define TIMEDQ_HDR_SZ		6		// time, type, reg
+#define TIMEDQ_STACK		2560
+#define TIMEDQ_PRIO			10		// above the sampler & socket handlers
+#define TIMEDQ_LOCK_WAIT	((TickType_t)100)
+
+/* an op in the host's list */
+typedef struct
+{
+	uint32_t at;
+	uint8_t type, Reg;
+	uint8_t *args;
+} timedq_op_t;
+
+/* the run in progress */
+typedef struct
+{
+	timedq_op_t *ops;
+	timedq_log_t *log;
+	uint32_t count, next;
+	int64_t t0;
+	uint8_t err;
+	volatile uint8_t abort;
+} timedq_state_t;
+
+static const char* TAG = "timedq";
+static SemaphoreHandle_t timedq_mutex, timedq_done;
+static esp_timer_handle_t timedq_timer;
+static TaskHandle_t timedq_handle;
+static timedq_state_t timedq;
+
+/*
+ * run one op, Data gets the value read
+ */
+static void timedq_op(timedq_op_t *op, uint32_t *Data)
+{
+	uint32_t Addr, len;
+	
+	switch(op->type)
+	{
+		case TIMEDQ_READ:
+			ICE_FPGA_Serial_Read(op->Reg, Data);
+			break;
+		
+		case TIMEDQ_WRITE:
+			memcpy(Data, op->args, 4);
+			ICE_FPGA_Serial_Write(op->Reg, *Data);
+			break;
+		
+		case TIMEDQ_PS_WRITE:
+			memcpy(&Addr, op->args, 4);
+			memcpy(&len, op->args+4, 4);
+			ICE_PSRAM_Write(Addr, op->args+8, len);
+			*Data = 0;
+			break;
+	}
+}
+
+/*
+ * timer callback - runs in the esp_timer task so just wakes ours
+ */
+static void timedq_fire(void *arg)
+{
+	xTaskNotifyGive(timedq_handle);
+}
+
+/*
+ * run everything that's due with the FPGA port held, then arm for the
+ * next. Returns 1 once the run is over.
+ */
+static uint8_t timedq_service(timedq_state_t *q)
+{
+	int64_t due, now, start;
+	timedq_log_t *log;
+	
+	if(ICE_Lock(TIMEDQ_LOCK_WAIT) != pdTRUE)
+	{
+		ESP_LOGW(TAG, "Couldn't get FPGA access at op %u", q->next);
+		q->err = 1;
+		return 1;
+	}
+	while(!q->abort && (q->next < q->count))
+	{
+		due = q->t0 + q->ops[q->next].at;
+		now = esp_timer_get_time();
+		if(due - now > TIMEDQ_LEAD_US)
+		{
+			ICE_Unlock();
+			esp_timer_start_once(timedq_timer, due - now - TIMEDQ_LEAD_US);
+			return 0;
+		}
+		
+		/* timing is taken when the op is done, not when the spin ends */
+		log = &q->log[q->next];
+		while((start = esp_timer_get_time()) < due);
+		timedq_op(&q->ops[q->next], &log->Data);
+		now = esp_timer_get_time();
+		log->err = now - due;
+		log->us = now - start;
+		q->next++;
+	}
+	ICE_Unlock();
+	return 1;
+}
+
+/*
+ * wait for the timer and run the ops, one run at a time
+ */
+static void timedq_task(void *pvParameters)
+{
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if(timedq_service(&timedq))
+			xSemaphoreGive(timedq_done);
+	}
+}
+
+/*
+ * create the timer, locks and task
+ */
+esp_err_t timedq_init(void)
+{
+	esp_timer_create_args_t args =
+	{
+		.callback = timedq_fire,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "timedq",
+	};
+	
+	if(!(timedq_mutex = xSemaphoreCreateMutex()) ||
+		!(timedq_done = xSemaphoreCreateBinary()))
+		return ESP_ERR_NO_MEM;
+	if(xTaskCreate(timedq_task, "timedq", TIMEDQ_STACK, NULL, TIMEDQ_PRIO,
+		&timedq_handle) != pdPASS)
+		return ESP_ERR_NO_MEM;
+	return esp_timer_create(&args, &timedq_timer);
+}
+
+/*
+ * split the host's list into ops, checking sizes, types and times.
+ * Returns the op count, 0 if it's bad.
+ */
+static uint32_t timedq_parse(uint8_t *args, uint32_t argsz, timedq_op_t *ops)
+{
+	uint32_t i = 0, n = 0, last = 0, len;
+	timedq_op_t op;
+	
+	while(i < argsz)
+	{
+		if((n == TIMEDQ_MAX_OPS) || (argsz - i < TIMEDQ_HDR_SZ))
+			return 0;
+		memcpy(&op.at, args+i, 4);
+		op.type = args[i+4];
+		op.Reg = args[i+5] & 0x7f;
+		op.args = args + i + TIMEDQ_HDR_SZ;
+		i += TIMEDQ_HDR_SZ;
+		
+		if(op.type == TIMEDQ_READ)
+			len = 0;
+		else if(op.type == TIMEDQ_WRITE)
+			len = 4;
+		else if((op.type == TIMEDQ_PS_WRITE) && (argsz - i >= 8))
+		{
+			memcpy(&len, op.args+4, 4);
+			if(len > TIMEDQ_PS_MAX)
+				return 0;
+			len += 8;
+		}
+		else
+			return 0;
+		
+		if((argsz - i < len) || (op.at < last) || (op.at > TIMEDQ_MAX_US))
+			return 0;
+		i += len;
+		last = op.at;
+		if(ops)
+			ops[n] = op;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * run a list of timed ops, reply is a timedq_sum_t then a log entry per op
+ */
+uint8_t timedq_run(uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz)
+{
+	timedq_sum_t *sum;
+	uint32_t i, count;
+	uint64_t total = 0;
+	uint8_t err = 0;
+	
+	if(!(count = timedq_parse(args, argsz, NULL)))
+	{
+		ESP_LOGW(TAG, "Bad op list");
+		return 8;
+	}
+	
+	*replysz = sizeof(timedq_sum_t) + count*sizeof(timedq_log_t);
+	if(!(*reply = malloc(*replysz)))
+		return 1;
+	sum = (timedq_sum_t *)*reply;
+	memset(sum, 0, *replysz);
+	
+	xSemaphoreTake(timedq_mutex, portMAX_DELAY);
+	if(!(timedq.ops = malloc(count*sizeof(timedq_op_t))))
+	{
+		xSemaphoreGive(timedq_mutex);
+		return 1;
+	}
+	timedq_parse(args, argsz, timedq.ops);
+	timedq.log = (timedq_log_t *)(*reply + sizeof(timedq_sum_t));
+	timedq.count = count;
+	timedq.next = 0;
+	timedq.err = 0;
+	timedq.abort = 0;
+	
+	/* the task takes the FPGA port for each group of ops */
+	xSemaphoreTake(timedq_done, 0);
+	timedq.t0 = esp_timer_get_time() + TIMEDQ_START_US;
+	esp_timer_start_once(timedq_timer, TIMEDQ_START_US - TIMEDQ_LEAD_US);
+	if(xSemaphoreTake(timedq_done,
+		(timedq.ops[count-1].at/1000 + 2000)/portTICK_PERIOD_MS + 1) != pdTRUE)
+	{
+		/* shouldn't happen - stop it if it's still going */
+		ESP_LOGE(TAG, "Timed out at op %u of %u", timedq.next, count);
+		timedq.abort = 1;
+		esp_timer_stop(timedq_timer);
+		xTaskNotifyGive(timedq_handle);
+		xSemaphoreTake(timedq_done, TIMEDQ_LOCK_WAIT + 10);
+		timedq.err = 1;
+	}
+	err = timedq.err;
+	
+	sum->count = timedq.next;
+	for(i=0;i<timedq.next;i++)
+	{
+		uint32_t e = abs(timedq.log[i].err);
+		
+		timedq.log[i].at = timedq.ops[i].at;
+		sum->max_err = e > sum->max_err ? e : sum->max_err;
+		total += e;
+	}
+	if(sum->count)
+		sum->mean_err = total / sum->count;
+	free(timedq.ops);
+	xSemaphoreGive(timedq_mutex);
+	
+	ESP_LOGI(TAG, "Ran %u of %u ops, error max %u us, mean %u us", sum->count, count,
+		sum->max_err, sum->mean_err);
+	return err;
+}
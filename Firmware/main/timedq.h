@@ -0,0 +1,39 @@
+/*
+ * timedq.h - FPGA operations fired at set times by esp_timer
+ * 10-17-26
+ */
+
+#ifndef __TIMEDQ__
+#define __TIMEDQ__
+
+#include "main.h"
+
+#define TIMEDQ_MAX_OPS		1024
+#define TIMEDQ_MAX_US		(10*1000*1000)	// last op after the start
+#define TIMEDQ_PS_MAX		1024			// longest PSRAM write
+
+/* op types - each op is time us, type byte, reg byte, then the listed args */
+#define TIMEDQ_READ			0x00	// none - value goes in the log
+#define TIMEDQ_WRITE		0x01	// data
+#define TIMEDQ_PS_WRITE		0x02	// addr, len word, len bytes - reg unused
+
+/* reply header, followed by a timedq_log_t per op - sent as-is to the host */
+typedef struct
+{
+	uint32_t count;			// ops run
+	uint32_t max_err;		// worst time error, us
+	uint32_t mean_err;		// average time error, us
+} timedq_sum_t;
+
+typedef struct
+{
+	uint32_t at;			// when it was due, us after the start
+	int32_t err;			// when it finished minus when it was due, us
+	uint32_t us;			// how long the op took
+	uint32_t Data;			// value read
+} timedq_log_t;
+
+esp_err_t timedq_init(void);
+uint8_t timedq_run(uint8_t *args, uint32_t argsz, uint8_t **reply, uint32_t *replysz);
+
+#endif
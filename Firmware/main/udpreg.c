@@ -0,0 +1,227 @@
+/*
+ * udpreg.c - low-latency FPGA register access over UDP
+ * 10-17-26
+ *
+ * Each datagram carries a magic, a 16-bit sequence number and a list of
+ * ops: one byte of register | write flag, followed by four bytes of data
+ * for a write. The reply echoes the sequence number with an error byte,
+ * the op count and one 32-bit word per op - the value read, or the value
+ * written. The last reply to each client is kept so a retried request
+ * gets it again without the writes happening twice. WiFi modem sleep is
+ * turned off while requests keep coming and put back once they stop.
+ */
+
+#include <string.h>
+#include "udpreg.h"
+#include "ice.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+
+#define UDPREG_CLIENTS		4
+#define UDPREG_REQ_SZ		(4 + 5*UDPREG_MAX_OPS)
+#define UDPREG_REP_SZ		(6 + 4*UDPREG_MAX_OPS)
+#define UDPREG_LOCK_WAIT	((TickType_t)10)
+
+/* last reply sent to a client */
+typedef struct
+{
+	uint32_t addr;
+	uint16_t port, seq;
+	uint8_t valid;
+	int len;
+	uint8_t reply[UDPREG_REP_SZ];
+} udpreg_client_t;
+
+static const char* TAG = "udpreg";
+static udpreg_client_t udpreg_clients[UDPREG_CLIENTS];
+static uint8_t udpreg_next;
+
+#if UDPREG_NO_SLEEP
+static uint8_t udpreg_awake;
+static wifi_ps_type_t udpreg_ps;
+static TickType_t udpreg_last;
+
+/*
+ * modem sleep would add up to a beacon interval to every round trip, so
+ * keep the radio up while a client is active and restore whatever power
+ * save was set once it has gone quiet
+ */
+static void udpreg_power(uint8_t active)
+{
+	if(active)
+	{
+		udpreg_last = xTaskGetTickCount();
+		if(!udpreg_awake && (esp_wifi_get_ps(&udpreg_ps) == ESP_OK))
+		{
+			esp_wifi_set_ps(WIFI_PS_NONE);
+			udpreg_awake = 1;
+			ESP_LOGD(TAG, "Power save off");
+		}
+	}
+	else if(udpreg_awake &&
+		(xTaskGetTickCount() - udpreg_last >= pdMS_TO_TICKS(UDPREG_IDLE_MS)))
+	{
+		esp_wifi_set_ps(udpreg_ps);
+		udpreg_awake = 0;
+		ESP_LOGD(TAG, "Power save restored");
+	}
+}
+#else
+#define udpreg_power(active)
+#endif
+
+/*
+ * find a client's slot, reusing the oldest for a new one
+ */
+static udpreg_client_t *udpreg_find(struct sockaddr_in *src)
+{
+	udpreg_client_t *cl;
+	
+	for(int i=0;i<UDPREG_CLIENTS;i++)
+	{
+		cl = &udpreg_clients[i];
+		if((cl->addr == src->sin_addr.s_addr) && (cl->port == src->sin_port))
+			return cl;
+	}
+	
+	cl = &udpreg_clients[udpreg_next];
+	udpreg_next = (udpreg_next + 1) % UDPREG_CLIENTS;
+	cl->addr = src->sin_addr.s_addr;
+	cl->port = src->sin_port;
+	cl->valid = 0;
+	return cl;
+}
+
+/*
+ * run the ops in a request, returns the reply length
+ */
+static int udpreg_handle(uint8_t *req, int len, uint8_t *reply)
+{
+	uint8_t err = 0, *rptr = &reply[6];
+	uint16_t magic = UDPREG_REP_MAGIC;
+	uint32_t Data;
+	int i, n = 0;
+	
+	/* check the whole request before touching the FPGA */
+	for(i=4;i<len;i++,n++)
+	{
+		if(n == UDPREG_MAX_OPS)
+			break;
+		if(req[i] & UDPREG_WRITE)
+			i += 4;
+	}
+	if(i != len)
+	{
+		ESP_LOGW(TAG, "Bad request");
+		err |= 8;
+		n = 0;
+	}
+	else if(n && (ICE_Lock(UDPREG_LOCK_WAIT) != pdTRUE))
+	{
+		ESP_LOGW(TAG, "Couldn't get FPGA access");
+		err |= 1;
+		n = 0;
+	}
+	else if(n)
+	{
+		/* whole batch goes in one turn at the FPGA */
+		for(i=4;i<len;i++)
+		{
+			uint8_t Reg = req[i] & 0x7f;
+			
+			if(req[i] & UDPREG_WRITE)
+			{
+				memcpy(&Data, &req[i+1], 4);
+				ICE_FPGA_Serial_Write(Reg, Data);
+				i += 4;
+			}
+			else
+				ICE_FPGA_Serial_Read(Reg, &Data);
+			memcpy(rptr, &Data, 4);
+			rptr += 4;
+		}
+		ICE_Unlock();
+	}
+	
+	memcpy(&reply[0], &magic, 2);
+	memcpy(&reply[2], &req[2], 2);
+	reply[4] = err;
+	reply[5] = n;
+	return 6 + 4*n;
+}
+
+/*
+ * answer register requests until the end of time
+ */
+void udpreg_task(void *pvParameters)
+{
+	static uint8_t rx_buffer[UDPREG_REQ_SZ];
+	struct sockaddr_in dest_addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(UDPREG_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if(sock < 0)
+	{
+		ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+		vTaskDelete(NULL);
+		return;
+	}
+	if(bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0)
+	{
+		ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+		close(sock);
+		vTaskDelete(NULL);
+		return;
+	}
+	
+#if UDPREG_NO_SLEEP
+	/* wake up now and then to put power save back after a client */
+	struct timeval tv = { .tv_sec = 1 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+	ESP_LOGI(TAG, "Listening on UDP port %d", UDPREG_PORT);
+	
+	while(1)
+	{
+		struct sockaddr_in source_addr;
+		socklen_t addr_len = sizeof(source_addr);
+		uint16_t magic, seq;
+		
+		int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer), 0,
+			(struct sockaddr *)&source_addr, &addr_len);
+		if(len < 0)
+		{
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+			udpreg_power(0);
+			continue;
+		}
+		
+		/* ignore anything that isn't ours */
+		memcpy(&magic, &rx_buffer[0], 2);
+		if((len < 4) || (magic != UDPREG_REQ_MAGIC) ||
+			(source_addr.sin_family != AF_INET))
+			continue;
+		memcpy(&seq, &rx_buffer[2], 2);
+		udpreg_power(1);
+		
+		/* a retry gets the same answer without running it again */
+		udpreg_client_t *cl = udpreg_find(&source_addr);
+		if(!cl->valid || (cl->seq != seq))
+		{
+			cl->len = udpreg_handle(rx_buffer, len, cl->reply);
+			cl->seq = seq;
+			
+			/* failures didn't touch the FPGA so are safe to run again */
+			cl->valid = !cl->reply[4];
+		}
+		else
+			ESP_LOGD(TAG, "Retry of seq %d", seq);
+		
+		sendto(sock, cl->reply, cl->len, 0,
+			(struct sockaddr *)&source_addr, addr_len);
+	}
+}
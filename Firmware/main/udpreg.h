@@ -0,0 +1,22 @@
+/*
+ * udpreg.h - low-latency FPGA register access over UDP
+ * 10-17-26
+ */
+
+#ifndef __UDPREG__
+#define __UDPREG__
+
+#include "main.h"
+
+#define UDPREG_ENABLE		1			// 0 leaves the UDP port closed
+#define UDPREG_NO_SLEEP		1			// 0 leaves WiFi power save alone
+#define UDPREG_IDLE_MS		10000		// power save comes back after this quiet
+#define UDPREG_PORT			3335
+#define UDPREG_REQ_MAGIC	0xC3A5		// request: magic, seq, ops
+#define UDPREG_REP_MAGIC	0xC3A6		// reply: magic, seq, err, count, data
+#define UDPREG_WRITE		0x80		// op byte: write flag | register
+#define UDPREG_MAX_OPS		64
+
+void udpreg_task(void *pvParameters);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * upload.c - chunked, CRC-checked, resumable uploads
+ * 10-17-26
+ *
+ * An alternative to sending a long payload (config, save config, PSRAM
+ * write or PSRAM init) as one command. The host begins an upload with
+ * the command, size and CRC32 of the whole payload, then sends it in
+ * chunks, each with its offset and own CRC32. Chunks that are corrupt or
+ * out of place are refused before they reach the sink, a payload whose
+ * whole CRC32 doesn't match is dropped, and every reply says how far the
+ * upload has got, so after a dropped link the host asks where to carry on
+ * and only resends what's missing. The upload isn't tied to a connection
+ * or interface. A PSRAM write goes out as it arrives, so one whose whole
+ * CRC32 fails has already changed its target range and says so with its
+ * own error bit.
+ *
+ * Configs are collected and handed to the config worker at the end
+ * rather than streamed, so no lock is held between chunks.
+ */
+
+#include <string.h>
+#include "upload.h"
+#include "sink.h"
+#include "cfgtask.h"
+#include "rom/crc.h"
+#include "freertos/semphr.h"
+
+#define UPLOAD_CFG_WAIT		(5000/portTICK_PERIOD_MS)
+
+static const char* TAG = "upload";
+static SemaphoreHandle_t upload_mutex;
+static QueueHandle_t upload_reply;
+static upload_status_t upload_st;
+static sink_t upload_sink;
+static uint8_t upload_active;		// sink open, more chunks to come
+static uint32_t upload_crc;			// CRC32 of what's been accepted
+
+/*
+ * set up the lock and config reply queue
+ */
+esp_err_t upload_init(void)
+{
+	if(!(upload_mutex = xSemaphoreCreateMutex()) ||
+		!(upload_reply = xQueueCreate(1, sizeof(cfgtask_result_t))))
+		return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+/*
+ * start an upload (args cmd, size, CRC32), dropping any unfinished one
+ */
+uint8_t upload_begin(uint8_t *args, uint32_t argsz, upload_status_t *status)
+{
+	uint32_t cmd, size, crc, Data;
+	
+	if(argsz < 12)
+	{
+		upload_status(status);
+		return 8;
+	}
+	memcpy(&cmd, args, 4);
+	memcpy(&size, args+4, 4);
+	memcpy(&crc, args+8, 4);
+	if(!sink_wants(cmd, size) || !size)
+	{
+		upload_status(status);
+		return 8;
+	}
+	
+	xSemaphoreTake(upload_mutex, portMAX_DELAY);
+	if(upload_active)
+	{
+		/* short so the sink drops it */
+		ESP_LOGW(TAG, "Dropping upload at %u of %u", upload_st.offset, upload_st.size);
+		sink_close(&upload_sink, &Data, upload_reply, UPLOAD_CFG_WAIT);
+	}
+	
+	memset(&upload_st, 0, sizeof(upload_status_t));
+	upload_st.cmd = cmd;
+	upload_st.size = size;
+	upload_st.crc = crc;
+	upload_crc = 0;
+	sink_open(&upload_sink, cmd, size);
+	upload_sink.collect = 1;
+	upload_active = 1;
+	ESP_LOGI(TAG, "Upload cmd 0x%X, %u bytes, CRC32 0x%08X", cmd, size, crc);
+	
+	*status = upload_st;
+	xSemaphoreGive(upload_mutex);
+	return 0;
+}
+
+/*
+ * take a chunk (args offset, CRC32, data). Repeats of chunks already in
+ * are acknowledged again so lost replies can simply be retried.
+ */
+uint8_t upload_chunk(uint8_t *args, uint32_t argsz, upload_status_t *status)
+{
+	uint32_t offset, crc, len = argsz - 8;
+	uint8_t err = 0, *data = args + 8;
+	
+	if(argsz < 8)
+	{
+		upload_status(status);
+		return 8;
+	}
+	memcpy(&offset, args, 4);
+	memcpy(&crc, args+4, 4);
+	
+	xSemaphoreTake(upload_mutex, portMAX_DELAY);
+	if(!upload_st.cmd)
+		err |= 8;
+	else if(crc32_le(0, data, len) != crc)
+	{
+		ESP_LOGW(TAG, "Bad CRC for chunk at %u", offset);
+		err |= UPLOAD_CHUNK_ERR;
+	}
+	else if(offset + len <= upload_st.offset)
+	{
+		/* already have it - result of the whole upload if that's done */
+		if(!upload_active)
+			err |= upload_st.err;
+	}
+	else if((offset != upload_st.offset) || (offset + len > upload_st.size))
+	{
+		ESP_LOGW(TAG, "Chunk at %u, expected %u", offset, upload_st.offset);
+		err |= UPLOAD_CHUNK_ERR;
+	}
+	else
+	{
+		sink_write(&upload_sink, data, len);
+		upload_crc = crc32_le(upload_crc, data, len);
+		upload_st.offset += len;
+		upload_st.err = upload_sink.err;
+		
+		if(upload_st.offset == upload_st.size)
+		{
+			/* good chunks can still add up to the wrong payload */
+			if(upload_crc != upload_st.crc)
+			{
+				ESP_LOGW(TAG, "Upload CRC32 0x%08X, expected 0x%08X", upload_crc,
+					upload_st.crc);
+				upload_sink.bad = 1;
+			}
+			upload_st.err = sink_close(&upload_sink, &upload_st.Data,
+				upload_reply, UPLOAD_CFG_WAIT);
+			if(upload_sink.bad && (upload_st.cmd == 0xc))
+			{
+				ESP_LOGW(TAG, "Bad payload already written to PSRAM");
+				upload_st.err |= UPLOAD_DIRTY_ERR;
+			}
+			upload_active = 0;
+			err |= upload_st.err;
+			ESP_LOGI(TAG, "Upload done, err %d", upload_st.err);
+		}
+	}
+	
+	*status = upload_st;
+	xSemaphoreGive(upload_mutex);
+	return err;
+}
+
+/*
+ * where the current or last upload is up to
+ */
+void upload_status(upload_status_t *status)
+{
+	xSemaphoreTake(upload_mutex, portMAX_DELAY);
+	*status = upload_st;
+	xSemaphoreGive(upload_mutex);
+}
@@ -0,0 +1,33 @@
+/*
+ * upload.h - chunked, CRC-checked, resumable uploads
+ * 10-17-26
+ */
+
+#ifndef __UPLOAD__
+#define __UPLOAD__
+
+#include "main.h"
+
+/* error bit for a chunk that's corrupt or not where the upload is up to */
+#define UPLOAD_CHUNK_ERR	0x20
+
+/* error bit for a PSRAM write whose whole CRC32 failed after it landed */
+#define UPLOAD_DIRTY_ERR	0x80
+
+/* where an upload is up to - layout is sent as-is to the host */
+typedef struct
+{
+	uint32_t cmd;			// command the payload is for, 0 if none
+	uint32_t size;			// whole payload
+	uint32_t crc;			// CRC32 of the whole payload
+	uint32_t offset;		// bytes accepted so far
+	uint32_t err;			// error bits so far
+	uint32_t Data;			// config time once done
+} upload_status_t;
+
+esp_err_t upload_init(void);
+uint8_t upload_begin(uint8_t *args, uint32_t argsz, upload_status_t *status);
+uint8_t upload_chunk(uint8_t *args, uint32_t argsz, upload_status_t *status);
+void upload_status(upload_status_t *status);
+
+#endif
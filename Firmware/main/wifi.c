@@ -17,6 +17,8 @@
 #include "lwip/netdb.h"
 #include "phy.h"
 #include "socket.h"
+#include "udpreg.h"
+#include "sampler.h"
 #include "mdns.h"
 #include "esp_idf_version.h"
 #include "uart2.h"
@@ -313,6 +315,13 @@ esp_err_t wifi_init(void)
 		
 		/* whatever else you want running on top of WiFi */
 		xTaskCreate(socket_task, "socket", 4096, (void*)AF_INET, 5, NULL);
+#if UDPREG_ENABLE
+		ESP_ERROR_CHECK( mdns_service_add(NULL, "_FPGA", "_udp", UDPREG_PORT, NULL, 0)  );
+		xTaskCreate(udpreg_task, "udpreg", 3072, NULL, 6, NULL);
+#endif
+#if SAMPLER_ENABLE
+		xTaskCreate(sampler_task, "samples", 3072, NULL, 5, NULL);
+#endif
 		
 		return ESP_OK;
 	}
@@ -0,0 +1 @@
+#include "mock_idf.h"
@@ -0,0 +1,175 @@
+/*
+ * mock_idf.h - just enough of the ESP-IDF API to build ice.c on a host
+ * 10-17-26
+ */
+
+#ifndef __MOCK_IDF__
+#define __MOCK_IDF__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+/* errors */
+typedef int esp_err_t;
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_TIMEOUT				0x107
+#define ESP_ERROR_CHECK(x)			assert((x)==ESP_OK)
+
+/* logging */
+#define ESP_LOGE(tag, fmt, ...)		printf("E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)		printf("W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...)		printf("I (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)		do {} while(0)
+
+/* FreeRTOS */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef void *xSemaphoreHandle;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef void *EventGroupHandle_t;
+typedef void *TaskHandle_t;
+#define pdTRUE						1
+#define pdFALSE						0
+#define pdPASS						1
+#define portMAX_DELAY				0xffffffffUL
+#define portTICK_PERIOD_MS			10
+#define vSemaphoreCreateBinary(s)	((s) = (void *)1)
+#define xSemaphoreGive(s)			((void)(s))
+static inline BaseType_t xSemaphoreTake(void *s, TickType_t t) { return pdTRUE; }
+#define xSemaphoreCreateMutex()		((void *)1)
+#define xQueueCreate(n, sz)			((void *)1)
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	0
+#define portENTER_CRITICAL(m)		((void)(m))
+#define portEXIT_CRITICAL(m)		((void)(m))
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack,
+	void *arg, uint32_t prio, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+
+/* timing */
+void ets_delay_us(uint32_t us);
+int64_t esp_timer_get_time(void);
+
+/* flash */
+typedef uint32_t spi_flash_mmap_handle_t;
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+/* heap */
+#define MALLOC_CAP_DMA				(1<<3)
+void *heap_caps_malloc(size_t size, uint32_t caps);
+bool esp_ptr_dma_capable(const void *p);
+size_t heap_caps_get_free_size(uint32_t caps);
+
+/* ROM */
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+/* GPIO */
+typedef int gpio_num_t;
+typedef enum { GPIO_MODE_INPUT = 1, GPIO_MODE_OUTPUT = 2 } gpio_mode_t;
+#define SIG_GPIO_OUT_IDX			128
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num);
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+void esp_rom_gpio_pad_select_gpio(uint32_t iopad_num);
+void esp_rom_gpio_connect_out_signal(uint32_t gpio_num, uint32_t signal_idx, bool out_inv, bool oen_inv);
+void esp_rom_gpio_connect_in_signal(uint32_t gpio_num, uint32_t signal_idx, bool inv);
+
+/* SPI master */
+typedef enum { SPI1_HOST = 0, SPI2_HOST = 1 } spi_host_device_t;
+#define SPI_DMA_CH_AUTO				3
+
+typedef struct {
+	int mosi_io_num;
+	int miso_io_num;
+	int sclk_io_num;
+	int quadwp_io_num;
+	int quadhd_io_num;
+	int max_transfer_sz;
+	uint32_t flags;
+	int intr_flags;
+} spi_bus_config_t;
+
+#define SPI_DEVICE_HALFDUPLEX		(1<<4)
+#define SPI_DEVICE_NO_DUMMY			(1<<6)
+
+typedef struct {
+	uint8_t command_bits;
+	uint8_t address_bits;
+	uint8_t dummy_bits;
+	uint8_t mode;
+	uint16_t duty_cycle_pos;
+	uint16_t cs_ena_pretrans;
+	uint8_t cs_ena_posttrans;
+	int clock_speed_hz;
+	int input_delay_ns;
+	int spics_io_num;
+	uint32_t flags;
+	int queue_size;
+	void *pre_cb;
+	void *post_cb;
+} spi_device_interface_config_t;
+
+#define SPI_TRANS_MODE_DIO			(1<<0)
+#define SPI_TRANS_USE_RXDATA		(1<<2)
+#define SPI_TRANS_USE_TXDATA		(1<<3)
+#define SPI_TRANS_VARIABLE_CMD		(1<<5)
+#define SPI_TRANS_VARIABLE_ADDR		(1<<6)
+#define SPI_TRANS_VARIABLE_DUMMY	(1<<7)
+
+typedef struct {
+	uint32_t flags;
+	uint16_t cmd;
+	uint64_t addr;
+	size_t length;
+	size_t rxlength;
+	void *user;
+	union {
+		const void *tx_buffer;
+		uint8_t tx_data[4];
+	};
+	union {
+		void *rx_buffer;
+		uint8_t rx_data[4];
+	};
+} spi_transaction_t;
+
+typedef struct {
+	spi_transaction_t base;
+	uint8_t command_bits;
+	uint8_t address_bits;
+	uint8_t dummy_bits;
+} spi_transaction_ext_t;
+
+typedef struct mock_spi_dev *spi_device_handle_t;
+
+typedef struct {
+	uint32_t spiclk_out;
+	uint32_t spiclk_in;
+	uint32_t spid_out;
+	uint32_t spiq_out;
+	uint32_t spics_out[6];
+} spi_signal_conn_t;
+extern const spi_signal_conn_t spi_periph_signal[2];
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *t, TickType_t wait);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **t, TickType_t wait);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *t);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *t);
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t wait);
+void spi_device_release_bus(spi_device_handle_t handle);
+
+#endif
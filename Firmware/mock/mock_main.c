@@ -0,0 +1,700 @@
+/*
+ * mock_main.c - throughput check of the ice.c SPI engine on a host
+ * 10-17-26
+ *
+ * Pushes a bitstream sized config and multi-MB PSRAM traffic through
+ * ice.c on top of the simulated driver in mock_spi.c, checks that config
+ * steps its clock down when the FPGA can't keep up and reports bus
+ * utilization, idle gaps and how much CPU time was left for other tasks.
+ * PSRAM data is checked against a model of the part that wraps bursts at
+ * page boundaries and bursts are checked against tCEM. Compressed
+ * bitstreams and ones streamed in network sized pieces must reach the
+ * FPGA intact and a damaged compressed one must be caught. The bitstream
+ * cache must evict least recently used entries but never pinned or busy
+ * ones. USB reply frames must decode back to what was sent. Dual I/O
+ * blocks are round-tripped through a model of the FPGA loopback buffer,
+ * which checks the firmware side only. Finally compares
+ * register read rates of the GPIO and hardware CS paths and checks the
+ * bus profiler counted them. Register polls must see a bit that comes up
+ * in time and give up on one that doesn't. Command scripts must run their
+ * register, PSRAM, poll and loop ops, malformed ones must be refused and
+ * runaway ones stopped.
+ * PSRAM fills, copies between overlapping ranges and CRCs must match the
+ * model.
+ */
+
+#include <string.h>
+#include "ice.h"
+#include "mock_spi.h"
+#include "cfgz.h"
+#include "bitcache.h"
+#include "frame.h"
+#include "script.h"
+#include "cfgtask.h"
+#include "psops.h"
+#include "psread.h"
+
+#define BITSTREAM_SZ	104090
+#define PSRAM_WR_SZ		(4*1024*1024)
+#define PSRAM_RD_SZ		(1024*1024)
+#define PSRAM_ADDR		0x1234F
+#define DUAL_LOOPS		64
+
+void ICE_SPI_WriteBlk(uint8_t *Data, uint32_t Count);
+void ICE_SPI_ReadBlk(uint8_t *Data, uint32_t Count);
+
+/*
+ * the original blocking 4kB-at-a-time writer, for comparison
+ */
+static void legacy_writeblk(uint8_t *Data, uint32_t Count)
+{
+	spi_transaction_t t;
+	uint32_t bytes;
+	
+	while(Count)
+	{
+		bytes = (Count > 4096) ? 4096 : Count;
+		memset(&t, 0, sizeof(spi_transaction_t));
+		t.length=8*bytes;
+		t.tx_buffer=Data;
+		spi_device_polling_transmit(mock_dev(0), &t);
+		Count -= bytes;
+		Data += bytes;
+	}
+}
+
+/*
+ * simple greedy LZSS in the python/cfgz.py format, returns container size
+ */
+static uint32_t cfgz_pack(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+	cfgz_hdr_t hdr = { CFGZ_MAGIC, len, crc32_le(0, in, len), 0 };
+	uint32_t pos = 0, op = sizeof(hdr), fp = 0, bit = 8, best, dist, d, l;
+	
+	while(pos < len)
+	{
+		if(bit == 8)
+		{
+			fp = op;
+			out[op++] = 0;
+			bit = 0;
+		}
+		
+		/* longest match in the last 1kB is plenty here */
+		best = dist = 0;
+		for(d=1;(d<=1024) && (d<=pos);d++)
+		{
+			for(l=0;(l<273) && (pos+l<len) && (in[pos+l-d]==in[pos+l]);l++);
+			if(l > best)
+			{
+				best = l;
+				dist = d;
+			}
+		}
+		
+		if(best >= 3)
+		{
+			out[op++] = (dist-1) & 0xff;
+			out[op++] = (((dist-1) >> 4) & 0xf0) | (best-3 < 15 ? best-3 : 15);
+			if(best-3 >= 15)
+				out[op++] = best-3-15;
+			pos += best;
+		}
+		else
+		{
+			out[fp] |= 1<<bit;
+			out[op++] = in[pos++];
+		}
+		bit++;
+	}
+	
+	hdr.zlen = op - sizeof(hdr);
+	memcpy(out, &hdr, sizeof(hdr));
+	return op;
+}
+
+/*
+ * streaming decoder output - append to the buffer
+ */
+static void cfgz_unpack_out(void *ctx, uint8_t *data, uint32_t len)
+{
+	uint8_t **pp = ctx;
+	
+	memcpy(*pp, data, len);
+	*pp += len;
+}
+
+/*
+ * unpack a container through the streaming decoder in random sized
+ * pieces, returns nonzero if it was refused
+ */
+static uint8_t cfgz_unpack(const uint8_t *in, uint32_t insz, uint8_t *out)
+{
+	cfgz_stream_t *z = cfgz_stream_new();
+	uint32_t ip = 0, sz, used;
+	uint8_t result;
+	
+	while(ip < insz)
+	{
+		sz = 1 + rand()%1500;
+		sz = sz <= insz-ip ? sz : insz-ip;
+		used = cfgz_stream_hdr(z, in+ip, sz);
+		cfgz_stream_write(z, in+ip+used, sz-used, cfgz_unpack_out, &out);
+		ip += sz;
+	}
+	result = cfgz_stream_end(z, cfgz_unpack_out, &out);
+	cfgz_stream_free(z);
+	return result;
+}
+
+/*
+ * COBS decode and check a reply frame, returns body size or -1
+ */
+static int frame_check(const uint8_t *in, uint32_t insz, uint8_t type, uint8_t *body)
+{
+	uint8_t raw[FRAME_MAX+8];
+	uint32_t ip = 0, n = 0, len;
+	uint8_t code;
+	
+	if(!insz || in[insz-1])
+		return -1;
+	insz--;
+	while(ip < insz)
+	{
+		code = in[ip++];
+		if(!code || (ip + code - 1 > insz) || (n + code > sizeof(raw)))
+			return -1;
+		memcpy(raw+n, in+ip, code-1);
+		n += code-1;
+		ip += code-1;
+		if((code < 0xff) && (ip < insz))
+			raw[n++] = 0;
+	}
+	if(memchr(in, 0, insz) || (n < 7) || (raw[0] != type))
+		return -1;
+	len = raw[1] | (raw[2] << 8);
+	if((len + 7 != n) || (crc32_le(0, raw, n-4) !=
+		(raw[n-4] | (raw[n-3] << 8) | (raw[n-2] << 16) | ((uint32_t)raw[n-1] << 24))))
+		return -1;
+	memcpy(body, raw+3, len);
+	return len;
+}
+
+/*
+ * print stats for one run
+ */
+static void report(const char *name)
+{
+	uint64_t ns = mock_now_ns();
+	
+	printf("%-24s %8llu B %6u trans %6u ints %6u gaps %8.1f us idle %7.2f MB/s "
+		"%5.1f%% cpu free\n",
+		name, (unsigned long long)mock_stats.bytes, mock_stats.transactions,
+		mock_stats.interrupts, mock_stats.idle_gaps, mock_stats.idle_ns/1000.0,
+		ns ? (1000.0*mock_stats.bytes)/ns : 0.0,
+		ns ? (100.0*mock_stats.cpu_free_ns)/ns : 0.0);
+}
+
+/*
+ * the config worker isn't modelled - scripts here don't load bitstreams
+ */
+uint32_t load_fpga(const char *filename, QueueHandle_t reply)
+{
+	return 0;
+}
+
+esp_err_t cfgtask_result(QueueHandle_t reply, uint32_t id, cfgtask_result_t *result,
+	TickType_t wait)
+{
+	return ESP_FAIL;
+}
+
+esp_err_t cfgtask_wait_idle(cfgtask_result_t *last, TickType_t wait)
+{
+	return ESP_OK;
+}
+
+/*
+ * no scheduler either - tasks never start
+ */
+BaseType_t xTaskCreate(void (*task)(void *), const char *name, uint32_t stack,
+	void *arg, uint32_t prio, TaskHandle_t *handle)
+{
+	return pdFALSE;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+/*
+ * the double-buffered read helper isn't modelled - read in line
+ */
+uint8_t psread_stream(uint32_t Addr, uint32_t size, uint32_t chunk,
+	psread_out_t out, void *ctx)
+{
+	uint8_t *buf = malloc(chunk);
+	uint32_t len;
+	
+	while(size)
+	{
+		len = size < chunk ? size : chunk;
+		ICE_Lock(portMAX_DELAY);
+		ICE_PSRAM_Read(Addr, buf, len);
+		ICE_Unlock();
+		out(ctx, buf, len);
+		Addr += len;
+		size -= len;
+	}
+	free(buf);
+	return 0;
+}
+
+/*
+ * add a script op with its reg byte if reg >= 0 and its words
+ */
+static uint32_t script_op(uint8_t *s, uint32_t len, uint8_t op, int reg,
+	uint32_t nw, const uint32_t *w)
+{
+	s[len++] = op;
+	if(reg >= 0)
+		s[len++] = reg;
+	memcpy(s+len, w, 4*nw);
+	return len + 4*nw;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *buf = malloc(PSRAM_WR_SZ), *rd;
+	uint32_t i, j, err = 0;
+	int hz;
+	
+	memset(buf, 0, PSRAM_WR_SZ);
+	ICE_Init();
+	
+	mock_reset();
+	legacy_writeblk(buf, BITSTREAM_SZ);
+	report("legacy bitstream");
+	
+	mock_reset();
+	if(ICE_FPGA_Config(buf, BITSTREAM_SZ))
+	{
+		printf("config failed\n");
+		err++;
+	}
+	report("config (dma)");
+	
+	mock_dma_ok = false;
+	mock_reset();
+	ICE_FPGA_Config(buf, BITSTREAM_SZ);
+	report("config (bounce)");
+	mock_dma_ok = true;
+	
+	/* FPGA that can't take the fast clocks - config must step down */
+	mock_cfg_max_hz = 20*1000*1000;
+	mock_reset();
+	if(ICE_FPGA_Config(buf, BITSTREAM_SZ) || (ICE_FPGA_Config_Time(&hz), hz > mock_cfg_max_hz))
+	{
+		printf("config step down failed\n");
+		err++;
+	}
+	report("config (step down)");
+	printf("config %u us @ %d Hz, %u clock changes\n", ICE_FPGA_Config_Time(NULL), hz,
+		mock_stats.removes);
+	mock_cfg_max_hz = 0;
+	
+	/* compressed bitstream - sparse like the real thing */
+	{
+		uint8_t *z = malloc(2*BITSTREAM_SZ), *cap = malloc(BITSTREAM_SZ);
+		uint32_t zsz, raw;
+		int was;
+		
+		memset(buf, 0, BITSTREAM_SZ);
+		for(j=0;j<BITSTREAM_SZ;j+=1+rand()%64)
+			buf[j] = rand();
+		zsz = cfgz_pack(buf, BITSTREAM_SZ, z);
+		
+		mock_cfg_capture = cap;
+		mock_reset();
+		if(!cfgz_check(z, zsz) || cfgz_config(z, zsz, &raw) ||
+			(raw != BITSTREAM_SZ) || (mock_cfg_captured != BITSTREAM_SZ) ||
+			memcmp(cap, buf, BITSTREAM_SZ))
+		{
+			printf("compressed config mismatch\n");
+			err++;
+		}
+		report("config (cfgz)");
+		
+		/* same bitstream streamed in TCP segment sized pieces */
+		mock_reset();
+		if(ICE_FPGA_Config_Begin(0))
+			err++;
+		for(j=0;j<BITSTREAM_SZ;j+=1460)
+			ICE_FPGA_Config_Write(buf+j, (BITSTREAM_SZ-j) < 1460 ? BITSTREAM_SZ-j : 1460);
+		if(ICE_FPGA_Config_End() || (mock_cfg_captured != BITSTREAM_SZ) ||
+			memcmp(cap, buf, BITSTREAM_SZ))
+		{
+			printf("streamed config mismatch\n");
+			err++;
+		}
+		report("config (streamed)");
+		
+		/* stream that stops part way isn't a slow clock */
+		ICE_FPGA_Config_Time(&was);
+		if(ICE_FPGA_Config_Begin(0))
+			err++;
+		ICE_FPGA_Config_Write(buf, 1460);
+		ICE_FPGA_Config_Abort();
+		if(ICE_FPGA_Config_Time(&hz), hz != was)
+		{
+			printf("aborted config stepped down\n");
+			err++;
+		}
+		
+		/* nothing kept to retry with - one pass at the safe clock */
+		if(ICE_FPGA_Config_Begin(1))
+			err++;
+		ICE_FPGA_Config_Write(buf, BITSTREAM_SZ);
+		if(ICE_FPGA_Config_End() || (ICE_FPGA_Config_Time(&hz), hz != 10*1000*1000))
+		{
+			printf("safe clock config wrong\n");
+			err++;
+		}
+		printf("cfgz %u -> %u bytes\n", BITSTREAM_SZ, zsz);
+		
+		/* same container unpacked as it arrives in odd sized pieces */
+		if(cfgz_unpack(z, zsz, cap) || memcmp(cap, buf, BITSTREAM_SZ))
+		{
+			printf("streamed cfgz mismatch\n");
+			err++;
+		}
+		
+		/* damaged stream must not pass as a good config */
+		z[sizeof(cfgz_hdr_t)+2] ^= 0xf0;
+		mock_reset();
+		if((cfgz_config(z, zsz, &raw) != 3) || mock_stats.transactions)
+		{
+			printf("damaged cfgz accepted or sent\n");
+			err++;
+		}
+		if(!cfgz_unpack(z, zsz, cap))
+		{
+			printf("damaged streamed cfgz accepted\n");
+			err++;
+		}
+		mock_cfg_capture = NULL;
+		free(cap);
+		free(z);
+	}
+	
+	/* bitstream cache - real sized images, both slots mapped & one upload */
+	{
+		bitcache_ent_t *a, *b, *c;
+		bitcache_stats_t st;
+		
+		bitcache_init();
+		a = bitcache_add_map(1, buf, BITSTREAM_SZ, 1);
+		b = bitcache_add_map(2, buf, BITSTREAM_SZ, 2);
+		c = bitcache_add(3, buf, BITSTREAM_SZ, 1);
+		if(!a || !b || !c)
+		{
+			printf("cache didn't hold both slots and an upload\n");
+			err++;
+		}
+		bitcache_put(a);
+		bitcache_put(b);
+		bitcache_put(c);
+		
+		/* a second upload only pushes out the first, not the older slots */
+		c = bitcache_add(4, buf, BITSTREAM_SZ, 1);
+		if(!c || !(a = bitcache_get(1)) || !(b = bitcache_get(2)) || bitcache_get(3))
+		{
+			printf("cache didn't evict the heap copy\n");
+			err++;
+		}
+		
+		/* everything busy - no room */
+		if(bitcache_add(5, buf, BITSTREAM_SZ, 1))
+		{
+			printf("cache evicted a busy entry\n");
+			err++;
+		}
+		
+		/* slot rewritten while in use - gone once released */
+		bitcache_drop_map(2);
+		if(bitcache_get(2) || (bitcache_put(b), mock_unmaps != 1))
+		{
+			printf("cache kept a rewritten slot\n");
+			err++;
+		}
+		if(a)
+			bitcache_put(a);
+		if(c)
+			bitcache_put(c);
+		bitcache_stats(&st);
+		printf("cache %u hits %u misses %u evictions, %u entries %u B\n",
+			st.hits, st.misses, st.evictions, st.count, st.bytes);
+		if((st.hits != 2) || (st.misses != 2) || (st.evictions != 1) || (st.count != 2) ||
+			(st.bytes != BITSTREAM_SZ))
+		{
+			printf("cache counters wrong\n");
+			err++;
+		}
+	}
+	
+	/* reply frames - zeros, a run past a COBS block and a full frame */
+	{
+		static const uint32_t sizes[] = {0, 5, 300, FRAME_MAX};
+		uint8_t *enc = malloc(FRAME_ENC_SZ(FRAME_MAX)), *dec = malloc(FRAME_MAX);
+		uint32_t encsz;
+		
+		for(i=0;i<4;i++)
+		{
+			for(j=0;j<sizes[i];j++)
+				buf[j] = (i == 2) ? 0xA5 : rand() & ((j & 1) ? 0xff : 0);
+			encsz = frame_encode(FRAME_DATA, buf, sizes[i], enc);
+			if((encsz > FRAME_ENC_SZ(sizes[i])) ||
+				(frame_check(enc, encsz, FRAME_DATA, dec) != sizes[i]) ||
+				memcmp(buf, dec, sizes[i]))
+			{
+				printf("reply frame of %u bytes didn't decode\n", sizes[i]);
+				err++;
+			}
+		}
+		
+		/* a damaged frame is caught */
+		enc[encsz/2] ^= 0x10;
+		if(frame_check(enc, encsz, FRAME_DATA, dec) >= 0)
+		{
+			printf("damaged reply frame accepted\n");
+			err++;
+		}
+		free(enc);
+		free(dec);
+	}
+	
+	for(i=0;i<2;i++)
+	{
+		mock_dma_ok = i ? false : true;
+		memset(buf, 0, PSRAM_RD_SZ+1);
+		mock_reset();
+		
+		/* odd offset & size forces the bounce path for the tail */
+		ICE_SPI_ReadBlk(buf+i, PSRAM_RD_SZ-i);
+		report(i ? "block read (bounce)" : "block read (dma)");
+		
+		for(j=0;j<PSRAM_RD_SZ-i;j++)
+			if(buf[i+j] != mock_rx_pattern(j))
+			{
+				printf("block readback mismatch @ %u\n", j);
+				err++;
+				break;
+			}
+	}
+	mock_dma_ok = true;
+	
+	/* PSRAM round trip from an odd address so bursts straddle pages */
+	for(j=0;j<PSRAM_WR_SZ;j++)
+		buf[j] = rand();
+	mock_reset();
+	ICE_PSRAM_Write(PSRAM_ADDR, buf, PSRAM_WR_SZ);
+	report("psram write");
+	if(memcmp(buf, mock_psram_mem()+PSRAM_ADDR, PSRAM_WR_SZ))
+	{
+		printf("psram contents mismatch\n");
+		err++;
+	}
+	rd = malloc(PSRAM_WR_SZ);
+	mock_reset();
+	ICE_PSRAM_Read(PSRAM_ADDR, rd, PSRAM_WR_SZ);
+	report("psram read");
+	if(memcmp(buf, rd, PSRAM_WR_SZ))
+	{
+		printf("psram readback mismatch\n");
+		err++;
+	}
+	if(mock_stats.tcem_violations)
+	{
+		printf("%u bursts exceeded tCEM\n", mock_stats.tcem_violations);
+		err++;
+	}
+	
+	/* dual I/O loopback round trip, direct and bounced */
+	for(i=0;i<2;i++)
+	{
+		mock_dma_ok = i ? false : true;
+		mock_reset();
+		for(j=0;j<DUAL_LOOPS;j++)
+			ICE_FPGA_Dual_Write(buf+j*ICE_DUAL_BUF_SZ, ICE_DUAL_BUF_SZ);
+		report(i ? "dual loop wr (bounce)" : "dual loop wr (dma)");
+		mock_reset();
+		memset(rd, 0, ICE_DUAL_BUF_SZ);
+		ICE_FPGA_Dual_Read(rd, ICE_DUAL_BUF_SZ);
+		report(i ? "dual loop rd (bounce)" : "dual loop rd (dma)");
+		if(memcmp(buf+(DUAL_LOOPS-1)*ICE_DUAL_BUF_SZ, rd, ICE_DUAL_BUF_SZ))
+		{
+			printf("dual readback mismatch\n");
+			err++;
+		}
+	}
+	mock_dma_ok = true;
+	if(!ICE_FPGA_Dual_Write(buf, ICE_DUAL_BUF_SZ+1))
+	{
+		printf("oversize dual block accepted\n");
+		err++;
+	}
+	free(rd);
+	
+	/* register access rate, GPIO CS vs hardware CS */
+	ICE_Prof_Reset();
+	ICE_FPGA_Reg_Bench(0, 10000);
+	
+	/* profiler saw only the hardware CS reads */
+	{
+		ice_prof_t prof[ICE_PROF_NUM];
+		
+		ICE_Prof_Get(prof);
+		printf("prof reg rd: %u ops, %llu B, max %u us\n", prof[ICE_PROF_REG_RD].count,
+			(unsigned long long)prof[ICE_PROF_REG_RD].bytes, prof[ICE_PROF_REG_RD].max_us);
+		if((prof[ICE_PROF_REG_RD].count != 10000) || prof[ICE_PROF_PSRAM_RD].count)
+		{
+			printf("profiler count mismatch\n");
+			err++;
+		}
+	}
+	
+	/* register poll - a status bit that comes up 3 ms in, then one that doesn't */
+	{
+		ice_poll_t poll;
+		
+		ICE_FPGA_Serial_Write(9, 0);
+		mock_reg_at(9, 0x100, mock_now_ns() + 3000000);
+		i = ICE_FPGA_Serial_Poll(9, 0x100, 0x100, 100000, 0, &poll);
+		printf("poll: 0x%X after %u reads, %u us\n", poll.Data, poll.polls, poll.us);
+		if(i || (poll.Data != 0x100) || (poll.us < 3000) || (poll.us > 3100))
+		{
+			printf("poll didn't see the bit\n");
+			err++;
+		}
+		
+		i = ICE_FPGA_Serial_Poll(9, 0x1, 0x1, 50000, 1000, &poll);
+		printf("poll timeout: %u reads, %u us\n", poll.polls, poll.us);
+		if((i != ICE_POLL_TIMEOUT_ERR) || (poll.us < 50000) || (poll.polls > 52))
+		{
+			printf("poll timeout wrong\n");
+			err++;
+		}
+	}
+	
+	/* command script - registers, PSRAM, nested loops, a poll */
+	{
+		uint8_t s[128];
+		uint32_t len = 0, Data, lp;
+		script_result_t res;
+		
+		*(uint32_t *)s = SCRIPT_MAGIC;
+		len = 4;
+		len = script_op(s, len, SCRIPT_WRITE, 3, 1, (uint32_t[]){0x1200});
+		len = script_op(s, len, SCRIPT_RMW, 3, 2, (uint32_t[]){0xff, 0x34});
+		len = script_op(s, len, SCRIPT_PS_FILL, -1, 3, (uint32_t[]){0x10000, 5000, 0xA55A0FF0});
+		len = script_op(s, len, SCRIPT_PS_WRITE, -1, 2, (uint32_t[]){0x20001, 5});
+		memcpy(s+len, "hello", 5);
+		len += 5;
+		len = script_op(s, len, SCRIPT_LOOP, -1, 1, (uint32_t[]){3});
+		len = script_op(s, len, SCRIPT_LOOP, -1, 1, (uint32_t[]){2});
+		len = script_op(s, len, SCRIPT_DELAY, -1, 1, (uint32_t[]){100});
+		len = script_op(s, len, SCRIPT_NEXT, -1, 0, NULL);
+		len = script_op(s, len, SCRIPT_NEXT, -1, 0, NULL);
+		lp = len;
+		len = script_op(s, len, SCRIPT_POLL, 3, 3, (uint32_t[]){0xffff, 0x1234, 1000});
+		
+		i = script_exec(s, len, &res);
+		ICE_FPGA_Serial_Read(3, &Data);
+		printf("script: %u ops in %u us\n", res.ops, res.us);
+		/* 5 + loop + 3 * (loop + 2 * (delay + next) + next) + poll */
+		if(i || (Data != 0x1234) || (res.ops != 5+3*6+1) || (res.us < 600) ||
+			memcmp(mock_psram_mem() + 0x20001, "hello", 5) ||
+			(mock_psram_mem()[0x10000+4999] != 0xA5) || (mock_psram_mem()[0x10000+5000]))
+		{
+			printf("script run wrong\n");
+			err++;
+		}
+		
+		/* stops at a poll that doesn't match */
+		script_op(s, lp, SCRIPT_POLL, 3, 3, (uint32_t[]){0xffff, 0x4321, 1000});
+		if((script_exec(s, len, &res) != ICE_POLL_TIMEOUT_ERR) || (res.offset != lp))
+		{
+			printf("script poll timeout wrong\n");
+			err++;
+		}
+		
+		/* a loop without its next, then an op that runs off the end */
+		if(!script_check(s, lp-1) || !script_check(s, len-1))
+		{
+			printf("bad script accepted\n");
+			err++;
+		}
+		
+		/* runaways stop - 2M ops, then a delay past the run's limit */
+		len = 4;
+		len = script_op(s, len, SCRIPT_LOOP, -1, 1, (uint32_t[]){2000});
+		len = script_op(s, len, SCRIPT_LOOP, -1, 1, (uint32_t[]){1000});
+		len = script_op(s, len, SCRIPT_NEXT, -1, 0, NULL);
+		len = script_op(s, len, SCRIPT_NEXT, -1, 0, NULL);
+		if((script_exec(s, len, &res) != 8) || (res.ops != SCRIPT_MAX_OPS+1))
+		{
+			printf("script op limit wrong\n");
+			err++;
+		}
+		len = 4;
+		len = script_op(s, len, SCRIPT_DELAY, -1, 1, (uint32_t[]){SCRIPT_MAX_US/2});
+		len = script_op(s, len, SCRIPT_DELAY, -1, 1, (uint32_t[]){SCRIPT_MAX_US/2+1});
+		if((script_exec(s, len, &res) != 8) || (res.ops != 2) || (res.us > SCRIPT_MAX_US))
+		{
+			printf("script delay limit wrong\n");
+			err++;
+		}
+	}
+	
+	/* PSRAM fill, copies up and down over themselves, CRC */
+	{
+		uint8_t *ps = mock_psram_mem();
+		uint32_t crc;
+		uint8_t after = ps[0x200001+70001];
+		
+		for(j=0;j<100000;j++)
+			buf[j] = j*7;
+		ICE_PSRAM_Write(0x100000, buf, 100000);
+		mock_reset();
+		i = psops_fill(0x200001, 70001, 0x04030201);
+		report("psram fill");
+		if(mock_stats.interrupts)
+		{
+			printf("psram fill bursts not polled\n");
+			err++;
+		}
+		i |= psops_copy(0x100000+1000, 0x100000, 50000);
+		i |= psops_copy(0x180000, 0x100000+1000, 50000);
+		i |= psops_copy(0x100000+1000, 0x100000+3000, 40000);
+		i |= psops_crc(0x180000, 50000, &crc);
+		printf("psram ops: crc 0x%08X\n", crc);
+		if(i || (ps[0x200001] != 1) || (ps[0x200004] != 4) || (ps[0x200001+70000] != 1) ||
+			(ps[0x200001+70001] != after) || memcmp(ps+0x180000, buf, 50000) ||
+			memcmp(ps+0x100000+1000, buf+2000, 40000) ||
+			(crc != crc32_le(0, buf, 50000)))
+		{
+			printf("psram ops wrong\n");
+			err++;
+		}
+		if(!psops_fill(PSOPS_SIZE-4, 5, 0) || !psops_copy(0, PSOPS_SIZE-4, 8) ||
+			!psops_crc(PSOPS_SIZE, 1, &crc))
+		{
+			printf("psram range not checked\n");
+			err++;
+		}
+	}
+	
+	free(buf);
+	printf("%s\n", err ? "FAIL" : "PASS");
+	return err ? 1 : 0;
+}
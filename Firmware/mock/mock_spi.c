@@ -0,0 +1,403 @@
+/*
+ * mock_spi.c - simulated SPI master driver for host builds of ice.c
+ * 10-17-26
+ *
+ * Keeps a single simulated timeline shared by the CPU and the bus. Each
+ * driver call costs a fixed amount of CPU time, transactions occupy the
+ * bus for their bit count at the device clock and any time the bus sits
+ * idle between two transactions is counted as an idle gap.
+ */
+
+#include <string.h>
+#include "mock_idf.h"
+#include "mock_spi.h"
+
+/* modelled CPU costs of driver calls */
+#define MOCK_POLL_NS		4000	// polling setup + teardown
+#define MOCK_POLL_ACQ_NS	1500	// same with the bus already acquired
+#define MOCK_QUEUE_NS		6000	// queue + ISR start of next trans
+#define MOCK_RESULT_NS		3000	// ISR + task wakeup on completion
+#define MOCK_GPIO_NS		500		// gpio_set_level() through the driver
+#define MOCK_MAX_QUEUE		16
+
+/* simulated LY68L6400 behind spi_pass */
+#define MOCK_PSRAM_SZ		(8*1024*1024)
+#define MOCK_PSRAM_PAGE		1024
+#define MOCK_PSRAM_TCEM_NS	8000
+
+/* simulated spi_dual.v buffer */
+#define MOCK_DUAL_SZ		2048
+
+struct mock_spi_dev
+{
+	spi_device_interface_config_t cfg;
+	spi_transaction_t *fifo[MOCK_MAX_QUEUE];
+	uint64_t done_ns[MOCK_MAX_QUEUE];
+	int head, count;
+	bool used, acquired;
+};
+
+const spi_signal_conn_t spi_periph_signal[2] =
+{
+	{ 63, 63, 64, 65, { 68, 69, 70, 71, 72, 73 } },
+	{ 63, 63, 64, 65, { 68, 69, 70, 71, 72, 73 } },
+};
+
+mock_stats_t mock_stats;
+bool mock_dma_ok = true;
+int mock_cfg_max_hz;
+uint8_t *mock_cfg_capture;
+uint32_t mock_cfg_captured;
+uint32_t mock_unmaps;
+static struct mock_spi_dev devs[6];
+static bool cfg_bad;
+static uint64_t now_ns, bus_free_ns;
+static uint32_t levels[32];
+static uint32_t rx_count;
+static uint8_t *psram;
+static uint8_t dual[MOCK_DUAL_SZ];
+static uint32_t regs[128];
+static int reg_at = -1;
+static uint32_t reg_at_data;
+static uint64_t reg_at_ns;
+
+/*
+ * PSRAM model - linear bursts wrap within a page like the real part
+ */
+static void mock_psram(spi_transaction_t *t)
+{
+	uint32_t i, addr = t->addr & (MOCK_PSRAM_SZ-1);
+	uint32_t page = addr & ~(MOCK_PSRAM_PAGE-1);
+	
+	if(!psram)
+		psram = calloc(MOCK_PSRAM_SZ, 1);
+	
+	if(t->cmd == 0x02)
+		for(i=0;i<t->length/8;i++)
+			psram[page | ((addr+i) & (MOCK_PSRAM_PAGE-1))] = ((uint8_t *)t->tx_buffer)[i];
+	else if((t->cmd == 0x03) || (t->cmd == 0x0B))
+		for(i=0;i<t->rxlength/8;i++)
+			((uint8_t *)t->rx_buffer)[i] = psram[page | ((addr+i) & (MOCK_PSRAM_PAGE-1))];
+}
+
+/*
+ * dual I/O buffer model - every block starts at address 0
+ */
+static void mock_dual(spi_transaction_t *t)
+{
+	uint32_t i;
+	
+	if(t->cmd == 0x7F)
+		for(i=0;i<t->length/8 && i<MOCK_DUAL_SZ;i++)
+			dual[i] = ((uint8_t *)t->tx_buffer)[i];
+	else if(t->cmd == 0xFF)
+		for(i=0;i<t->rxlength/8;i++)
+			((uint8_t *)t->rx_buffer)[i] = i<MOCK_DUAL_SZ ? dual[i] : 0;
+}
+
+/*
+ * register model - a value set with mock_reg_at() lands at its time
+ */
+static void mock_reg(spi_transaction_t *t, uint64_t start)
+{
+	uint8_t Reg = t->cmd & 0x7f;
+	
+	if((reg_at >= 0) && (start >= reg_at_ns))
+	{
+		regs[reg_at] = reg_at_data;
+		reg_at = -1;
+	}
+	
+	if(t->cmd & 0x80)
+	{
+		t->rx_data[0] = regs[Reg] >> 24;
+		t->rx_data[1] = regs[Reg] >> 16;
+		t->rx_data[2] = regs[Reg] >> 8;
+		t->rx_data[3] = regs[Reg];
+	}
+	else
+		regs[Reg] = (t->tx_data[0]<<24) | (t->tx_data[1]<<16) |
+			(t->tx_data[2]<<8) | t->tx_data[3];
+}
+
+/*
+ * have register Reg read as Data from time ns on
+ */
+void mock_reg_at(uint8_t Reg, uint32_t Data, uint64_t ns)
+{
+	reg_at = Reg & 0x7f;
+	reg_at_data = Data;
+	reg_at_ns = ns;
+}
+
+/*
+ * reset counters between runs
+ */
+void mock_reset(void)
+{
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	now_ns = bus_free_ns = 0;
+}
+
+/*
+ * what the simulated slave shifts out for the n'th byte since CS fell
+ */
+uint8_t mock_rx_pattern(uint32_t n)
+{
+	return (n * 7 + 3) & 0xff;
+}
+
+/*
+ * put one transaction on the simulated bus, returns its end time
+ */
+static uint64_t mock_bus(struct mock_spi_dev *dev, spi_transaction_t *t)
+{
+	uint64_t start = now_ns > bus_free_ns ? now_ns : bus_free_ns;
+	uint64_t data = t->length + t->rxlength*(dev->cfg.flags & SPI_DEVICE_HALFDUPLEX ? 1 : 0);
+	uint64_t dummy = (t->flags & SPI_TRANS_VARIABLE_DUMMY) ?
+		((spi_transaction_ext_t *)t)->dummy_bits : dev->cfg.dummy_bits;
+	uint64_t bits, ns;
+	uint32_t i;
+	
+	/* dual mode moves two data bits per clock */
+	if(t->flags & SPI_TRANS_MODE_DIO)
+		data /= 2;
+	bits = data + dev->cfg.command_bits + dev->cfg.address_bits + dummy;
+	ns = (bits * 1000000000ULL) / dev->cfg.clock_speed_hz;
+	
+	if(mock_stats.transactions && (start > bus_free_ns))
+	{
+		mock_stats.idle_gaps++;
+		mock_stats.idle_ns += start - bus_free_ns;
+	}
+	mock_stats.transactions++;
+	mock_stats.bytes += (t->length > t->rxlength ? t->length : t->rxlength)/8;
+	
+	/* config data clocked faster than the FPGA accepts is lost */
+	if(mock_cfg_max_hz && !levels[MOCK_CS_PIN] && (dev->cfg.spics_io_num < 0) &&
+		(dev->cfg.clock_speed_hz > mock_cfg_max_hz))
+		cfg_bad = true;
+	
+	/* keep config data for checking, each pass starts over */
+	if(mock_cfg_capture && !levels[MOCK_CS_PIN] && (dev->cfg.spics_io_num < 0) && t->tx_buffer)
+	{
+		memcpy(mock_cfg_capture + mock_cfg_captured, t->tx_buffer, t->length/8);
+		mock_cfg_captured += t->length/8;
+	}
+	
+	/* simulated slave data */
+	if((dev->cfg.command_bits == 8) && (dev->cfg.address_bits == 24))
+		mock_psram(t);
+	else if(t->flags & SPI_TRANS_MODE_DIO)
+		mock_dual(t);
+	else if((dev->cfg.command_bits == 8) && !(dev->cfg.flags & SPI_DEVICE_HALFDUPLEX))
+		mock_reg(t, start);
+	else if(t->rx_buffer && !(t->flags & SPI_TRANS_USE_RXDATA))
+		for(i=0;i<t->rxlength/8;i++)
+			((uint8_t *)t->rx_buffer)[i] = mock_rx_pattern(rx_count++);
+	
+	/* hardware CS is only low for the transaction */
+	if((dev->cfg.spics_io_num >= 0) && (ns > MOCK_PSRAM_TCEM_NS))
+		mock_stats.tcem_violations++;
+	
+	bus_free_ns = start + ns;
+	return bus_free_ns;
+}
+
+uint64_t mock_now_ns(void)
+{
+	return now_ns;
+}
+
+uint8_t *mock_psram_mem(void)
+{
+	return psram;
+}
+
+spi_device_handle_t mock_dev(int n)
+{
+	return &devs[n];
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma)
+{
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle)
+{
+	struct mock_spi_dev *dev = devs;
+	
+	/* first free slot, like the real driver */
+	while(dev->used)
+		dev++;
+	assert(dev < &devs[6]);
+	memset(dev, 0, sizeof(*dev));
+	dev->cfg = *cfg;
+	dev->used = true;
+	*handle = dev;
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t dev)
+{
+	assert(dev->count == 0);
+	dev->used = false;
+	mock_stats.removes++;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t dev, spi_transaction_t *t, TickType_t wait)
+{
+	int idx;
+	
+	assert(dev->count < dev->cfg.queue_size);
+	now_ns += MOCK_QUEUE_NS;
+	idx = (dev->head + dev->count) % MOCK_MAX_QUEUE;
+	dev->fifo[idx] = t;
+	dev->done_ns[idx] = mock_bus(dev, t);
+	dev->count++;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t dev, spi_transaction_t **t, TickType_t wait)
+{
+	assert(dev->count);
+	
+	/* CPU is free for other tasks until the transaction is done */
+	if(dev->done_ns[dev->head] > now_ns)
+	{
+		mock_stats.cpu_free_ns += dev->done_ns[dev->head] - now_ns;
+		now_ns = dev->done_ns[dev->head];
+	}
+	now_ns += MOCK_RESULT_NS;
+	mock_stats.interrupts++;
+	
+	*t = dev->fifo[dev->head];
+	dev->head = (dev->head + 1) % MOCK_MAX_QUEUE;
+	dev->count--;
+	return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t dev, spi_transaction_t *t)
+{
+	assert(dev->count == 0);
+	now_ns += dev->acquired ? MOCK_POLL_ACQ_NS : MOCK_POLL_NS;
+	now_ns = mock_bus(dev, t);
+	return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t dev, TickType_t wait)
+{
+	assert(!dev->acquired && (dev->count == 0));
+	dev->acquired = true;
+	return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t dev)
+{
+	assert(dev->acquired);
+	dev->acquired = false;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t dev, spi_transaction_t *t)
+{
+	spi_transaction_t *rt;
+	
+	spi_device_queue_trans(dev, t, portMAX_DELAY);
+	return spi_device_get_trans_result(dev, &rt, portMAX_DELAY);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	return malloc(size);
+}
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+	int i;
+	
+	crc = ~crc;
+	while(len--)
+	{
+		crc ^= *buf++;
+		for(i=0;i<8;i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	return 256*1024;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+	mock_unmaps++;
+}
+
+bool esp_ptr_dma_capable(const void *p)
+{
+	return mock_dma_ok;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+	/* slave data restarts with every CS cycle */
+	if((gpio_num == MOCK_CS_PIN) && level)
+		rx_count = 0;
+	if((gpio_num == MOCK_CRST_PIN) && !level)
+	{
+		cfg_bad = false;
+		mock_cfg_captured = 0;
+	}
+	levels[gpio_num] = level;
+	now_ns += MOCK_GPIO_NS;
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+	/* CDONE follows CRST unless config data was clocked too fast */
+	if(gpio_num == MOCK_CDONE_PIN)
+		return levels[MOCK_CRST_PIN] && !cfg_bad;
+	return levels[gpio_num];
+}
+
+void esp_rom_gpio_pad_select_gpio(uint32_t iopad_num)
+{
+}
+
+void esp_rom_gpio_connect_out_signal(uint32_t gpio_num, uint32_t signal_idx, bool out_inv, bool oen_inv)
+{
+}
+
+void esp_rom_gpio_connect_in_signal(uint32_t gpio_num, uint32_t signal_idx, bool inv)
+{
+}
+
+void ets_delay_us(uint32_t us)
+{
+	now_ns += 1000ULL * us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return now_ns / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	now_ns += 1000000ULL * portTICK_PERIOD_MS * ticks;
+}
@@ -0,0 +1,42 @@
+/*
+ * mock_spi.h - simulated SPI master driver for host builds of ice.c
+ * 10-17-26
+ */
+
+#ifndef __MOCK_SPI__
+#define __MOCK_SPI__
+
+#include "mock_idf.h"
+
+/* must match the pins in ice.c */
+#define MOCK_CS_PIN		6
+#define MOCK_CDONE_PIN	0
+#define MOCK_CRST_PIN	1
+
+typedef struct
+{
+	uint32_t transactions;
+	uint32_t idle_gaps;
+	uint64_t idle_ns;
+	uint64_t bytes;
+	uint64_t cpu_free_ns;
+	uint32_t interrupts;
+	uint32_t tcem_violations;
+	uint32_t removes;
+} mock_stats_t;
+
+extern mock_stats_t mock_stats;
+extern bool mock_dma_ok;
+extern int mock_cfg_max_hz;
+extern uint8_t *mock_cfg_capture;
+extern uint32_t mock_cfg_captured;
+extern uint32_t mock_unmaps;
+
+void mock_reset(void);
+uint64_t mock_now_ns(void);
+uint8_t mock_rx_pattern(uint32_t n);
+spi_device_handle_t mock_dev(int n);
+uint8_t *mock_psram_mem(void);
+void mock_reg_at(uint8_t Reg, uint32_t Data, uint64_t ns);
+
+#endif
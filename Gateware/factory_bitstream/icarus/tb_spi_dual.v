@@ -0,0 +1,130 @@
+// tb_spi_dual.v - testbench for dual I/O SPI bulk path
+// 10-17-26
+
+`timescale 1ns/1ps
+`default_nettype none
+
+module tb_spi_dual;
+	reg reset;
+	reg sclk, csl;
+	reg m_io0, m_io1, m_oe;
+	wire s_io0, s_io1, s_oe, s_wr, s_rd;
+	integer i, j, errs;
+	reg [7:0] tx[0:255];
+	reg [7:0] rx;
+	
+	// 20MHz SPI clock like the ESP32C3 driver
+	localparam HP = 25;
+	
+	// bus: master drives both lines in write, slave drives in read
+	wire io0 = m_oe ? m_io0 : (s_oe ? s_io0 : 1'bz);
+	wire io1 = m_oe ? m_io1 : (s_oe ? s_io1 : 1'bz);
+	
+	// single-bit command byte on io0, mode 0
+	task cmd_byte(input [7:0] c);
+		integer k;
+		begin
+			for(k=7;k>=0;k=k-1)
+			begin
+				m_io0 = c[k];
+				#HP sclk = 1'b1;
+				#HP sclk = 1'b0;
+			end
+		end
+	endtask
+	
+	// one byte as four bit pairs {io1,io0}, MSB first
+	task dual_out(input [7:0] d);
+		integer k;
+		begin
+			for(k=3;k>=0;k=k-1)
+			begin
+				{m_io1, m_io0} = d[2*k+1 -: 2];
+				#HP sclk = 1'b1;
+				#HP sclk = 1'b0;
+			end
+		end
+	endtask
+	
+	// sample four pairs on rising edges
+	task dual_in(output [7:0] d);
+		integer k;
+		begin
+			for(k=3;k>=0;k=k-1)
+			begin
+				#HP sclk = 1'b1;
+				d[2*k+1 -: 2] = {io1, io0};
+				#HP sclk = 1'b0;
+			end
+		end
+	endtask
+	
+	initial
+	begin
+`ifdef icarus
+		$dumpfile("tb_spi_dual.vcd");
+		$dumpvars;
+`endif
+		reset = 1'b1;
+		sclk = 1'b0;
+		csl = 1'b1;
+		m_io0 = 1'b0;
+		m_io1 = 1'b0;
+		m_oe = 1'b1;
+		errs = 0;
+		for(i=0;i<256;i=i+1)
+			tx[i] = (i*37+11) & 8'hff;
+		
+		#100 reset = 1'b0;
+		
+		// dual write
+		#100 csl = 1'b0;
+		#HP cmd_byte(8'h7F);
+		for(i=0;i<256;i=i+1)
+			dual_out(tx[i]);
+		#HP csl = 1'b1;
+		
+		// dual read: command, 8 turnaround clocks, then data
+		#200 csl = 1'b0;
+		#HP cmd_byte(8'hFF);
+		m_oe = 1'b0;
+		for(j=0;j<8;j=j+1)
+		begin
+			#HP sclk = 1'b1;
+			#HP sclk = 1'b0;
+		end
+		for(i=0;i<256;i=i+1)
+		begin
+			dual_in(rx);
+			if(rx !== tx[i])
+			begin
+				if(errs < 8)
+					$display("mismatch @ %0d: got %02X expected %02X", i, rx, tx[i]);
+				errs = errs + 1;
+			end
+		end
+		#HP csl = 1'b1;
+		m_oe = 1'b1;
+		
+		// pads must be released once CS is high
+		#HP if(s_oe | s_wr | s_rd)
+		begin
+			$display("pads still driven after CS high");
+			errs = errs + 1;
+		end
+		
+		if(errs == 0)
+			$display("PASS");
+		else
+			$display("FAIL: %0d errors", errs);
+		$finish;
+	end
+	
+	// Unit under test
+	spi_dual
+		uut(.reset(reset),
+			.spiclk(sclk), .spicsl(csl),
+			.io0_in(io0), .io1_in(io1),
+			.io0_out(s_io0), .io1_out(s_io1),
+			.io_oe(s_oe), .wr(s_wr), .rd(s_rd));
+endmodule
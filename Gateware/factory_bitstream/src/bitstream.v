@@ -38,8 +38,8 @@ module bitstream(
 	
 	// SPI slave port
 	input SPI_CSL,
-	input SPI_MOSI,
-	output SPI_MISO,
+	inout SPI_MOSI,
+	inout SPI_MISO,
 	input SPI_SCLK
 );
 	// This should be unique so firmware knows who it's talking to
@@ -120,12 +120,62 @@ module bitstream(
 	reg [31:0] rdat;
 	wire [6:0] addr;
 	wire re, we;
+	wire mosi_in, miso_in, miso_slv;
 	spi_slave
 		uspi(.clk(clk), .reset(reset),
-			.spiclk(SPI_SCLK), .spimosi(SPI_MOSI),
-			.spimiso(SPI_MISO), .spicsl(SPI_CSL),
+			.spiclk(SPI_SCLK), .spimosi(mosi_in),
+			.spimiso(miso_slv), .spicsl(SPI_CSL),
 			.we(we), .re(re), .wdat(wdat), .addr(addr), .rdat(rdat));
 	
+	//------------------------------
+	// Dual I/O bulk path shares the SPI pins
+	//------------------------------
+	wire dual_io0, dual_io1, dual_oe, dual_wr, dual_rd;
+	spi_dual
+		udual(.reset(reset),
+			.spiclk(SPI_SCLK), .spicsl(SPI_CSL),
+			.io0_in(mosi_in), .io1_in(miso_in),
+			.io0_out(dual_io0), .io1_out(dual_io1),
+			.io_oe(dual_oe), .wr(dual_wr), .rd(dual_rd));
+	
+	// MOSI is only driven during dual reads
+	SB_IO #(
+		.PIN_TYPE(6'b101001),
+		.PULLUP(1'b1),
+		.NEG_TRIGGER(1'b0),
+		.IO_STANDARD("SB_LVCMOS")
+	) umosi_io (
+		.PACKAGE_PIN(SPI_MOSI),
+		.LATCH_INPUT_VALUE(1'b0),
+		.CLOCK_ENABLE(1'b0),
+		.INPUT_CLK(1'b0),
+		.OUTPUT_CLK(1'b0),
+		.OUTPUT_ENABLE(dual_oe),
+		.D_OUT_0(dual_io0),
+		.D_OUT_1(1'b0),
+		.D_IN_0(mosi_in),
+		.D_IN_1()
+	);
+	
+	// MISO is released while the ESP32 drives it during dual writes
+	SB_IO #(
+		.PIN_TYPE(6'b101001),
+		.PULLUP(1'b1),
+		.NEG_TRIGGER(1'b0),
+		.IO_STANDARD("SB_LVCMOS")
+	) umiso_io (
+		.PACKAGE_PIN(SPI_MISO),
+		.LATCH_INPUT_VALUE(1'b0),
+		.CLOCK_ENABLE(1'b0),
+		.INPUT_CLK(1'b0),
+		.OUTPUT_CLK(1'b0),
+		.OUTPUT_ENABLE(~dual_wr),
+		.D_OUT_0(dual_rd ? dual_io1 : miso_slv),
+		.D_OUT_1(1'b0),
+		.D_IN_0(miso_in),
+		.D_IN_1()
+	);
+	
 	//------------------------------
 	// Writeable registers
 	//------------------------------
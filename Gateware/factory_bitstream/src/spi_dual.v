@@ -0,0 +1,128 @@
+// spi_dual.v: dual I/O bulk transfer path for the ESP32C3 SPI port
+// 10-17-26
+//
+// Runs alongside spi_slave on the same four wires and moves bulk data
+// two bits per clock into/out of a 2kB buffer. These SPI parameters
+// are used in this module:
+//   CPOL = 0 (spiclk idles low)
+//   CPHA = 0 (data sampled on rising edge, shifted on falling edge)
+//
+// A transfer starts with an 8-bit command sent single-bit on MOSI:
+//   8'h7F - dual write: data follows immediately, 2 bits/clock
+//   8'hFF - dual read:  8 turnaround clocks, then data 2 bits/clock
+// Each pair is {MISO, MOSI} = {IO1, IO0}, MSB first. The buffer address
+// restarts at 0 every time CS falls. Any other command is ignored here
+// and handled by spi_slave (these two are register 0x7F, which must not
+// be used for a CSR).
+//
+// The buffer is a loopback scratch with no port into the fabric - what's
+// written is only ever read back over SPI, for link tests and throughput
+// benchmarks. Getting the data into a design's logic would need a second
+// EBR and a clock crossing, since each EBR has just one read and one
+// write port and both are used here in the SPI clock domain.
+
+`timescale 1 ns/1 ps
+`default_nettype none
+
+module spi_dual #(
+	parameter asz = 11				// buffer address size
+)
+(
+	input reset,					// System POR
+	input spiclk,					// SPI Clock
+	input spicsl,					// SPI Chip Select Low
+	input io0_in,					// MOSI pad input
+	input io1_in,					// MISO pad input
+	output io0_out,					// MOSI pad output
+	output io1_out,					// MISO pad output
+	output reg io_oe,				// drive both pads (read data)
+	output reg wr,					// dual write - release MISO pad
+	output reg rd					// dual read - MISO from this module
+);
+	localparam CMD_WR = 8'h7F;
+	localparam CMD_RD = 8'hFF;
+
+	// buffer in the SPI clock domain
+	reg [7:0] mem[(1<<asz)-1:0];
+	
+	// SPI Posedge Process
+	reg [4:0] cnt;					// clock counter, saturates at 16
+	reg [6:0] cmd;					// command shift reg
+	reg [5:0] wshift;				// write data shift reg
+	reg [1:0] wpair;				// pairs in current byte
+	reg [asz-1:0] waddr;			// write address
+	reg [asz-1:0] raddr;			// read address
+	reg [7:0] rdat;					// read data prefetch
+	reg [7:0] oshift;				// outgoing shift reg
+	reg [1:0] opair;				// pairs in current byte
+	wire spi_reset = reset | spicsl;	// combined reset
+	always @(posedge spiclk or posedge spi_reset)
+		if(spi_reset)
+		begin
+			cnt <= 5'd0;
+			cmd <= 7'h00;
+			wr <= 1'b0;
+			rd <= 1'b0;
+			wpair <= 2'b00;
+			waddr <= {asz{1'b0}};
+		end
+		else
+		begin
+			if(cnt != 5'd16)
+				cnt <= cnt + 5'd1;
+			
+			// single-bit command
+			if(cnt < 5'd7)
+				cmd <= {cmd[5:0], io0_in};
+			
+			// decode
+			if(cnt == 5'd7)
+			begin
+				wr <= ({cmd, io0_in} == CMD_WR);
+				rd <= ({cmd, io0_in} == CMD_RD);
+			end
+			
+			// dual write data
+			if(wr)
+			begin
+				wshift <= {wshift[3:0], io1_in, io0_in};
+				wpair <= wpair + 2'b01;
+				if(wpair == 2'b11)
+				begin
+					mem[waddr] <= {wshift, io1_in, io0_in};
+					waddr <= waddr + 1;
+				end
+			end
+		end
+	
+	// read prefetch on every rising edge
+	always @(posedge spiclk)
+		rdat <= mem[raddr];
+	
+	// outgoing shift register is clocked on falling edge
+	always @(negedge spiclk or posedge spi_reset)
+		if(spi_reset)
+		begin
+			oshift <= 8'h00;
+			opair <= 2'b00;
+			raddr <= {asz{1'b0}};
+			io_oe <= 1'b0;
+		end
+		else if(rd && (cnt == 5'd16))
+		begin
+			// turnaround done - drive from the first data falling edge
+			io_oe <= 1'b1;
+			opair <= opair + 2'b01;
+			if(opair == 2'b00)
+			begin
+				oshift <= rdat;
+				raddr <= raddr + 1;
+			end
+			else
+				oshift <= {oshift[5:0], 2'b00};
+		end
+	
+	// pads are the top two bits of the shift reg
+	assign io1_out = oshift[7];
+	assign io0_out = oshift[6];
+endmodule
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# compress an FPGA bitstream into the firmware's cfgz container
+# 10-17-26
+
+import sys
+import zlib
+
+CFGZ_MAGIC = 0x5A454349     # "ICEZ"
+CFGZ_WIN = 4096             # must match firmware
+MIN_MATCH = 3
+MAX_MATCH = MIN_MATCH + 15 + 255
+MAX_CHAIN = 64
+
+# check for a container header
+def is_cfgz(data):
+    return len(data) >= 16 and \
+        int.from_bytes(data[0:4], byteorder='little') == CFGZ_MAGIC
+
+# length of the common run at a and b, up to lim. Slices compare in C
+# so a binary search beats stepping a byte at a time
+def match_len(data, a, b, lim):
+    if data[a:a+lim] == data[b:b+lim]:
+        return lim
+    lo, hi = 0, lim
+    while hi - lo > 1:
+        mid = (lo + hi) // 2
+        if data[a:a+mid] == data[b:b+mid]:
+            lo = mid
+        else:
+            hi = mid
+    return lo
+
+# LZSS encode - greedy longest match over a 4kB window
+def lzss(data):
+    data = bytes(data)
+    out = bytearray()
+    heads = {}
+    pos = 0
+    n = len(data)
+    while pos < n:
+        # flag byte then up to 8 items
+        flagpos = len(out)
+        out.append(0)
+        for bit in range(8):
+            if pos >= n:
+                break
+            
+            # search previous occurrences of the next 3 bytes
+            best_len = 0
+            best_dist = 0
+            key = data[pos:pos+MIN_MATCH]
+            if len(key) == MIN_MATCH:
+                lim = min(MAX_MATCH, n - pos)
+                for cand in reversed(heads.get(key, [])):
+                    dist = pos - cand
+                    if dist > CFGZ_WIN:
+                        break
+                    # can't beat the best unless the next byte matches too
+                    if best_len and data[cand+best_len] != data[pos+best_len]:
+                        continue
+                    ml = match_len(data, cand, pos, lim)
+                    if ml > best_len:
+                        best_len = ml
+                        best_dist = dist
+                        if ml == lim:
+                            break
+            
+            if best_len >= MIN_MATCH:
+                d = best_dist - 1
+                l = best_len - MIN_MATCH
+                out.append(d & 0xff)
+                if l >= 15:
+                    out.append(((d >> 4) & 0xf0) | 15)
+                    out.append(l - 15)
+                else:
+                    out.append(((d >> 4) & 0xf0) | l)
+                step = best_len
+            else:
+                out[flagpos] |= 1 << bit
+                out.append(data[pos])
+                step = 1
+            
+            # index the bytes just covered, keeping the chains short
+            for p in range(pos, min(pos + step, n - MIN_MATCH + 1)):
+                chain = heads.setdefault(data[p:p+MIN_MATCH], [])
+                chain.append(p)
+                if len(chain) > 2 * MAX_CHAIN:
+                    del chain[:-MAX_CHAIN]
+            pos += step
+    return bytes(out)
+
+# build the container: magic, raw length, raw CRC32, stream length, stream
+def compress(data):
+    z = lzss(data)
+    hdr = b"".join([CFGZ_MAGIC.to_bytes(4, byteorder='little'), \
+                    len(data).to_bytes(4, byteorder='little'), \
+                    (zlib.crc32(data) & 0xffffffff).to_bytes(4, byteorder='little'), \
+                    len(z).to_bytes(4, byteorder='little')])
+    return hdr + z
+
+# reference decoder for checking the output
+def decompress(cont):
+    rawlen = int.from_bytes(cont[4:8], byteorder='little')
+    z = cont[16:]
+    out = bytearray()
+    ip = 0
+    while len(out) < rawlen:
+        flags = z[ip]
+        ip += 1
+        for bit in range(8):
+            if len(out) >= rawlen:
+                break
+            if flags & (1 << bit):
+                out.append(z[ip])
+                ip += 1
+            else:
+                b0 = z[ip]
+                b1 = z[ip+1]
+                ip += 2
+                dist = (((b1 & 0xf0) << 4) | b0) + 1
+                l = (b1 & 0x0f) + MIN_MATCH
+                if (b1 & 0x0f) == 15:
+                    l += z[ip]
+                    ip += 1
+                for i in range(l):
+                    out.append(out[-dist])
+    return bytes(out)
+
+# command line: compress <in> to <out>
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print(sys.argv[0], "<bitstream> <compressed> : compress a bitstream for the ICE-V")
+        sys.exit(2)
+    with open(sys.argv[1], "rb") as file:
+        raw = file.read()
+    cont = compress(raw)
+    if decompress(cont) != raw:
+        print("self-check failed")
+        sys.exit(1)
+    with open(sys.argv[2], "wb") as file:
+        file.write(cont)
+    print("%d -> %d bytes, ratio %.2f" % (len(raw), len(cont), len(raw)/len(cont)))
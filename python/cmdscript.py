@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# command scripts run by the firmware - text to binary
+# 10-17-26
+
+import os
+import sys
+import getopt
+
+EXT_SCRIPT_SAVE = 11    # extended opcodes
+EXT_SCRIPT_RUN = 12
+EXT_SCRIPT_STOP = 21
+MAGIC = 0x53454349      # "ICES"
+NAME_MAX = 31
+
+# op word: opcode, register argument or not, word argument count
+OPS = {
+    "end":   (0, False, 0),     # end
+    "w":     (1, True, 1),      # w REG DATA
+    "m":     (2, True, 2),      # m REG MASK DATA
+    "pw":    (3, False, 1),     # pw ADDR <file> - PSRAM from a host file
+    "pf":    (4, False, 3),     # pf ADDR LEN PATTERN - PSRAM filled with a word
+    "load":  (5, False, 0),     # load <name> - SPIFFS bitstream
+    "delay": (6, False, 1),     # delay US
+    "poll":  (7, True, 3),      # poll REG MASK VAL TIMEOUT_US - stops if no match
+    "loop":  (8, False, 1),     # loop COUNT - up to the matching next
+    "next":  (9, False, 0),     # next
+}
+
+def word(v):
+    return (v & 0xFFFFFFFF).to_bytes(4, byteorder='little')
+
+# turn a script file into what the firmware runs. Files for pw are relative
+# to the script. Raises ValueError naming the bad line
+def assemble(name):
+    body = bytearray(word(MAGIC))
+    depth = 0
+    with open(name, "r") as file:
+        for num, line in enumerate(file, 1):
+            tok = line.split("#")[0].split()
+            if not len(tok):
+                continue
+            try:
+                opcode, has_reg, nwords = OPS[tok[0]]
+                args = tok[1:]
+                if tok[0] == "load":
+                    if len(args) != 1 or not 0 < len(args[0]) <= NAME_MAX:
+                        raise ValueError
+                    body += bytes([opcode, len(args[0])]) + args[0].encode()
+                    continue
+                if tok[0] == "pw":
+                    if len(args) != 2:
+                        raise ValueError
+                    with open(os.path.join(os.path.dirname(name), args[1]), "rb") as data:
+                        data = data.read()
+                    body += bytes([opcode]) + word(int(args[0], 0)) + word(len(data)) + data
+                    continue
+                if len(args) != has_reg + nwords:
+                    raise ValueError
+                vals = [int(a, 0) for a in args]
+                body.append(opcode)
+                if has_reg:
+                    body.append(vals.pop(0) & 0x7f)
+                for v in vals:
+                    body += word(v)
+                if tok[0] == "loop":
+                    if vals[0] < 1:
+                        raise ValueError
+                    depth += 1
+                elif tok[0] == "next":
+                    if not depth:
+                        raise ValueError
+                    depth -= 1
+            except (KeyError, ValueError, OSError) as e:
+                raise ValueError("%s line %d: %s" % (name, num, line.strip())) from e
+    if depth:
+        raise ValueError("%s: loop without next" % name)
+    return bytes(body)
+
+# run reply words: ops run, us taken, offset where it stopped
+def parse_result(data):
+    if len(data) < 12:
+        return None
+    return [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(3)]
+
+# usage text for command line
+def usage():
+    print(sys.argv[0], " [options] <file> assemble a command script")
+    print("  -h, --help              : this message")
+    print("  -o, --output=<file>     : write the binary to <file> (default stdout)")
+
+# main entry - assemble to a file, eg to put in the SPIFFS image
+if __name__ == "__main__":
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "ho:", ["help", "output="])
+    except getopt.GetoptError as err:
+        print(err)
+        usage()
+        sys.exit(2)
+
+    output = None
+    for o, a in opts:
+        if o in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif o in ("-o", "--output"):
+            output = a
+
+    if len(args) < 1:
+        print("missing filename")
+        sys.exit(2)
+    try:
+        body = assemble(args[0])
+    except ValueError as e:
+        print("Bad script:", e)
+        sys.exit(1)
+    if output:
+        with open(output, "wb") as file:
+            file.write(body)
+    else:
+        sys.stdout.buffer.write(body)
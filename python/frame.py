@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# COBS framed binary replies from the firmware's USB interface
+# 10-17-26
+
+import zlib
+
+FRAME_STATUS = 0x01     # error byte, 32-bit data
+FRAME_DATA = 0x02       # block of reply data
+FRAME_END = 0x03        # no more data frames
+FRAME_TEXT = 0x04       # error byte, text
+FRAME_BAD = 0xFF        # returned for a frame that failed to decode
+
+# COBS encode - no zero bytes in the result
+def cobs_encode(data):
+    out = bytearray([0])
+    code = 0
+    for b in data:
+        if b:
+            out.append(b)
+            if len(out) - code == 0xff:
+                out[code] = 0xff
+                code = len(out)
+                out.append(0)
+        else:
+            out[code] = len(out) - code
+            code = len(out)
+            out.append(0)
+    out[code] = len(out) - code
+    return bytes(out)
+
+# COBS decode, None if malformed
+def cobs_decode(data):
+    out = bytearray()
+    idx = 0
+    while idx < len(data):
+        code = data[idx]
+        if code == 0 or idx + code > len(data):
+            return None
+        out += data[idx+1:idx+code]
+        idx += code
+        if code < 0xff and idx < len(data):
+            out.append(0)
+    return bytes(out)
+
+# build a frame as the firmware does, including the trailing zero
+def encode(ftype, body):
+    raw = bytes([ftype]) + len(body).to_bytes(2, byteorder='little') + body
+    raw += zlib.crc32(raw).to_bytes(4, byteorder='little')
+    return cobs_encode(raw) + b"\x00"
+
+# check a frame without its trailing zero, returns type and body
+def decode(data):
+    raw = cobs_decode(data)
+    if raw is None or len(raw) < 7:
+        return FRAME_BAD, b""
+    blen = int.from_bytes(raw[1:3], byteorder='little')
+    crc = int.from_bytes(raw[-4:], byteorder='little')
+    if len(raw) != blen + 7 or zlib.crc32(raw[:-4]) != crc:
+        return FRAME_BAD, b""
+    return raw[0], raw[3:-4]
+
+# read and decode the next frame from a serial port
+def recv(tty):
+    data = tty.read_until(b"\x00")
+    if not data.endswith(b"\x00"):
+        return FRAME_BAD, b""
+    return decode(data[:-1])
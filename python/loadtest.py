@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# multi-client load test for the ICE-V Wireless socket server
+# 10-17-26
+
+import sys
+import getopt
+import threading
+import time
+import session
+
+# one client hammering the server with a single kind of command
+class Client(threading.Thread):
+    def __init__(self, name, addr, port, work, until):
+        super().__init__()
+        self.name = name
+        self.addr = addr
+        self.port = port
+        self.work = work
+        self.until = until
+        self.lat = []
+        self.nbytes = 0
+        self.errors = 0
+
+    def run(self):
+        try:
+            with session.Session(self.addr, self.port, depth=1) as s:
+                while time.time() < self.until:
+                    start = time.time()
+                    err, data, body = self.work(s)
+                    self.lat.append(time.time() - start)
+                    self.nbytes += len(body)
+                    if err:
+                        self.errors += 1
+        except (OSError, ConnectionError) as e:
+            print(self.name, "failed:", e, file=sys.stderr)
+            self.errors += 1
+
+# the kinds of client
+def reg_work(s):
+    return s.result(s.read_reg(0))
+
+def vbat_work(s):
+    return s.call(2, (0).to_bytes(4, byteorder='little'))
+
+def psram_work(dlen):
+    return lambda s: s.result(s.psram_read(0, dlen))
+
+def pct(lat, p):
+    lat = sorted(lat)
+    return 1000 * lat[min(len(lat) - 1, int(p * len(lat)))] if lat else 0
+
+# usage text for command line
+def usage():
+    print(sys.argv[0], " [options] run several clients at once against the socket server")
+    print("  -h, --help              : this message")
+    print("  -a, --address=ip_addr   : address of ESP32C3 (default ICE-V.local)")
+    print("  -p, --port=portnum      : port of server (default 3333)")
+    print("  -t, --time=SECS         : how long to run (default 10)")
+    print("      --bulk=N            : number of PSRAM readers (default 1)")
+    print("      --monitor=N         : number of register/Vbat readers (default 2)")
+    print("      --len=LEN           : PSRAM read size (default 1048576)")
+
+# main entry
+if __name__ == "__main__":
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "ha:p:t:", \
+            ["help", "address=", "port=", "time=", "bulk=", "monitor=", "len="])
+    except getopt.GetoptError as err:
+        print(err)
+        usage()
+        sys.exit(2)
+
+    # defaults
+    addr = "ICE-V.local"
+    port = 3333
+    secs = 10.0
+    bulk = 1
+    monitor = 2
+    dlen = 1048576
+
+    for o, a in opts:
+        if o in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif o in ("-a", "--address"):
+            addr = a
+        elif o in ("-p", "--port"):
+            port = int(a)
+        elif o in ("-t", "--time"):
+            secs = float(a)
+        elif o == "--bulk":
+            bulk = int(a)
+        elif o == "--monitor":
+            monitor = int(a)
+        elif o == "--len":
+            dlen = int(a)
+
+    # the server serves a few clients at once, more wait their turn
+    until = time.time() + secs
+    clients = [Client("psram%d" % i, addr, port, psram_work(dlen), until) \
+               for i in range(bulk)]
+    clients += [Client(("reg%d" if i % 2 == 0 else "vbat%d") % i, addr, port, \
+                       reg_work if i % 2 == 0 else vbat_work, until) \
+                for i in range(monitor)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+
+    print("%-8s %8s %10s %9s %9s %6s" % \
+          ("client", "ops", "ops/s", "p50 ms", "p99 ms", "errs"))
+    for c in clients:
+        print("%-8s %8d %10.1f %9.2f %9.2f %6d" % \
+              (c.name, len(c.lat), len(c.lat) / secs, pct(c.lat, 0.5), \
+               pct(c.lat, 0.99), c.errors), end="")
+        if c.nbytes:
+            print("  %.1f kB/s" % (c.nbytes / secs / 1024), end="")
+        print()
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# register op vectors - many register accesses in one extended command
+# 10-17-26
+
+EXT_REG_VEC = 6     # extended opcodes
+EXT_REG_POLL = 10
+POLL_TIMEOUT = 0x40 # error bit when a poll doesn't match in time
+
+# op letter: type byte, argument count
+OPS = {
+    "r": (0, 0),    # read REG
+    "w": (1, 1),    # write REG DATA
+    "m": (2, 2),    # read-modify-write REG MASK DATA
+    "s": (3, 1),    # set bits REG BITS
+    "c": (4, 1),    # clear bits REG BITS
+}
+
+# ops are tuples of letter, register and arguments, eg ("m", 4, 0xff, 0x12)
+def encode(ops):
+    body = b""
+    for op in ops:
+        typ, nargs = OPS[op[0]]
+        if len(op) != 2 + nargs:
+            raise ValueError("%s takes %d arguments" % (op[0], nargs + 1))
+        body += bytes([typ, op[1] & 0x7f])
+        for arg in op[2:]:
+            body += (arg & 0xFFFFFFFF).to_bytes(4, byteorder='little')
+    return body
+
+# pair up the reply words with the registers read
+def decode(ops, data):
+    regs = [op[1] for op in ops if op[0] == "r"]
+    return [(reg, int.from_bytes(data[4*i:4*i+4], byteorder='little')) \
+            for i, reg in enumerate(regs)]
+
+# read a script file, one op per line as "LETTER REG [ARGS]" with # starting
+# a comment. Returns the ops or None if a line is bad
+def parse_script(name):
+    ops = []
+    with open(name, "r") as file:
+        for line in file:
+            tok = line.split("#")[0].split()
+            if not len(tok):
+                continue
+            if tok[0] not in OPS or len(tok) != 2 + OPS[tok[0]][1]:
+                print("Bad line:", line.strip())
+                return None
+            ops.append((tok[0],) + tuple(int(t, 0) for t in tok[1:]))
+    return ops
+
+# arguments for a poll of reg until (value & mask) == expect, reading every
+# interval_us (0 = back to back) for up to timeout_us
+def poll_args(reg, mask, expect, timeout_us, interval_us=0):
+    return b"".join([(v & 0xFFFFFFFF).to_bytes(4, byteorder='little') \
+                     for v in (reg, mask, expect, timeout_us, interval_us)])
+
+# poll reply words: last value, reads made, microseconds taken
+def poll_result(data):
+    if len(data) < 12:
+        return None
+    return [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(3)]
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# register sampler - registers read by the firmware at a fixed rate
+# 10-17-26
+
+import sys
+
+EXT_SAMPLE_START = 14   # extended opcodes
+EXT_SAMPLE_STOP = 15
+EXT_SAMPLE_STATS = 16
+EXT_SAMPLE_READ = 17
+PORT = 3336             # samples stream to whoever connects here
+MAGIC = 0xCAFE5A70      # batch header
+MAX_REGS = 16
+MIN_US = 100
+
+STATS = ("running", "period_us", "nregs", "samples", "overflow", "missed", \
+         "queued", "mean_us", "max_us", "max_hz")
+
+def words(data, n, at=0):
+    return [int.from_bytes(data[at+4*i:at+4*i+4], byteorder='little') for i in range(n)]
+
+# start arguments for sampling regs hz times a second
+def start_args(hz, regs):
+    period = int(round(1e6 / hz))
+    if not 0 < len(regs) <= MAX_REGS or period < MIN_US:
+        raise ValueError("1 to %d registers, up to %d Hz" % (MAX_REGS, 1000000 // MIN_US))
+    return period.to_bytes(4, byteorder='little') + bytes([r & 0x7f for r in regs])
+
+# stats reply as a dict
+def parse_stats(data):
+    if len(data) < 4*len(STATS):
+        return None
+    return dict(zip(STATS, words(data, len(STATS))))
+
+def print_stats(st, file=sys.stdout):
+    print("%s, %d registers every %d us" % ("Running" if st["running"] else "Stopped", \
+          st["nregs"], st["period_us"]), file=file)
+    print("%d samples, %d lost to a full ring, %d periods missed, %d waiting" % \
+          (st["samples"], st["overflow"], st["missed"], st["queued"]), file=file)
+    print("%d us per sample (worst %d), up to %d samples/s" % \
+          (st["mean_us"], st["max_us"], st["max_hz"]), file=file)
+
+# split whole batches off the front of buf. Returns the samples as lists of
+# sequence number, us since the start and register values, the latest
+# overflow count (None if there was no batch) and what's left of buf.
+# Raises ValueError if the stream is out of step
+def parse_batches(buf):
+    samples = []
+    overflow = None
+    while len(buf) >= 16:
+        magic, count, nregs, ovf = words(buf, 4)
+        if magic != MAGIC:
+            raise ValueError("bad batch header 0x%08X" % magic)
+        recsz = 4 * (2 + nregs)
+        if len(buf) < 16 + count * recsz:
+            break
+        for i in range(count):
+            samples.append(words(buf, 2 + nregs, 16 + i * recsz))
+        overflow = ovf
+        buf = buf[16 + count * recsz:]
+    return samples, overflow, buf
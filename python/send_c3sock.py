@@ -6,34 +6,140 @@ import sys
 import os
 import socket
 import getopt
+import cfgz
+import zlib
+import time
+import regvec
+import cmdscript
+import timedq
+import sampler
+import session
+import upload
 
-# convert a command nybble into a 32-bit magic value for the header
-def make_magic(cmmd):
-    return bytearray([0xE0+cmmd, 0xBE, 0xFE, 0xCA])
+# send long payloads as resumable chunks
+chunked = False
 
-# send a file for direct load to FPGA or write to SPIFFS
-def send_file(name, cmmd, addr, port):
-    # open file as binary
+# compress long payloads on the wire, the firmware unpacks as they arrive
+zwire = False
+
+# convert a command nybble into a 32-bit magic value for the header,
+# the compressed-payload form if z
+def make_magic(cmmd, z=False):
+    return bytearray([(0xD0 if z else 0xE0)+cmmd, 0xBE, 0xFE, 0xCA])
+
+# header plus payload for a long command, compressed if asked. Returns
+# the packet and the size of the payload before compression
+def make_packet(cmmd, data):
+    if zwire:
+        start = time.time()
+        wire = cfgz.compress(data)
+        print("Compressed", len(data), "to", len(wire), "bytes in %.2f s" % \
+              (time.time() - start))
+    else:
+        wire = data
+    size = len(wire).to_bytes(4, byteorder = 'little')
+    return b"".join([make_magic(cmmd, zwire), size, wire]), len(data)
+
+# report how fast a payload went, by its size before compression
+def print_rate(rawlen, wirelen, secs):
+    print("%d bytes (%d on the wire) in %.3f s = %.2f MB/s effective" % \
+          (rawlen, wirelen, secs, rawlen / secs / 1e6 if secs else 0))
+
+# read a bitstream file, optionally packed into a compressed container
+def read_bitstream(name, compress):
     with open(name, "rb") as file:
-        # get length by seeking around
-        file.seek(0, os.SEEK_END)
-        file_len = file.tell()
-        file.seek(0, os.SEEK_SET)
-        print("Size of", name, "is", file_len, "bytes")
+        data = file.read()
+    print("Size of", name, "is", len(data), "bytes")
+    if compress and not cfgz.is_cfgz(data):
+        data = cfgz.compress(data)
+        print("Compressed to", len(data), "bytes")
+    return data
 
-        # add the header with command
-        magic = make_magic(cmmd)
-        size = file_len.to_bytes(4, byteorder = 'little')
-        payload = b"".join([magic, size, file.read(file_len)])
+# config from the firmware's bitstream cache by CRC, returns error and time
+def send_crc(crc, addr, port):
+    magic = make_magic(15)
+    crcsz = 4
+    size = crcsz.to_bytes(4, byteorder = 'little')
+    payload = b"".join([magic, size, crc.to_bytes(4, byteorder = 'little')])
+    
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.connect((addr, port))
+        s.sendall(payload)
+        reply = recv_all(s, 5)
+        s.close()
+    return reply[0], int.from_bytes(reply[1:5], byteorder='little')
 
-        # send to the socket server on the C3
-        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
-            s.connect((addr, port))
-            s.sendall(payload)
-            reply = s.recv(1024)
-            if reply[0] :
-                print("Error", reply[0])
-            s.close()
+# extended commands over a session that's reopened if the link drops
+class SessionExt:
+    def __init__(self, addr, port):
+        self.addr = addr
+        self.port = port
+        self.s = None
+
+    def __call__(self, op, args):
+        try:
+            if not self.s:
+                self.s = session.Session(self.addr, self.port, depth=1)
+                self.s.s.settimeout(10)
+            err, data, body = self.s.call(7, op.to_bytes(4, byteorder='little') + args)
+            return err, body
+        except OSError:
+            if self.s:
+                self.s.close()
+                self.s = None
+            raise
+
+    def close(self):
+        if self.s:
+            self.s.close()
+
+# send what command cmmd would carry as resumable chunks, returns error & data
+def chunked_send(cmmd, payload, addr, port):
+    ext = SessionExt(addr, port)
+    try:
+        return upload.upload(ext, cmmd, payload)
+    finally:
+        ext.close()
+
+# send a file for direct load to FPGA or write to SPIFFS
+def send_file(name, cmmd, compress, addr, port):
+    data = read_bitstream(name, compress)
+    
+    # skip the upload if the firmware has it cached
+    if cmmd == 15:
+        err, us = send_crc(zlib.crc32(data), addr, port)
+        if not err:
+            print("Configured from cache in", us, "us")
+            return
+        elif err != 16:
+            print("Error", err)
+            return
+
+    if chunked:
+        err, us = chunked_send(cmmd, data, addr, port)
+        if err:
+            print("Error", err)
+        elif cmmd == 15:
+            print("Configured in", us, "us")
+        return
+
+    # add the header with command
+    payload, rawlen = make_packet(cmmd, data)
+
+    # send to the socket server on the C3
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        start = time.time()
+        s.connect((addr, port))
+        s.sendall(payload)
+        reply = s.recv(1024)
+        secs = time.time() - start
+        if reply[0] :
+            print("Error", reply[0])
+        else:
+            print_rate(rawlen, len(payload) - 8, secs)
+            if cmmd == 15 and len(reply) >= 5:
+                print("Configured in", int.from_bytes(reply[1:5], byteorder='little'), "us")
+        s.close()
 
 # send a read command plus register address
 def read_reg(reg, addr, port):
@@ -119,31 +225,33 @@ def psram_write(psaddr, name, addr, port):
         file.seek(0, os.SEEK_SET)
         print("Size of", name, "is", file_len, "bytes")
 
-        # iterate over max 64kB chunks
-        magic = make_magic(12)
-        remain_len = file_len
-        while remain_len:
-            send_len = min(remain_len, 65536)
-        
-            # add the header with command
-            size = send_len + 4
-            size_bytes = size.to_bytes(4, byteorder = 'little')
-            psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
-            payload = b"".join([magic, size_bytes, psaddr_bytes, file.read(send_len)])
-
-            # send to the socket server on the C3
-            print("psram_write: sending packet @", psaddr, " len", send_len)
-            with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
-                s.connect((addr, port))
-                s.sendall(payload)
-                reply = s.recv(1024)
-                if reply[0] :
-                    print("Error", reply[0])
-                s.close()
-
-            # update for next iteration
-            remain_len = remain_len - send_len
-            psaddr = psaddr + send_len
+        if chunked:
+            err, data = chunked_send(12, psaddr.to_bytes(4, byteorder = 'little') + \
+                                     file.read(file_len), addr, port)
+            if err & upload.DIRTY_ERR:
+                print("Error", err, "- PSRAM 0x%x to 0x%x holds a bad payload" % \
+                      (psaddr, psaddr + file_len - 1))
+            elif err:
+                print("Error", err)
+            return
+
+        # add the header with command - the firmware streams it to PSRAM
+        psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
+        payload, rawlen = make_packet(12, psaddr_bytes + file.read(file_len))
+
+        # send to the socket server on the C3
+        print("psram_write: sending @", psaddr, " len", file_len)
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            start = time.time()
+            s.connect((addr, port))
+            s.sendall(payload)
+            reply = s.recv(1024)
+            secs = time.time() - start
+            if reply[0] :
+                print("Error", reply[0])
+            else:
+                print_rate(rawlen, len(payload) - 8, secs)
+            s.close()
 
 # read psram to stdout
 def psram_read(psaddr, dlen, addr, port):
@@ -156,25 +264,28 @@ def psram_read(psaddr, dlen, addr, port):
     
     # send to the socket server on the C3
     with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
         s.connect((addr, port))
         s.sendall(payload)
+        
+        # check for error
+        err = s.recv(1)
+        if not len(err) or err[0]:
+            print("Error", err[0] if len(err) else "- no reply")
+            return
+        
+        # then the data in whatever size pieces it comes
+        buf = bytearray(65536)
+        view = memoryview(buf)
         rxlen = 0
-        while rxlen < dlen+1:
-            reply = s.recv(65)
-            if rxlen == 0:
-                # check for error
-                if reply[0]:
-                    print("Error", reply[0])
-                    return
-                
-                # trim off error byte
-                rxlen = rxlen + 1
-                reply = reply[1:]
-            
-            if len(reply):
-                sys.stdout.buffer.write(reply)
-            rxlen = rxlen + len(reply)
-            
+        while rxlen < dlen:
+            n = s.recv_into(view, min(len(buf), dlen - rxlen))
+            if not n:
+                print("Connection closed after", rxlen, "bytes", file=sys.stderr)
+                break
+            sys.stdout.buffer.write(view[:n])
+            rxlen = rxlen + n
+        
         s.close()
 
 # write file to psram
@@ -187,25 +298,132 @@ def psram_init(psaddr, name, addr, port):
         file.seek(0, os.SEEK_SET)
         print("Size of", name, "is", file_len, "bytes")
 
-        # init cmd
-        magic = make_magic(10)
-        
-        # add the header with command
-        size = file_len + 4
-        size_bytes = size.to_bytes(4, byteorder = 'little')
+        if chunked:
+            err, data = chunked_send(10, psaddr.to_bytes(4, byteorder = 'little') + \
+                                     file.read(file_len), addr, port)
+            if err:
+                print("Error", err)
+            return
+
+        # add the header with init cmd
         psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
-        payload = b"".join([magic, size_bytes, psaddr_bytes, file.read(file_len)])
+        payload, rawlen = make_packet(10, psaddr_bytes + file.read(file_len))
 
         # send to the socket server on the C3
         print("psram_write: sending packet @", psaddr, " len", file_len)
         with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            start = time.time()
             s.connect((addr, port))
             s.sendall(payload)
             reply = s.recv(1024)
+            secs = time.time() - start
             if reply[0] :
                 print("Error", reply[0])
+            else:
+                print_rate(rawlen, len(payload) - 8, secs)
             s.close()
 
+# names of the bus profiler classes in firmware order
+stat_names = ["config", "reg_rd", "reg_wr", "psram_rd", "psram_wr", \
+              "dual_rd", "dual_wr", "mutex"]
+
+# print a bus profiler snapshot
+def print_stats(data):
+    nclass = int.from_bytes(data[0:4], byteorder='little')
+    nbins = int.from_bytes(data[4:8], byteorder='little')
+    recsz = 24 + 4*nbins
+    print("%-9s %8s %12s %12s %8s %8s  histogram (2^n us)" % \
+        ("class", "count", "bytes", "total_us", "avg_us", "max_us"))
+    for i in range(nclass):
+        rec = data[8+i*recsz:8+(i+1)*recsz]
+        count = int.from_bytes(rec[0:4], byteorder='little')
+        max_us = int.from_bytes(rec[4:8], byteorder='little')
+        nbytes = int.from_bytes(rec[8:16], byteorder='little')
+        total_us = int.from_bytes(rec[16:24], byteorder='little')
+        hist = [int.from_bytes(rec[24+4*j:28+4*j], byteorder='little') for j in range(nbins)]
+        name = stat_names[i] if i < len(stat_names) else str(i)
+        avg = total_us // count if count else 0
+        print("%-9s %8d %12d %12d %8d %8d  %s" % \
+            (name, count, nbytes, total_us, avg, max_us, " ".join(str(h) for h in hist)))
+
+# receive a whole number of bytes from a socket
+def recv_all(s, n):
+    data = b""
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            break
+        data = data + chunk
+    return data
+
+# send an extended command, return error and reply data
+def ext_cmd(op, args, addr, port):
+    magic = make_magic(7)
+    body = b"".join([op.to_bytes(4, byteorder = 'little'), args])
+    size = len(body).to_bytes(4, byteorder = 'little')
+    payload = b"".join([magic, size, body])
+    
+    # send to the socket server on the C3
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.connect((addr, port))
+        s.sendall(payload)
+        reply = recv_all(s, 5)
+        err = reply[0]
+        rlen = int.from_bytes(reply[1:5], byteorder='little')
+        data = recv_all(s, rlen)
+        s.close()
+    return err, data
+
+# read or clear the bus profiler
+def stats(reset, addr, port):
+    err, data = ext_cmd(1 if reset else 0, b"", addr, port)
+    if err:
+        print("Error", err)
+    elif not reset:
+        print_stats(data)
+
+# report the last FPGA configuration
+def cfg_info(addr, port):
+    err, data = ext_cmd(2, b"", addr, port)
+    if err:
+        print("Error", err)
+        return
+    info = [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(6)]
+    if info[1] == 255:
+        print("No configuration yet")
+        return
+    print("Config job", info[0], "status", info[1], "-", info[2], "us @", info[3], "Hz")
+    if info[4]:
+        print("Sent", info[4], "bytes, configured", info[5], \
+            "bytes, ratio %.2f" % (info[5] / info[4]))
+
+# report the firmware's bitstream cache
+def cache_stats(addr, port):
+    err, data = ext_cmd(3, b"", addr, port)
+    if err:
+        print("Error", err)
+        return
+    v = [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(len(data)//4)]
+    print("Cache", v[0], "hits", v[1], "misses", v[2], "evictions,", \
+        v[3], "of", v[4], "bytes used")
+    for i in range(v[5]):
+        e = v[6+4*i:10+4*i]
+        print("  0x%08X %7d bytes%s%s" % (e[0], e[1], \
+            " pinned" if e[2] else "", " busy" if e[3] else ""))
+
+# pin or unpin a bitstream file in the firmware's cache
+def cache_pin(name, pin, compress, addr, port):
+    crc = zlib.crc32(read_bitstream(name, compress))
+    args = b"".join([crc.to_bytes(4, byteorder='little'), \
+                     pin.to_bytes(4, byteorder='little')])
+    err, data = ext_cmd(4, args, addr, port)
+    if err == 16:
+        print("0x%08X is not cached - load it first" % crc)
+    elif err:
+        print("Error", err)
+    else:
+        print("%s 0x%08X" % ("Pinned" if pin else "Unpinned", crc))
+
 # send a load command plus config ID
 def load_cfg(reg, addr, port):
     magic = make_magic(6)
@@ -220,8 +438,191 @@ def load_cfg(reg, addr, port):
         reply = s.recv(1024)
         if reply[0]!= 0 :
             print("Error", reply[0])
+        elif len(reply) >= 5:
+            print("Configured in", int.from_bytes(reply[1:5], byteorder='little'), "us")
         s.close()
 
+# run a file of register ops in one round trip. Lines are "r REG",
+# "w REG DATA", "m REG MASK DATA", "s REG BITS" or "c REG BITS"
+def run_script(name, addr, port):
+    ops = regvec.parse_script(name)
+    if ops is None:
+        return
+    
+    start = time.time()
+    err, data = ext_cmd(regvec.EXT_REG_VEC, regvec.encode(ops), addr, port)
+    if err:
+        print("Error", err)
+        return
+    for reg, val in regvec.decode(ops, data):
+        print("Read Reg", reg, "=", hex(val))
+    print(len(ops), "accesses in %.1f ms" % (1000 * (time.time() - start)), \
+          file=sys.stderr)
+
+# wait on the device for (REG & MASK) == VALUE, one round trip in all
+def poll_reg(reg, mask, expect, timeout_us, addr, port):
+    err, data = ext_cmd(regvec.EXT_REG_POLL, \
+                        regvec.poll_args(reg, mask, expect, timeout_us), addr, port)
+    res = regvec.poll_result(data)
+    if res is None:
+        print("Error", err)
+    else:
+        print("Read Reg", reg, "=", hex(res[0]), "after", res[1], "reads in", res[2], "us")
+        if err & regvec.POLL_TIMEOUT:
+            print("Timed out")
+        elif err:
+            print("Error", err)
+
+# store command script <file> on the device as number num, none removes it
+def store_script(num, name, addr, port):
+    body = b""
+    if name:
+        try:
+            body = cmdscript.assemble(name)
+        except ValueError as e:
+            print("Bad script:", e)
+            return
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_SAVE, num.to_bytes(4, byteorder='little') + body, addr, port)
+    if err:
+        print("Error", err)
+    else:
+        print("Removed" if not name else "Stored", "script", num)
+
+# run stored command script num, or a script file without storing it
+def run_cmdscript(which, addr, port):
+    if which.isdigit():
+        args = int(which).to_bytes(4, byteorder='little')
+    else:
+        try:
+            args = cmdscript.assemble(which)
+        except ValueError as e:
+            print("Bad script:", e)
+            return
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_RUN, args, addr, port)
+    res = cmdscript.parse_result(data)
+    if res is None or (err and not res[0]):
+        print("Error", err)
+    elif err:
+        print("Stopped at offset", res[2], "after", res[0], "ops in", res[1], "us, error", err)
+    else:
+        print("Ran", res[0], "ops in", res[1], "us")
+
+# stop the command script running on the device, eg the boot script
+def stop_cmdscript(addr, port):
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_STOP, b"", addr, port)
+    if err:
+        print("Error", err)
+    else:
+        print("Stop sent")
+
+# fire the ops in timed list <file> on the device and report how close to
+# time they ran
+def run_timed(name, addr, port):
+    try:
+        body = timedq.assemble(name)
+    except ValueError as e:
+        print("Bad op list:", e)
+        return
+    err, data = ext_cmd(timedq.EXT_TIMED, body, addr, port)
+    res = timedq.parse_result(data)
+    if res is None:
+        print("Error", err)
+        return
+    timedq.report(body, res)
+    if err:
+        print("Error", err)
+
+# print one sample as csv: sequence, us, register values
+def print_sample(smp):
+    print("%d,%d," % (smp[0], smp[1]) + ",".join("0x%08X" % v for v in smp[2:]))
+
+# sample regs hz times a second on the device and print them as they stream
+# in, count of them or until ^C, then stop and report how it went
+def sample_regs(hz, regs, count, addr, port):
+    try:
+        args = sampler.start_args(hz, regs)
+    except ValueError as e:
+        print("Bad sampling:", e)
+        return
+    err, data = ext_cmd(sampler.EXT_SAMPLE_START, args, addr, port)
+    if err:
+        print("Error", err)
+        return
+    print("seq,us," + ",".join("reg%d" % r for r in regs))
+    got = 0
+    buf = b""
+    start = time.time()
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.connect((addr, sampler.PORT))
+        try:
+            while not count or got < count:
+                rx = s.recv(65536)
+                if not rx:
+                    break
+                samples, ovf, buf = sampler.parse_batches(buf + rx)
+                for smp in samples[:count - got if count else None]:
+                    print_sample(smp)
+                got += len(samples)
+        except KeyboardInterrupt:
+            pass
+        except ValueError as e:
+            print(e, file=sys.stderr)
+    secs = time.time() - start
+    sample_stop(addr, port, sys.stderr)
+    print("Received %d samples in %.2f s = %.0f/s" % (got, secs, got / secs if secs else 0), \
+          file=sys.stderr)
+
+# stop sampling, or just report, with the sampler's counters
+def sample_stop(addr, port, file=sys.stdout, stop=True):
+    err, data = ext_cmd(sampler.EXT_SAMPLE_STOP if stop else sampler.EXT_SAMPLE_STATS, \
+                        b"", addr, port)
+    st = sampler.parse_stats(data)
+    if st is None:
+        print("Error", err, file=file)
+    else:
+        sampler.print_stats(st, file)
+
+# PSRAM ops run on the device - extended opcodes 18 fill, 19 copy, 20 CRC
+def psram_op(op, vals, addr, port):
+    args = b"".join([(v & 0xFFFFFFFF).to_bytes(4, byteorder='little') for v in vals])
+    start = time.time()
+    err, data = ext_cmd(op, args, addr, port)
+    return err, data, time.time() - start
+
+# fill LEN bytes of PSRAM at ADDR with a repeated 32-bit word
+def psram_fill(psaddr, dlen, pattern, addr, port):
+    err, data, secs = psram_op(18, (psaddr, dlen, pattern), addr, port)
+    if err:
+        print("Error", err)
+    else:
+        print("Filled", dlen, "bytes in %.3f s" % secs)
+
+# copy LEN bytes of PSRAM from SRC to DST, the ranges may overlap
+def psram_copy(dst, src, dlen, addr, port):
+    err, data, secs = psram_op(19, (dst, src, dlen), addr, port)
+    if err:
+        print("Error", err)
+    else:
+        print("Copied", dlen, "bytes in %.3f s" % secs)
+
+# CRC32 of PSRAM at ADDR, for LEN bytes or compared with <file>
+def psram_crc(psaddr, what, addr, port):
+    data = None
+    if what.isdigit() or what.startswith("0x"):
+        dlen = int(what, 0)
+    else:
+        with open(what, "rb") as file:
+            data = file.read()
+        dlen = len(data)
+    err, reply, secs = psram_op(20, (psaddr, dlen), addr, port)
+    if err or len(reply) < 4:
+        print("Error", err)
+        return
+    crc = int.from_bytes(reply[0:4], byteorder='little')
+    print("CRC32 of", dlen, "bytes is 0x%08X in %.3f s" % (crc, secs))
+    if data is not None:
+        print("Matches" if crc == zlib.crc32(data) else "Does NOT match", what)
+
 # usage text for command line
 def usage():
     print(sys.argv[0], " [options] [<file>] | [DATA] | [LEN] communicate with ESP32C3 FPGA")
@@ -237,14 +638,41 @@ def usage():
     print("      --ps_rd=ADDR LEN    : read PSRAM at ADDR for LEN to stdout")
     print("      --ps_wr=ADDR <file> : write PSRAM at ADDR with data in <file>")
     print("      --ps_in=ADDR <file> : write PSRAM init at ADDR with data in <file>")
+    print("      --ps_fill=ADDR LEN PATTERN : fill PSRAM with a 32-bit word on the device")
+    print("      --ps_copy=DST SRC LEN : copy PSRAM on the device")
+    print("      --ps_crc=ADDR LEN|<file> : CRC32 of PSRAM on the device, checked with <file>")
+    print("      --stats             : report FPGA bus profiler")
+    print("      --stats_reset       : clear FPGA bus profiler")
+    print("      --cfg_info          : report last config time & compression")
+    print("  -z, --compress          : compress <file> before sending")
+    print("  -c, --chunked           : send <file> in CRC-checked chunks that resume")
+    print("  -Z, --zwire             : compress <file> on the wire, report MB/s")
+    print("      --cache             : report bitstream cache")
+    print("      --pin <file>        : keep <file> in the bitstream cache")
+    print("      --unpin <file>      : allow <file> to be evicted from the cache")
+    print("      --script <file>     : run register ops in <file> in one go")
+    print("      --poll=REG MASK VAL : wait for (REG & MASK) == VAL on the device")
+    print("      --timeout=US        : give up a poll after US microseconds (default 1000000)")
+    print("      --store=N [<file>]  : keep command script <file> as N, 0 runs at boot")
+    print("      --run=N|<file>      : run stored command script N or <file>")
+    print("      --script_stop       : stop the command script that's running")
+    print("      --timed <file>      : fire the ops in <file> at their times, report error")
+    print("      --sample=HZ REG ... : sample registers HZ times a second, print as csv")
+    print("      --count=N           : stop sampling after N samples (default ^C)")
+    print("      --sample_stats      : report the sampler's counters")
+    print("      --sample_stop       : stop sampling and report")
 
 # main entry
 if __name__ == "__main__":
     try:
         opts, args = getopt.getopt(sys.argv[1:], \
-            "ha:bfil:p:r:w:", \
+            "ha:bfil:p:r:w:zcZ", \
             ["help", "address=", "battery", "flash", "info", "load=", \
-             "port=", "read=", "write=","ps_rd=", "ps_wr=", "ps_in="])
+             "port=", "read=", "write=","ps_rd=", "ps_wr=", "ps_in=", \
+             "ps_fill=", "ps_copy=", "ps_crc=", \
+             "stats", "stats_reset", "cfg_info", "compress", \
+             "cache", "pin", "unpin", "script=", "poll=", "timeout=", "store=", "run=", "script_stop", "timed=", \
+             "sample=", "count=", "sample_stats", "sample_stop", "chunked", "zwire"])
     except getopt.GetoptError as err:
         # print help information and exit:
         print(err)  # will print something like "option -a not recognized"
@@ -256,6 +684,17 @@ if __name__ == "__main__":
     port = 3333
     cmmd = 15
     reg = 0
+    compress = False
+    script = None
+    poll = False
+    store = None
+    runscr = None
+    timed = None
+    psop = None
+    sample = None
+    count = 0
+    sampstat = None
+    timeout = 1000000
     
     # scan thru results
     for o, a in opts:
@@ -290,14 +729,92 @@ if __name__ == "__main__":
         elif o in ("--ps_in"):
             cmmd = 10
             psaddr = int(a)
+        elif o == "--stats":
+            cmmd = 7
+            reg = 0
+        elif o == "--stats_reset":
+            cmmd = 7
+            reg = 1
+        elif o == "--cfg_info":
+            cmmd = 7
+            reg = 2
+        elif o in ("-z", "--compress"):
+            compress = True
+        elif o in ("-c", "--chunked"):
+            chunked = True
+        elif o in ("-Z", "--zwire"):
+            zwire = True
+        elif o == "--cache":
+            cmmd = 7
+            reg = 3
+        elif o == "--pin":
+            cmmd = 7
+            reg = 4
+        elif o == "--unpin":
+            cmmd = 7
+            reg = 5
+        elif o == "--script":
+            script = a
+        elif o == "--poll":
+            reg = int(a, 0)
+            poll = True
+        elif o == "--timeout":
+            timeout = int(a)
+        elif o == "--store":
+            store = int(a)
+        elif o == "--run":
+            runscr = a
+        elif o == "--script_stop":
+            runscr = o
+        elif o in ("--ps_fill", "--ps_copy", "--ps_crc"):
+            psop = o
+            psaddr = int(a, 0)
+        elif o == "--timed":
+            timed = a
+        elif o == "--sample":
+            sample = float(a)
+        elif o == "--count":
+            count = int(a)
+        elif o in ("--sample_stats", "--sample_stop"):
+            sampstat = o
         else:
             assert False, "unhandled option"
     
     # check for non-option arg
-    if cmmd > 13:
+    if script:
+        run_script(script, addr, port)
+    elif store is not None:
+        store_script(store, args[0] if len(args) > 0 else None, addr, port)
+    elif psop == "--ps_crc":
+        if len(args) > 0:
+            psram_crc(psaddr, args[0], addr, port)
+        else:
+            print("missing length or filename")
+    elif psop:
+        if len(args) > 1:
+            (psram_fill if psop == "--ps_fill" else psram_copy)(psaddr, \
+                int(args[0], 0), int(args[1], 0), addr, port)
+        else:
+            print("missing arguments")
+    elif sample:
+        sample_regs(sample, [int(r, 0) for r in args], count, addr, port)
+    elif sampstat:
+        sample_stop(addr, port, stop=sampstat == "--sample_stop")
+    elif timed:
+        run_timed(timed, addr, port)
+    elif runscr == "--script_stop":
+        stop_cmdscript(addr, port)
+    elif runscr:
+        run_cmdscript(runscr, addr, port)
+    elif poll:
+        if len(args) > 1:
+            poll_reg(reg, int(args[0], 0), int(args[1], 0), timeout, addr, port)
+        else:
+            print("missing mask and value")
+    elif cmmd > 13:
         # bitstream file handler
         if len(args) > 0:
-            send_file(args[0], cmmd, addr, port)
+            send_file(args[0], cmmd, compress, addr, port)
         else:
             print("missing filename")
     elif cmmd == 12:
@@ -328,6 +845,18 @@ if __name__ == "__main__":
         read_info()
     elif cmmd == 6:
         load_cfg(reg, addr, port)
+    elif cmmd == 7:
+        if reg == 2:
+            cfg_info(addr, port)
+        elif reg == 3:
+            cache_stats(addr, port)
+        elif reg > 3:
+            if len(args) > 0:
+                cache_pin(args[0], 1 if reg == 4 else 0, compress, addr, port)
+            else:
+                print("missing filename")
+        else:
+            stats(reg, addr, port)
     else:
         assert False, "unhandled option"
 
@@ -5,6 +5,14 @@
 import sys
 import os
 import getopt
+import cfgz
+import frame
+import regvec
+import cmdscript
+import timedq
+import sampler
+import upload
+import zlib
 import time
 import serial
 import base64
@@ -18,10 +26,38 @@ def get_C3_port():
     else:
         return 'none'
 
-# convert a command nybble into a 32-bit magic value for the header
-def make_magic(cmmd):
+# replies come as binary frames once negotiated, text lines before
+binary = False
+
+# send long payloads as resumable chunks
+chunked = False
+
+# compress long payloads on the wire, the firmware unpacks as they arrive
+zwire = False
+
+# convert a command nybble into a 32-bit magic value for the header,
+# the compressed-payload form if z
+def make_magic(cmmd, z=False):
     cmmd = cmmd & 15
-    return bytearray([0xE0+cmmd, 0xBE, 0xFE, 0xCA])
+    return bytearray([(0xD0 if z else 0xE0)+cmmd, 0xBE, 0xFE, 0xCA])
+
+# header plus payload for a long command, compressed if asked. Returns
+# the packet and the size of the payload before compression
+def make_packet(cmmd, data):
+    if zwire:
+        start = time.time()
+        wire = cfgz.compress(data)
+        print("Compressed", len(data), "to", len(wire), "bytes in %.2f s" % \
+              (time.time() - start))
+    else:
+        wire = data
+    size = len(wire).to_bytes(4, byteorder = 'little')
+    return b"".join([make_magic(cmmd, zwire), size, wire]), len(data)
+
+# report how fast a payload went, by its size before compression
+def print_rate(rawlen, wirelen, secs):
+    print("%d bytes (%d on the wire) in %.3f s = %.2f MB/s effective" % \
+          (rawlen, wirelen, secs, rawlen / secs / 1e6 if secs else 0))
 
 # transmit a buffer of data to the tty
 def sendall(tty, buffer):
@@ -61,36 +97,96 @@ def recv_err_tokens(tty):
         # too short
         return 32, 0
 
-# receive a short reply with header, err status and 32-bit data as hex
+# receive a short reply with err status and 32-bit data
 def recv_err_data(tty):
+    if binary:
+        ftype, body = frame.recv(tty)
+        if ftype != frame.FRAME_STATUS or len(body) != 5:
+            return 64, 0
+        return body[0], int.from_bytes(body[1:5], byteorder='little')
+    
+    # data comes with firmware errors too, not with link ones
     err, toks = recv_err_tokens(tty)
-    if err:
-        return err, 0;
-    else:
-        if len(toks) == 1:
-            return err, int(toks[0], 16)
+    if toks and len(toks) == 1:
+        return err, int(toks[0], 16)
+    return err, 0
     
-# send a file for direct load to FPGA or write to SPIFFS
-def send_file(name, cmmd, tty):
-    # open file as binary
+# read a bitstream file, optionally packed into a compressed container
+def read_bitstream(name, compress):
     with open(name, "rb") as file:
-        # get length by seeking around
-        file.seek(0, os.SEEK_END)
-        file_len = file.tell()
-        file.seek(0, os.SEEK_SET)
-        #print("Size of", name, "is", file_len, "bytes")
+        data = file.read()
+    if compress and not cfgz.is_cfgz(data):
+        data = cfgz.compress(data)
+    return data
 
-        # add the header with command
-        magic = make_magic(cmmd)
-        size = file_len.to_bytes(4, byteorder = 'little')
-        payload = b"".join([magic, size, file.read(file_len)])
+# config from the firmware's bitstream cache by CRC, returns error and time
+def send_crc(crc, tty):
+    magic = make_magic(15)
+    crcsz = 4
+    size = crcsz.to_bytes(4, byteorder = 'little')
+    payload = b"".join([magic, size, crc.to_bytes(4, byteorder = 'little')])
+    
+    sendall(tty, payload)
+    return recv_err_data(tty)
 
-        # send to the C3 over usb
-        sendall(tty, payload)
-        err, data = recv_err_data(tty)
+# send what command cmmd would carry as resumable chunks, returns error & data
+def chunked_send(cmmd, payload, tty):
+    return upload.upload(lambda op, args: ext_cmd(op, args, tty), cmmd, payload)
+
+# send a file for direct load to FPGA or write to SPIFFS
+def send_file(name, cmmd, compress, tty):
+    data = read_bitstream(name, compress)
+    
+    # skip the upload if the firmware has it cached
+    if cmmd == 15:
+        err, us = send_crc(zlib.crc32(data), tty)
+        if not err:
+            print("Configured from cache in", us, "us")
+            return
+        elif err != 16:
+            print("Error", err)
+            return
+
+    if chunked:
+        err, us = chunked_send(cmmd, data, tty)
         if err:
             print("Error", err)
+        elif cmmd == 15:
+            print("Configured in", us, "us")
+        return
+
+    # add the header with command
+    payload, rawlen = make_packet(cmmd, data)
+
+    # send to the C3 over usb
+    start = time.time()
+    sendall(tty, payload)
+    err, data = recv_err_data(tty)
+    secs = time.time() - start
+    if err:
+        print("Error", err)
+    else:
+        print_rate(rawlen, len(payload) - 8, secs)
+        if cmmd == 15:
+            print("Configured in", data, "us")
             
+# switch between text and binary framed replies, the firmware answers
+# this one in text whatever the mode. Returns 0 if the firmware agreed
+def reply_mode(mode, tty):
+    global binary
+    magic = make_magic(7)
+    size = (8).to_bytes(4, byteorder = 'little')
+    payload = b"".join([magic, size, (5).to_bytes(4, byteorder = 'little'), \
+                        mode.to_bytes(4, byteorder = 'little')])
+    
+    tty.reset_input_buffer()
+    sendall(tty, payload)
+    binary = False
+    err, data = recv_err_data(tty)
+    if not err:
+        binary = mode == 1
+    return err
+
 # send a read command plus register address
 def read_reg(reg, tty):
     magic = make_magic(0)
@@ -145,7 +241,14 @@ def read_info(tty):
     
     # send to the C3 over usb
     sendall(tty, payload)
-    err, toks = recv_err_tokens(tty)
+    if binary:
+        ftype, body = frame.recv(tty)
+        if ftype != frame.FRAME_TEXT or not len(body):
+            err, toks = 64, 0
+        else:
+            err, toks = body[0], body[1:].decode('utf-8').split()
+    else:
+        err, toks = recv_err_tokens(tty)
     if err:
         print("Error", err)
     else:
@@ -164,28 +267,30 @@ def psram_write(psaddr, name, tty):
         file.seek(0, os.SEEK_SET)
         print("Size of", name, "is", file_len, "bytes")
 
-        # iterate over max 64kB chunks
-        magic = make_magic(12)
-        remain_len = file_len
-        while remain_len:
-            send_len = min(remain_len, 65536)
-        
-            # add the header with command
-            size = send_len + 4
-            size_bytes = size.to_bytes(4, byteorder = 'little')
-            psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
-            payload = b"".join([magic, size_bytes, psaddr_bytes, file.read(send_len)])
-
-            # send to the C3 over usb
-            print("PS_WR: sending packet @", psaddr, " len", send_len)
-            sendall(tty, payload)
-            err, data = recv_err_data(tty)
-            if err:
+        if chunked:
+            err, data = chunked_send(12, psaddr.to_bytes(4, byteorder = 'little') + \
+                                     file.read(file_len), tty)
+            if err & upload.DIRTY_ERR:
+                print("Error", err, "- PSRAM 0x%x to 0x%x holds a bad payload" % \
+                      (psaddr, psaddr + file_len - 1))
+            elif err:
                 print("Error", err)
+            return
+
+        # add the header with command - the firmware streams it to PSRAM
+        psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
+        payload, rawlen = make_packet(12, psaddr_bytes + file.read(file_len))
 
-            # update for next iteration
-            remain_len = remain_len - send_len
-            psaddr = psaddr + send_len
+        # send to the C3 over usb
+        print("PS_WR: sending @", psaddr, " len", file_len)
+        start = time.time()
+        sendall(tty, payload)
+        err, data = recv_err_data(tty)
+        secs = time.time() - start
+        if err:
+            print("Error", err)
+        else:
+            print_rate(rawlen, len(payload) - 8, secs)
 
 # read psram to stdout
 def psram_read(psaddr, numbytes, tty):
@@ -198,6 +303,14 @@ def psram_read(psaddr, numbytes, tty):
     
     # send to the C3 over usb
     sendall(tty, payload)
+    if binary:
+        data = recv_data(tty)
+        if data is None:
+            print("Error")
+        else:
+            sys.stdout.buffer.write(data)
+        return
+    
     go = 1
     while go:
         reply = tty.read_until()
@@ -235,21 +348,27 @@ def psram_init(psaddr, name, tty):
         file.seek(0, os.SEEK_SET)
         print("Size of", name, "is", file_len, "bytes")
 
-        # psram init command
-        magic = make_magic(10)
-        
-        # add the header with command
-        size = file_len + 4
-        size_bytes = size.to_bytes(4, byteorder = 'little')
+        if chunked:
+            err, data = chunked_send(10, psaddr.to_bytes(4, byteorder = 'little') + \
+                                     file.read(file_len), tty)
+            if err:
+                print("Error", err)
+            return
+
+        # add the header with psram init command
         psaddr_bytes = psaddr.to_bytes(4, byteorder = 'little')
-        payload = b"".join([magic, size_bytes, psaddr_bytes, file.read(file_len)])
+        payload, rawlen = make_packet(10, psaddr_bytes + file.read(file_len))
 
         # send to the C3 over usb
         print("PS_WR: sending packet @", psaddr, " len", file_len)
+        start = time.time()
         sendall(tty, payload)
         err, data = recv_err_data(tty)
+        secs = time.time() - start
         if err:
             print("Error", err)
+        else:
+            print_rate(rawlen, len(payload) - 8, secs)
 
 # send credentials (ssid or password)
 def send_cred(cred_type, cred_value, tty):
@@ -266,6 +385,132 @@ def send_cred(cred_type, cred_value, tty):
     if err:
         print("Error", err)
     
+# names of the bus profiler classes in firmware order
+stat_names = ["config", "reg_rd", "reg_wr", "psram_rd", "psram_wr", \
+              "dual_rd", "dual_wr", "mutex"]
+
+# print a bus profiler snapshot
+def print_stats(data):
+    nclass = int.from_bytes(data[0:4], byteorder='little')
+    nbins = int.from_bytes(data[4:8], byteorder='little')
+    recsz = 24 + 4*nbins
+    print("%-9s %8s %12s %12s %8s %8s  histogram (2^n us)" % \
+        ("class", "count", "bytes", "total_us", "avg_us", "max_us"))
+    for i in range(nclass):
+        rec = data[8+i*recsz:8+(i+1)*recsz]
+        count = int.from_bytes(rec[0:4], byteorder='little')
+        max_us = int.from_bytes(rec[4:8], byteorder='little')
+        nbytes = int.from_bytes(rec[8:16], byteorder='little')
+        total_us = int.from_bytes(rec[16:24], byteorder='little')
+        hist = [int.from_bytes(rec[24+4*j:28+4*j], byteorder='little') for j in range(nbins)]
+        name = stat_names[i] if i < len(stat_names) else str(i)
+        avg = total_us // count if count else 0
+        print("%-9s %8d %12d %12d %8d %8d  %s" % \
+            (name, count, nbytes, total_us, avg, max_us, " ".join(str(h) for h in hist)))
+
+# receive data frames or base64 data lines up to the terminator
+def recv_data(tty):
+    data = b""
+    if binary:
+        while True:
+            ftype, body = frame.recv(tty)
+            if ftype == frame.FRAME_DATA:
+                data += body
+            elif ftype == frame.FRAME_END:
+                return data
+            else:
+                return None
+    
+    go = 1
+    while go:
+        reply = tty.read_until()
+        rplystr = reply.decode('utf-8')
+        rplytok = rplystr.split()
+        
+        # search tokens for reply header
+        for tokidx in range(len(rplytok)):
+            if rplytok[tokidx] == 'RX':
+                addr = int(rplytok[tokidx+1], 16)
+                data_len = int(rplytok[tokidx+2], 16)
+                if (addr == 0xffffffff) and (data_len == 70):
+                    go = 0
+                else:
+                    data = data + base64.b64decode(rplytok[tokidx+3])
+                break
+        else:
+            # didn't find header
+            print("No header")
+            go = 0
+    return data
+
+# send an extended command, return error and reply data
+def ext_cmd(op, args, tty):
+    magic = make_magic(7)
+    body = b"".join([op.to_bytes(4, byteorder = 'little'), args])
+    size = len(body).to_bytes(4, byteorder = 'little')
+    payload = b"".join([magic, size, body])
+    
+    # send to the C3 over usb
+    sendall(tty, payload)
+    err, rlen = recv_err_data(tty)
+    if not rlen:
+        return err, b""
+    # the data follows even if there's an error
+    data = recv_data(tty)
+    if data is None:
+        return 64, b""
+    return err, data
+
+# read or clear the bus profiler
+def stats(reset, tty):
+    err, data = ext_cmd(1 if reset else 0, b"", tty)
+    if err:
+        print("Error", err)
+    elif not reset:
+        print_stats(data)
+
+# report the last FPGA configuration
+def cfg_info(tty):
+    err, data = ext_cmd(2, b"", tty)
+    if err:
+        print("Error", err)
+        return
+    info = [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(6)]
+    if info[1] == 255:
+        print("No configuration yet")
+        return
+    print("Config job", info[0], "status", info[1], "-", info[2], "us @", info[3], "Hz")
+    if info[4]:
+        print("Sent", info[4], "bytes, configured", info[5], \
+            "bytes, ratio %.2f" % (info[5] / info[4]))
+
+# report the firmware's bitstream cache
+def cache_stats(tty):
+    err, data = ext_cmd(3, b"", tty)
+    if err:
+        print("Error", err)
+        return
+    v = [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(len(data)//4)]
+    print("Cache", v[0], "hits", v[1], "misses", v[2], "evictions,", \
+        v[3], "of", v[4], "bytes used")
+    for i in range(v[5]):
+        e = v[6+4*i:10+4*i]
+        print("  0x%08X %7d bytes%s%s" % (e[0], e[1], \
+            " pinned" if e[2] else "", " busy" if e[3] else ""))
+
+# pin or unpin a bitstream file in the firmware's cache
+def cache_pin(name, pin, compress, tty):
+    crc = zlib.crc32(read_bitstream(name, compress))
+    args = b"".join([crc.to_bytes(4, byteorder='little'), \
+                     pin.to_bytes(4, byteorder='little')])
+    err, data = ext_cmd(4, args, tty)
+    if err == 16:
+        print("0x%08X is not cached - load it first" % crc)
+    elif err:
+        print("Error", err)
+    else:
+        print("%s 0x%08X" % ("Pinned" if pin else "Unpinned", crc))
+
 # send a load command plus config ID
 def load_cfg(reg, tty):
     magic = make_magic(6)
@@ -278,6 +523,190 @@ def load_cfg(reg, tty):
     err, data = recv_err_data(tty)
     if err:
         print("Error", err)
+    else:
+        print("Configured in", data, "us")
+
+# run a file of register ops in one round trip, same format as
+# send_c3sock.py --script
+def run_script(name, tty):
+    ops = regvec.parse_script(name)
+    if ops is None:
+        return
+    
+    err, data = ext_cmd(regvec.EXT_REG_VEC, regvec.encode(ops), tty)
+    if err:
+        print("Error", err)
+        return
+    for reg, val in regvec.decode(ops, data):
+        print("Read Reg", reg, "=", hex(val))
+
+# wait on the device for (REG & MASK) == VALUE, one round trip in all
+def poll_reg(reg, mask, expect, timeout_us, tty):
+    tty.timeout = 2 + timeout_us / 1e6
+    err, data = ext_cmd(regvec.EXT_REG_POLL, \
+                        regvec.poll_args(reg, mask, expect, timeout_us), tty)
+    res = regvec.poll_result(data)
+    if res is None:
+        print("Error", err)
+    else:
+        print("Read Reg", reg, "=", hex(res[0]), "after", res[1], "reads in", res[2], "us")
+        if err & regvec.POLL_TIMEOUT:
+            print("Timed out")
+        elif err:
+            print("Error", err)
+
+# store command script <file> on the device as number num, none removes it
+def store_script(num, name, tty):
+    body = b""
+    if name:
+        try:
+            body = cmdscript.assemble(name)
+        except ValueError as e:
+            print("Bad script:", e)
+            return
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_SAVE, num.to_bytes(4, byteorder='little') + body, tty)
+    if err:
+        print("Error", err)
+    else:
+        print("Removed" if not name else "Stored", "script", num)
+
+# run stored command script num, or a script file without storing it
+def run_cmdscript(which, tty):
+    if which.isdigit():
+        args = int(which).to_bytes(4, byteorder='little')
+    else:
+        try:
+            args = cmdscript.assemble(which)
+        except ValueError as e:
+            print("Bad script:", e)
+            return
+    tty.timeout = 75
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_RUN, args, tty)
+    res = cmdscript.parse_result(data)
+    if res is None or (err and not res[0]):
+        print("Error", err)
+    elif err:
+        print("Stopped at offset", res[2], "after", res[0], "ops in", res[1], "us, error", err)
+    else:
+        print("Ran", res[0], "ops in", res[1], "us")
+
+# stop the command script running on the device, eg the boot script
+def stop_cmdscript(tty):
+    err, data = ext_cmd(cmdscript.EXT_SCRIPT_STOP, b"", tty)
+    if err:
+        print("Error", err)
+    else:
+        print("Stop sent")
+
+# fire the ops in timed list <file> on the device and report how close to
+# time they ran
+def run_timed(name, tty):
+    try:
+        body = timedq.assemble(name)
+    except ValueError as e:
+        print("Bad op list:", e)
+        return
+    tty.timeout = 15
+    err, data = ext_cmd(timedq.EXT_TIMED, body, tty)
+    res = timedq.parse_result(data)
+    if res is None:
+        print("Error", err)
+        return
+    timedq.report(body, res)
+    if err:
+        print("Error", err)
+
+# print one sample as csv: sequence, us, register values
+def print_sample(smp):
+    print("%d,%d," % (smp[0], smp[1]) + ",".join("0x%08X" % v for v in smp[2:]))
+
+# sample regs hz times a second on the device and print them as they're read
+# out of its ring, count of them or until ^C, then stop and report
+def sample_regs(hz, regs, count, tty):
+    try:
+        args = sampler.start_args(hz, regs)
+    except ValueError as e:
+        print("Bad sampling:", e)
+        return
+    err, data = ext_cmd(sampler.EXT_SAMPLE_START, args, tty)
+    if err:
+        print("Error", err)
+        return
+    print("seq,us," + ",".join("reg%d" % r for r in regs))
+    got = 0
+    start = time.time()
+    try:
+        while not count or got < count:
+            err, data = ext_cmd(sampler.EXT_SAMPLE_READ, b"", tty)
+            if err:
+                print("Error", err, file=sys.stderr)
+                break
+            samples, ovf, rest = sampler.parse_batches(data)
+            for smp in samples[:count - got if count else None]:
+                print_sample(smp)
+            got += len(samples)
+            if not samples:
+                time.sleep(0.01)
+    except KeyboardInterrupt:
+        pass
+    except ValueError as e:
+        print(e, file=sys.stderr)
+    secs = time.time() - start
+    sample_stop(tty, sys.stderr)
+    print("Received %d samples in %.2f s = %.0f/s" % (got, secs, got / secs if secs else 0), \
+          file=sys.stderr)
+
+# stop sampling, or just report, with the sampler's counters
+def sample_stop(tty, file=sys.stdout, stop=True):
+    err, data = ext_cmd(sampler.EXT_SAMPLE_STOP if stop else sampler.EXT_SAMPLE_STATS, \
+                        b"", tty)
+    st = sampler.parse_stats(data)
+    if st is None:
+        print("Error", err, file=file)
+    else:
+        sampler.print_stats(st, file)
+
+# PSRAM ops run on the device - extended opcodes 18 fill, 19 copy, 20 CRC
+def psram_op(op, vals, tty):
+    args = b"".join([(v & 0xFFFFFFFF).to_bytes(4, byteorder='little') for v in vals])
+    tty.timeout = 30
+    start = time.time()
+    err, data = ext_cmd(op, args, tty)
+    return err, data, time.time() - start
+
+# fill LEN bytes of PSRAM at ADDR with a repeated 32-bit word
+def psram_fill(psaddr, dlen, pattern, tty):
+    err, data, secs = psram_op(18, (psaddr, dlen, pattern), tty)
+    if err:
+        print("Error", err)
+    else:
+        print("Filled", dlen, "bytes in %.3f s" % secs)
+
+# copy LEN bytes of PSRAM from SRC to DST, the ranges may overlap
+def psram_copy(dst, src, dlen, tty):
+    err, data, secs = psram_op(19, (dst, src, dlen), tty)
+    if err:
+        print("Error", err)
+    else:
+        print("Copied", dlen, "bytes in %.3f s" % secs)
+
+# CRC32 of PSRAM at ADDR, for LEN bytes or compared with <file>
+def psram_crc(psaddr, what, tty):
+    data = None
+    if what.isdigit() or what.startswith("0x"):
+        dlen = int(what, 0)
+    else:
+        with open(what, "rb") as file:
+            data = file.read()
+        dlen = len(data)
+    err, reply, secs = psram_op(20, (psaddr, dlen), tty)
+    if err or len(reply) < 4:
+        print("Error", err)
+        return
+    crc = int.from_bytes(reply[0:4], byteorder='little')
+    print("CRC32 of", dlen, "bytes is 0x%08X in %.3f s" % (crc, secs))
+    if data is not None:
+        print("Matches" if crc == zlib.crc32(data) else "Does NOT match", what)
 
 # usage text for command line
 def usage():
@@ -293,6 +722,30 @@ def usage():
     print("      --ps_rd=ADDR LEN    : read PSRAM at ADDR for LEN to stdout")
     print("      --ps_wr=ADDR <file> : write PSRAM at ADDR with data in <file>")
     print("      --ps_in=ADDR <file> : write PSRAM init at ADDR with data in <file>")
+    print("      --ps_fill=ADDR LEN PATTERN : fill PSRAM with a 32-bit word on the device")
+    print("      --ps_copy=DST SRC LEN : copy PSRAM on the device")
+    print("      --ps_crc=ADDR LEN|<file> : CRC32 of PSRAM on the device, checked with <file>")
+    print("      --stats             : report FPGA bus profiler")
+    print("      --stats_reset       : clear FPGA bus profiler")
+    print("      --cfg_info          : report last config time & compression")
+    print("  -z, --compress          : compress <file> before sending")
+    print("  -c, --chunked           : send <file> in CRC-checked chunks that resume")
+    print("  -Z, --zwire             : compress <file> on the wire, report MB/s")
+    print("  -t, --text              : use text replies (older firmware)")
+    print("      --cache             : report bitstream cache")
+    print("      --pin <file>        : keep <file> in the bitstream cache")
+    print("      --unpin <file>      : allow <file> to be evicted from the cache")
+    print("      --script <file>     : run register ops in <file> in one go")
+    print("      --poll=REG MASK VAL : wait for (REG & MASK) == VAL on the device")
+    print("      --timeout=US        : give up a poll after US microseconds (default 1000000)")
+    print("      --store=N [<file>]  : keep command script <file> as N, 0 runs at boot")
+    print("      --run=N|<file>      : run stored command script N or <file>")
+    print("      --script_stop       : stop the command script that's running")
+    print("      --timed <file>      : fire the ops in <file> at their times, report error")
+    print("      --sample=HZ REG ... : sample registers HZ times a second, print as csv")
+    print("      --count=N           : stop sampling after N samples (default ^C)")
+    print("      --sample_stats      : report the sampler's counters")
+    print("      --sample_stop       : stop sampling and report")
     print("  -s, --ssid <SSID>       : set WiFi SSID")
     print("  -o, --password <pwd>    : set WiFi Password")
 
@@ -300,10 +753,15 @@ def usage():
 if __name__ == "__main__":
     try:
         opts, args = getopt.getopt(sys.argv[1:], \
-            "hp:bfil:r:w:so", \
+            "hp:bfil:r:w:soztcZ", \
             ["help", "port=", "battery", "flash", "info", "load=", \
              "read=", "write=", \
-             "ps_rd=", "ps_wr=", "ps_in=", "ssid", "password"])
+             "ps_rd=", "ps_wr=", "ps_in=", \
+             "ps_fill=", "ps_copy=", "ps_crc=", "stats", "stats_reset", "cfg_info", "compress", \
+             "text", "chunked", "zwire", \
+             "cache", "pin", "unpin", "script=", "poll=", "timeout=", "store=", "run=", "script_stop", "timed=", \
+             "sample=", "count=", "sample_stats", "sample_stop", \
+             "ssid", "password"])
     except getopt.GetoptError as err:
         # print help information and exit:
         print(err)  # will print something like "option -a not recognized"
@@ -318,6 +776,18 @@ if __name__ == "__main__":
     
     cmmd = 15
     reg = 0
+    compress = False
+    text = False
+    script = None
+    poll = False
+    store = None
+    runscr = None
+    timed = None
+    psop = None
+    sample = None
+    count = 0
+    sampstat = None
+    timeout = 1000000
     
     # scan thru results
     for o, a in opts:
@@ -350,6 +820,56 @@ if __name__ == "__main__":
         elif o in ("--ps_in"):
             cmmd = 10
             psaddr = int(a)
+        elif o == "--stats":
+            cmmd = 7
+            reg = 0
+        elif o == "--stats_reset":
+            cmmd = 7
+            reg = 1
+        elif o == "--cfg_info":
+            cmmd = 7
+            reg = 2
+        elif o in ("-z", "--compress"):
+            compress = True
+        elif o in ("-t", "--text"):
+            text = True
+        elif o in ("-c", "--chunked"):
+            chunked = True
+        elif o in ("-Z", "--zwire"):
+            zwire = True
+        elif o == "--cache":
+            cmmd = 7
+            reg = 3
+        elif o == "--pin":
+            cmmd = 7
+            reg = 4
+        elif o == "--unpin":
+            cmmd = 7
+            reg = 5
+        elif o == "--script":
+            script = a
+        elif o == "--poll":
+            reg = int(a, 0)
+            poll = True
+        elif o == "--timeout":
+            timeout = int(a)
+        elif o == "--store":
+            store = int(a)
+        elif o == "--run":
+            runscr = a
+        elif o == "--script_stop":
+            runscr = o
+        elif o in ("--ps_fill", "--ps_copy", "--ps_crc"):
+            psop = o
+            psaddr = int(a, 0)
+        elif o == "--timed":
+            timed = a
+        elif o == "--sample":
+            sample = float(a)
+        elif o == "--count":
+            count = int(a)
+        elif o in ("--sample_stats", "--sample_stop"):
+            sampstat = o
         elif o in ("-s", "--ssid"):
             cmmd = 3
         elif o in ("-o", "--password"):
@@ -363,12 +883,46 @@ if __name__ == "__main__":
     # try to open the port and run the command
     tty = serial.Serial(port)
     tty.timeout = 2 # -f option can be very slow
+    
+    # binary replies if the firmware has them
+    if not text:
+        reply_mode(1, tty)
 
     # check for non-option arg
-    if cmmd > 13:
+    if script:
+        run_script(script, tty)
+    elif store is not None:
+        store_script(store, args[0] if len(args) > 0 else None, tty)
+    elif psop == "--ps_crc":
+        if len(args) > 0:
+            psram_crc(psaddr, args[0], tty)
+        else:
+            print("missing length or filename")
+    elif psop:
+        if len(args) > 1:
+            (psram_fill if psop == "--ps_fill" else psram_copy)(psaddr, \
+                int(args[0], 0), int(args[1], 0), tty)
+        else:
+            print("missing arguments")
+    elif sample:
+        sample_regs(sample, [int(r, 0) for r in args], count, tty)
+    elif sampstat:
+        sample_stop(tty, stop=sampstat == "--sample_stop")
+    elif timed:
+        run_timed(timed, tty)
+    elif runscr == "--script_stop":
+        stop_cmdscript(tty)
+    elif runscr:
+        run_cmdscript(runscr, tty)
+    elif poll:
+        if len(args) > 1:
+            poll_reg(reg, int(args[0], 0), int(args[1], 0), timeout, tty)
+        else:
+            print("missing mask and value")
+    elif cmmd > 13:
         # bitstream file handler
         if len(args) > 0:
-            send_file(args[0], cmmd, tty)
+            send_file(args[0], cmmd, compress, tty)
         else:
             print("missing filename")
     elif cmmd == 12:
@@ -406,8 +960,21 @@ if __name__ == "__main__":
         read_info(tty)
     elif cmmd == 6:
         load_cfg(reg, tty)
+    elif cmmd == 7:
+        if reg == 2:
+            cfg_info(tty)
+        elif reg == 3:
+            cache_stats(tty)
+        elif reg > 3:
+            if len(args) > 0:
+                cache_pin(args[0], 1 if reg == 4 else 0, compress, tty)
+            else:
+                print("missing filename")
+        else:
+            stats(reg, tty)
     else:
         assert False, "unknown command"
-       
-
     
+    # leave the firmware in text mode for other tools
+    if binary:
+        reply_mode(0, tty)
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+# pipelined command session with the ICE-V Wireless socket server
+# 10-17-26
+
+import socket
+
+SESS_MAGIC = 0xCAFE5E50     # command header | cmd
+SESS_REPLY = 0xCAFE5E60     # reply header | cmd
+
+# one connection carrying any number of commands. Each command gets an
+# id which comes back with its reply, so several can be in flight
+class Session:
+    def __init__(self, addr, port, depth=16):
+        self.s = socket.create_connection((addr, port))
+        self.s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.depth = depth
+        self.next_id = 1
+        self.inflight = []
+        self.done = {}
+
+    def close(self):
+        self.s.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def recv_all(self, n):
+        data = b""
+        while len(data) < n:
+            part = self.s.recv(n - len(data))
+            if not part:
+                raise ConnectionError("session closed")
+            data += part
+        return data
+
+    # take the next reply off the connection
+    def recv_reply(self):
+        head = self.recv_all(20)
+        words = [int.from_bytes(head[i:i+4], byteorder='little') for i in range(0, 20, 4)]
+        if words[0] & 0xFFFFFFF0 != SESS_REPLY:
+            raise ConnectionError("bad reply header 0x%08X" % words[0])
+        rid = words[1]
+        body = self.recv_all(words[4]) if words[4] else b""
+        self.inflight.remove(rid)
+        self.done[rid] = (words[2], words[3], body)
+
+    # send a command, returns its id. Waits for a reply first if too
+    # many are outstanding so neither end blocks sending
+    def submit(self, cmd, body):
+        while len(self.inflight) >= self.depth:
+            self.recv_reply()
+        rid = self.next_id
+        self.next_id = (self.next_id + 1) & 0xFFFFFFFF or 1
+        head = b"".join([(SESS_MAGIC | (cmd & 15)).to_bytes(4, byteorder='little'), \
+                         len(body).to_bytes(4, byteorder='little'), \
+                         rid.to_bytes(4, byteorder='little')])
+        self.s.sendall(head + body)
+        self.inflight.append(rid)
+        return rid
+
+    # wait for a command's reply, returns error, 32-bit data and payload
+    def result(self, rid):
+        while rid not in self.done:
+            self.recv_reply()
+        return self.done.pop(rid)
+
+    # send and wait
+    def call(self, cmd, body):
+        return self.result(self.submit(cmd, body))
+
+    def read_reg(self, reg):
+        return self.submit(0, reg.to_bytes(4, byteorder='little'))
+
+    def write_reg(self, reg, data):
+        return self.submit(1, reg.to_bytes(4, byteorder='little') + \
+                           data.to_bytes(4, byteorder='little'))
+
+    def psram_read(self, psaddr, dlen):
+        return self.submit(11, psaddr.to_bytes(4, byteorder='little') + \
+                           dlen.to_bytes(4, byteorder='little'))
+
+    def psram_write(self, psaddr, data):
+        return self.submit(12, psaddr.to_bytes(4, byteorder='little') + data)
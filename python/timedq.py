@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# timed op lists - FPGA accesses the firmware fires at set times
+# 10-17-26
+
+import os
+
+EXT_TIMED = 13          # extended opcode
+MAX_OPS = 1024
+MAX_US = 10000000       # last op after the start
+PS_MAX = 1024           # longest PSRAM write
+
+# op word: type byte, register argument or not
+OPS = {
+    "r":  (0, True),    # US r REG
+    "w":  (1, True),    # US w REG DATA
+    "pw": (2, False),   # US pw ADDR <file> - PSRAM from a host file
+}
+
+def word(v):
+    return (v & 0xFFFFFFFF).to_bytes(4, byteorder='little')
+
+# turn an op list file into what the firmware runs, one op per line as
+# "US OP ARGS" with US the time after the start and # starting a comment.
+# Files for pw are relative to the list. Raises ValueError naming the bad line
+def assemble(name):
+    body = bytearray()
+    last = 0
+    count = 0
+    with open(name, "r") as file:
+        for num, line in enumerate(file, 1):
+            tok = line.split("#")[0].split()
+            if not len(tok):
+                continue
+            try:
+                at = int(tok[0], 0)
+                typ, has_reg = OPS[tok[1]]
+                args = tok[2:]
+                if at < last or at > MAX_US or count == MAX_OPS:
+                    raise ValueError
+                if tok[1] == "pw":
+                    if len(args) != 2:
+                        raise ValueError
+                    with open(os.path.join(os.path.dirname(name), args[1]), "rb") as data:
+                        data = data.read()
+                    if len(data) > PS_MAX:
+                        raise ValueError
+                    body += word(at) + bytes([typ, 0]) + word(int(args[0], 0)) + \
+                            word(len(data)) + data
+                else:
+                    if len(args) != (2 if tok[1] == "w" else 1):
+                        raise ValueError
+                    body += word(at) + bytes([typ, int(args[0], 0) & 0x7f])
+                    if tok[1] == "w":
+                        body += word(int(args[1], 0))
+                last = at
+                count += 1
+            except (IndexError, KeyError, ValueError, OSError) as e:
+                raise ValueError("%s line %d: %s" % (name, num, line.strip())) from e
+    if not count:
+        raise ValueError("%s: no ops" % name)
+    return bytes(body)
+
+# reply: ops run, worst and mean error, then time due, error, time taken and
+# value per op
+def parse_result(data):
+    if len(data) < 12:
+        return None
+    hdr = [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(3)]
+    log = []
+    for i in range(hdr[0]):
+        entry = data[12+16*i:28+16*i]
+        if len(entry) < 16:
+            break
+        log.append((int.from_bytes(entry[0:4], byteorder='little'), \
+                    int.from_bytes(entry[4:8], byteorder='little', signed=True), \
+                    int.from_bytes(entry[8:12], byteorder='little'), \
+                    int.from_bytes(entry[12:16], byteorder='little')))
+    return hdr, log
+
+# op letters in order, to label the log
+def op_names(body):
+    names = []
+    i = 0
+    while i < len(body):
+        typ = body[i+4]
+        names.append([k for k, v in OPS.items() if v[0] == typ][0])
+        i += 6
+        if typ == OPS["w"][0]:
+            i += 4
+        elif typ == OPS["pw"][0]:
+            i += 8 + int.from_bytes(body[i+4:i+8], byteorder='little')
+    return names
+
+# print the log and how close to time things ran, reads show their value
+def report(body, res):
+    hdr, log = res
+    ops = op_names(body)
+    for (at, err, us, val), typ in zip(log, ops):
+        print("%8d us %+5d us %4d us" % (at, err, us), \
+              typ if typ != "r" else "r = " + hex(val))
+    errs = sorted(abs(e) for _, e, _, _ in log)
+    if errs:
+        p99 = errs[min(len(errs) - 1, (99 * len(errs)) // 100)]
+        print("Ran", hdr[0], "ops, timing error max", hdr[1], "us mean", hdr[2], \
+              "us p99", p99, "us")
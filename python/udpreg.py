@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# low-latency register access over UDP with the ICE-V Wireless
+# 10-17-26
+
+import sys
+import getopt
+import socket
+import time
+
+REQ_MAGIC = 0xC3A5      # request: magic, seq, ops
+REP_MAGIC = 0xC3A6      # reply: magic, seq, err, count, data
+WRITE = 0x80            # op byte: write flag | register
+MAX_OPS = 64
+
+# register reads and writes as datagrams. Lost requests or replies are
+# retried with the same sequence number, which the ESP32C3 recognizes so
+# writes don't happen twice
+class UdpRegs:
+    def __init__(self, addr, port=3335, timeout=0.05, retries=5):
+        self.s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.s.connect((socket.gethostbyname(addr), port))
+        self.s.settimeout(timeout)
+        self.retries = retries
+        self.seq = 0
+        self.resent = 0
+
+    def close(self):
+        self.s.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    # ops are (reg,) to read or (reg, data) to write, all done in one turn
+    # at the FPGA. Returns a word per op - the value read or written
+    def batch(self, ops):
+        if len(ops) > MAX_OPS:
+            raise ValueError("at most %d ops per request" % MAX_OPS)
+        self.seq = (self.seq + 1) & 0xFFFF
+        req = REQ_MAGIC.to_bytes(2, byteorder='little') + \
+              self.seq.to_bytes(2, byteorder='little')
+        for op in ops:
+            if len(op) > 1:
+                req += bytes([WRITE | (op[0] & 0x7f)]) + \
+                       (op[1] & 0xFFFFFFFF).to_bytes(4, byteorder='little')
+            else:
+                req += bytes([op[0] & 0x7f])
+
+        for attempt in range(self.retries + 1):
+            if attempt:
+                self.resent += 1
+            self.s.send(req)
+            try:
+                while True:
+                    rep = self.s.recv(2048)
+                    # late replies to earlier requests are dropped
+                    if len(rep) >= 6 and \
+                       int.from_bytes(rep[0:2], byteorder='little') == REP_MAGIC and \
+                       int.from_bytes(rep[2:4], byteorder='little') == self.seq:
+                        break
+            except (socket.timeout, ConnectionRefusedError):
+                continue
+            if rep[4]:
+                raise IOError("register request error %d" % rep[4])
+            return [int.from_bytes(rep[6+4*i:10+4*i], byteorder='little') \
+                    for i in range(rep[5])]
+        raise TimeoutError("no reply after %d tries" % (self.retries + 1))
+
+    def read(self, reg):
+        return self.batch([(reg,)])[0]
+
+    def write(self, reg, data):
+        self.batch([(reg, data)])
+
+def pct(lat, p):
+    lat = sorted(lat)
+    return 1000 * lat[min(len(lat) - 1, int(p * len(lat)))]
+
+# time count calls of fn, print p50/p99
+def bench(name, fn, count):
+    lat = []
+    for i in range(count):
+        start = time.perf_counter()
+        fn(i)
+        lat.append(time.perf_counter() - start)
+    print("%-20s %8d %9.3f %9.3f %9.3f" % \
+          (name, count, pct(lat, 0.5), pct(lat, 0.99), 1000 * max(lat)))
+
+# usage text for command line
+def usage():
+    print(sys.argv[0], " [options] register access latency benchmark")
+    print("  -h, --help              : this message")
+    print("  -a, --address=ip_addr   : address of ESP32C3 (default ICE-V.local)")
+    print("  -p, --port=portnum      : UDP port (default 3335)")
+    print("  -n, --count=N           : requests per test (default 1000)")
+    print("  -r, --reg=REG           : register to use (default 0)")
+    print("      --batch=N           : reads per batch test (default 16)")
+    print("      --tcp=portnum       : also time TCP session reads on this port")
+
+# main entry
+if __name__ == "__main__":
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "ha:p:n:r:", \
+            ["help", "address=", "port=", "count=", "reg=", "batch=", "tcp="])
+    except getopt.GetoptError as err:
+        print(err)
+        usage()
+        sys.exit(2)
+
+    # defaults
+    addr = "ICE-V.local"
+    port = 3335
+    count = 1000
+    reg = 0
+    nbatch = 16
+    tcp = None
+
+    for o, a in opts:
+        if o in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif o in ("-a", "--address"):
+            addr = a
+        elif o in ("-p", "--port"):
+            port = int(a)
+        elif o in ("-n", "--count"):
+            count = int(a)
+        elif o in ("-r", "--reg"):
+            reg = int(a)
+        elif o == "--batch":
+            nbatch = int(a)
+        elif o == "--tcp":
+            tcp = int(a)
+
+    print("%-20s %8s %9s %9s %9s" % ("test", "count", "p50 ms", "p99 ms", "max ms"))
+    with UdpRegs(addr, port) as u:
+        bench("udp read", lambda i: u.read(reg), count)
+        bench("udp write", lambda i: u.write(reg, i), count)
+        bench("udp batch x%d" % nbatch, lambda i: u.batch([(reg,)] * nbatch), count)
+        if u.resent:
+            print(u.resent, "requests resent")
+    if tcp:
+        import session
+        with session.Session(addr, tcp) as s:
+            bench("tcp session read", lambda i: s.result(s.read_reg(reg)), count)
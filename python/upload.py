@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# chunked, CRC-checked, resumable uploads to the ICE-V Wireless
+# 10-17-26
+
+import sys
+import time
+import zlib
+
+EXT_BEGIN = 7       # extended opcodes
+EXT_CHUNK = 8
+EXT_STATUS = 9
+CHUNK_ERR = 0x20    # chunk corrupt or out of place
+DIRTY_ERR = 0x80    # PSRAM write failed its CRC32 after landing
+
+# reply words: cmd, size, CRC32, offset, error, data
+def parse_status(data):
+    if len(data) < 24:
+        return None
+    return [int.from_bytes(data[4*i:4*i+4], byteorder='little') for i in range(6)]
+
+# send payload - what command cmd would carry - in chunks. ext(op, args)
+# sends an extended command and returns error and reply data, raising
+# OSError if the link fails. After a failure the firmware is asked how
+# far it got and the upload carries on from there. Returns error & data.
+def upload(ext, cmd, payload, chunk=8192, retries=10):
+    ident = [cmd, len(payload), zlib.crc32(payload)]
+
+    # an unfinished upload of the same payload is carried on with
+    err, data = ext(EXT_STATUS, b"")
+    st = parse_status(data)
+    if st and st[0:3] == ident and st[3] < ident[1]:
+        offset = st[3]
+        print("Resuming upload at", offset, file=sys.stderr)
+    else:
+        err, data = ext(EXT_BEGIN, b"".join([v.to_bytes(4, byteorder='little') for v in ident]))
+        if err:
+            return err, 0
+        offset = 0
+
+    fails = 0
+    while True:
+        try:
+            part = payload[offset:offset+chunk]
+            args = b"".join([offset.to_bytes(4, byteorder='little'), \
+                             zlib.crc32(part).to_bytes(4, byteorder='little'), part])
+            err, data = ext(EXT_CHUNK, args)
+            st = parse_status(data)
+            if st is None:
+                raise IOError("no reply to chunk at %d" % offset)
+            if st[0:3] != ident:
+                return err if err else 8, 0
+            if err & CHUNK_ERR:
+                raise IOError("chunk at %d refused" % offset)
+            if err or st[3] == ident[1]:
+                return err, st[5]
+            offset = st[3]
+            fails = 0
+        except (OSError, ConnectionError) as e:
+            fails += 1
+            if fails > retries:
+                print("Giving up:", e, file=sys.stderr)
+                return 64, 0
+            print(e, "- retrying", file=sys.stderr)
+            time.sleep(0.2 * fails)
+
+            # find out where it got to
+            try:
+                err, data = ext(EXT_STATUS, b"")
+            except OSError:
+                continue
+            st = parse_status(data)
+            if st is None:
+                continue
+            if st[0:3] != ident:
+                print("Upload lost", file=sys.stderr)
+                return 8, 0
+            if st[3] == ident[1]:
+                return st[4], st[5]
+            offset = st[3]